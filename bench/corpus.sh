@@ -0,0 +1,39 @@
+#!/bin/sh
+# Generates the pathological pages `make bench` loads into tocaia.
+# Usage: bench/corpus.sh DIR
+
+set -e
+dir=${1:-bench/corpus}
+mkdir -p "$dir"
+
+# Bytes of a single repeated character, without a trailing newline.
+repeat() {
+	head -c "$2" /dev/zero | tr '\0' "$1"
+}
+
+# Text: 40 lines of 2MB each.
+i=0
+while [ $i -lt 40 ]; do
+	repeat a 2097152
+	echo
+	i=$((i + 1))
+done > "$dir/longlines"
+
+# Text: one 64MB line with no newline at all.
+repeat b 67108864 > "$dir/oneline"
+
+# Menu: a single item line of 8M tabs.
+{ printf '1'; repeat '\t' 8388608; printf '\r\n.\r\n'; } > "$dir/tabs"
+
+# Menu: 2M tiny items.
+awk 'BEGIN { for (i = 0; i < 2097152; i++) printf "0x\t/x\th\t70\r\n"; printf ".\r\n" }' > "$dir/tiny"
+
+# Menu: 100 items with 200KB display strings.
+i=0
+while [ $i -lt 100 ]; do
+	printf '0'
+	repeat c 204800
+	printf '\t/c\tlocalhost\t70\r\n'
+	i=$((i + 1))
+done > "$dir/display"
+printf '.\r\n' >> "$dir/display"
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Loads each page of the pathological corpus into tocaia and scrolls
+through it, failing when a case runs past its time or memory limit.
+
+Usage: bench/run.py TOCAIA CORPUS_DIR
+
+The pages are served over Gopher from this script. tocaia runs in a
+pseudo-terminal under `ulimit -v`, so a case that needs more address
+space than its limit fails instead of passing slowly."""
+
+import fcntl
+import os
+import pty
+import select
+import shutil
+import socket
+import struct
+import sys
+import tempfile
+import termios
+import threading
+import time
+
+# Name, item type, time limit in seconds, address space limit in MB.
+CASES = [
+    ("longlines", "0", 3, 256),
+    ("oneline", "0", 5, 256),
+    ("tabs", "1", 3, 64),
+    ("tiny", "1", 12, 160),
+    ("display", "1", 3, 96),
+]
+KEYS = 300
+ARROW_DOWN = b"\x1b[B"
+PAGE_DOWN = b"\x1b[6~"[:3]
+
+
+def serve(listener, corpus):
+    while True:
+        client, _ = listener.accept()
+        threading.Thread(target=answer, args=(client, corpus), daemon=True).start()
+
+
+def answer(client, corpus):
+    with client:
+        request = b""
+        while b"\n" not in request:
+            data = client.recv(4096)
+            if not data:
+                return
+            request += data
+        name = os.path.basename(request.split(b"\r")[0].split(b"\n")[0].decode())
+        path = os.path.join(corpus, name)
+        try:
+            if not os.path.isfile(path):
+                client.sendall(b"3Not found\t\terror.host\t1\r\n.\r\n")
+                return
+            with open(path, "rb") as page:
+                client.sendfile(page)
+        except OSError:
+            pass  # A case that failed its limits hung up early.
+
+
+def read_screen(fd, deadline):
+    """Waits for output and reads what is there; b"" once tocaia has exited
+    or the deadline has passed."""
+    while time.time() < deadline:
+        ready, _, _ = select.select([fd], [], [], 0.05)
+        if ready:
+            try:
+                return os.read(fd, 1 << 20)
+            except OSError:
+                return b""
+    return b""
+
+
+def run_case(tocaia, port, home, name, item_type, seconds, megabytes):
+    url = "gopher://127.0.0.1:%d/%s/%s" % (port, item_type, name)
+    started = time.time()
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.environ["TOCAIA_HOME"] = home
+        os.execv("/bin/sh", ["sh", "-c", 'ulimit -v %d && exec "$0" "$1"' % (megabytes * 1024), tocaia, url])
+    fcntl.ioctl(fd, termios.TIOCSWINSZ, struct.pack("HHHH", 40, 100, 0, 0))
+
+    # Keys typed during the fetch would cancel it, so the first one waits
+    # for the page's header. Each one after waits for the redraw of the last.
+    deadline = started + seconds
+    screen = b""
+    while url.encode() not in screen[-(1 << 16):]:
+        output = read_screen(fd, deadline)
+        if not output:
+            break
+        screen += output
+    for i in range(KEYS + 1):
+        key = b"q" if i == KEYS else PAGE_DOWN if i % 10 == 9 else ARROW_DOWN
+        try:
+            os.write(fd, key)
+        except OSError:
+            break
+        if not read_screen(fd, deadline):
+            break
+    pid_done = 0
+    while not pid_done and time.time() < deadline:
+        read_screen(fd, min(deadline, time.time() + 0.05))
+        pid_done, status, usage = os.wait4(pid, os.WNOHANG)
+
+    elapsed = time.time() - started
+    if not pid_done:
+        try:
+            os.kill(pid, 9)
+        except ProcessLookupError:
+            pass
+        pid_done, status, usage = os.wait4(pid, 0)
+    os.close(fd)
+
+    ok = elapsed < seconds and os.WIFEXITED(status) and os.WEXITSTATUS(status) == 0
+    print("%-10s %6.2fs %5dMB max RSS  %s (limits %ds, %dMB)" % (
+        name, elapsed, usage.ru_maxrss // 1024, "ok" if ok else "FAIL", seconds, megabytes))
+    return ok
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    tocaia = os.path.abspath(sys.argv[1])
+    corpus = sys.argv[2]
+
+    listener = socket.socket()
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(16)
+    threading.Thread(target=serve, args=(listener, corpus), daemon=True).start()
+    port = listener.getsockname()[1]
+
+    home = tempfile.mkdtemp(prefix="tocaia-bench-")
+    try:
+        failed = 0
+        for name, item_type, seconds, megabytes in CASES:
+            if not run_case(tocaia, port, home, name, item_type, seconds, megabytes):
+                failed += 1
+    finally:
+        shutil.rmtree(home)
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -5,6 +5,8 @@
  * See LICENSE file for copyright and license details.
 */
 
+#define _XOPEN_SOURCE 600
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +20,17 @@
 #include <sys/select.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #define PROGRAM_VERSION "0.8.0"
 
@@ -29,6 +42,179 @@
 #define MAX_DISPLAY_LENGTH 1024
 #define MAX_CONTENT_DISPLAY_WIDTH 78
 #define MAX_URL_INPUT_LENGTH (MAX_HOST_LENGTH + MAX_SELECTOR_LENGTH + 10)
+#define MAX_CACHE_KEY_LENGTH (MAX_HOST_LENGTH + MAX_SELECTOR_LENGTH + 8)
+#define MAX_PATH_LENGTH 1024
+#define MAX_TITLE_LENGTH 72
+/* Longest menu line kept for parsing: each field clipped to its item field. */
+#define MAX_MENU_LINE_LENGTH (MAX_DISPLAY_LENGTH + MAX_SELECTOR_LENGTH + MAX_HOST_LENGTH + 24)
+
+/* Shared cache segment geometry. Pages larger than a slot are not shared. */
+#define SHARED_CACHE_MAGIC 0x74636333UL
+#define SHARED_CACHE_SLOTS 256
+#define SHARED_CACHE_DATA_SIZE (64 * 1024)
+#define SHARED_CACHE_PROBES 8
+#define SHARED_CACHE_TTL 300
+#define SHARED_CACHE_INFLIGHT 64
+#define INFLIGHT_POLL_MS 50
+#define INFLIGHT_WAIT_MS 30000
+
+/* Caching proxy mode. */
+#define PROXY_BACKLOG 64
+#define PROXY_DEFAULT_ADDRESS "127.0.0.1"
+#define PROXY_GOPHER_PORT 70
+
+/* Hash sets start at this many slots. Must be a power of two. */
+#define HASH_SET_INITIAL 1024
+
+/* Sharded crawl mode. */
+#define CRAWL_MAX_SHARDS 256
+#define CRAWL_IDLE_MS 30000
+#define CRAWL_POLL_MS 200
+#define CRAWL_READ_SIZE (64 * 1024)
+#define CRAWL_BATCH_PAGES 256
+
+/* Gophermap lint mode. */
+#define LINT_MAX_WORKERS 64
+#define LINT_CHUNK_SIZE (8 * 1024 * 1024)
+#define LINT_SCHEDULE_WINDOW 64
+#define LINT_LOCAL 'L'
+#define LINT_MENU  'M'
+#define LINT_PROBE 'P'
+
+/* Fetch telemetry tables. Sizes must be powers of two. */
+#define TELEMETRY_LINK_SLOTS 1024
+#define TELEMETRY_HOST_SLOTS 256
+#define TELEMETRY_PROBES 4
+#define SLOW_FETCH_MS 1500
+
+/* Timing records of recent fetches, for the waterfall view. */
+#define FETCH_TIMING_SLOTS 64
+#define FETCH_TIMING_LABEL_LENGTH 96
+#define WATERFALL_MAX_WIDTH 255
+
+/* Watchdog process of the interactive browser (--watchdog). It appends a
+ * diagnostic dump to <data dir>/watchdog.log when typed input has waited
+ * WATCHDOG_STALL_MS without being read, or when a page fetch has had no
+ * first byte after WATCHDOG_FETCH_FACTOR times its host's last latency
+ * (and at least WATCHDOG_FETCH_MIN_MS). Past WATCHDOG_LOG_MAX the log is
+ * renamed to watchdog.log.1, replacing the previous one. Histogram bucket
+ * i counts times under 2^i ms; the last one counts everything longer. */
+#define WATCHDOG_FILE "watchdog.log"
+#define WATCHDOG_OLD_FILE "watchdog.log.1"
+#define WATCHDOG_LOG_MAX (256 * 1024L)
+#define WATCHDOG_POLL_MS 100
+#define WATCHDOG_STALL_MS 2000
+#define WATCHDOG_FETCH_FACTOR 4
+#define WATCHDOG_FETCH_MIN_MS 5000
+#define WATCHDOG_BUCKETS 14
+
+/* Network timeouts and the per-host circuit breaker. */
+#define CONNECT_TIMEOUT_MS 10000
+#define READ_TIMEOUT_MS 30000
+#define BREAKER_THRESHOLD 3
+#define BREAKER_BASE_BACKOFF_MS 2000UL
+#define BREAKER_MAX_BACKOFF_MS 300000UL
+
+/* Mirror groups: hosts serving the same selectors, listed one group per
+ * line in <data dir>/mirrors. A fetch starts at the member with the lowest
+ * median first byte time and hedges to the next one once the first has
+ * taken longer than MIRROR_HEDGE_PERCENTILE percent of its fetches did. */
+#define MIRROR_FILE "mirrors"
+#define MIRROR_MAX_HOSTS 64
+#define MIRROR_SAMPLES 16
+#define MIRROR_MIN_SAMPLES 4
+#define MIRROR_HEDGE_PERCENTILE 90
+#define MIRROR_HEDGE_DEFAULT_MS 500
+#define MIRROR_HEDGE_MIN_MS 20
+#define MIRROR_RACERS 2
+
+/* Data-saver mode (--budget): bytes received count against a budget for
+ * the session. Speculative fetches stop once less than
+ * BUDGET_RESERVE_PERCENT of it is left, and all fetches once none is. */
+#define BUDGET_RESERVE_PERCENT 10
+
+/* Full-text index over every page fetched. */
+#define INDEX_BUCKETS 256
+#define INDEX_DOC_RECORD 16
+#define INDEX_POSTING_RECORD 8
+#define INDEX_MAX_DOCS 0xffffffUL
+#define INDEX_MAX_QUERY_TERMS 8
+#define INDEX_MAX_RESULTS 50
+
+/* Global history log and its trigram signatures. */
+#define HISTORY_RECORD 40
+#define HISTORY_SIGNATURE_BITS 256
+#define HISTORY_MAX_RESULTS 64
+#define MIN_TOKEN_LENGTH 2
+#define MAX_TOKEN_LENGTH 40
+
+/* Concurrent link checker. */
+#define CHECK_MAX_PARALLEL 16
+#define CHECK_RESOLVE_SLOTS 64 /* Power of two. */
+
+/* Per-host concurrency of bulk fetches, tuned by AIMD. A fetch slower than
+ * HOST_SLOWDOWN_FACTOR times the host's usual latency counts as congestion. */
+#define HOST_CONCURRENCY_INITIAL 2
+#define HOST_CONCURRENCY_MAX 16
+#define HOST_SLOWDOWN_FACTOR 2
+#define HOST_SLOWDOWN_MIN_MS 100
+
+/* Split-pane preview of the highlighted menu item. */
+#define PREVIEW_MIN_COLUMNS 120
+#define PREVIEW_MAX_WIDTH 255
+#define PREVIEW_MAX_BYTES (16 * 1024)
+#define PREVIEW_CACHE_SLOTS 64 /* Power of two. */
+#define PREVIEW_DELAY_MS 150
+
+/* Follow mode of the text viewer. */
+#define FOLLOW_INTERVAL_MS 2000
+
+/* Hex viewer for binary items, which are spilled to a temporary file. */
+#define HEX_BYTES_PER_ROW 16
+#define MAX_BYTE_PATTERN 64
+#define SPILL_CHUNK_SIZE (64 * 1024)
+#define SPILL_PROGRESS_BYTES (1024UL * 1024UL)
+
+/* Copies of text pages kept to highlight what changed since the last visit.
+ * Bodies are stored once per content in PAGE_STORE_BLOB_DIR; unreferenced
+ * ones are removed once they are PAGE_STORE_SWEEP_AGE seconds old. */
+#define PAGE_STORE_DIR "pages"
+#define PAGE_STORE_BLOB_DIR "pages/blobs"
+#define PAGE_STORE_MAX_SIZE (64UL * 1024UL * 1024UL)
+#define PAGE_STORE_SWEEP_AGE 60
+
+/* Parsed indexes of menus at least this large are saved next to the page
+ * store and mapped back in instead of reparsing the menu. */
+#define MENU_INDEX_MAGIC 0x746d6931UL
+#define MENU_INDEX_MIN_BODY (64 * 1024)
+
+/* Menu items are parsed on demand into this many cache slots (power of two). */
+#define ITEM_CACHE_SLOTS 128
+
+/* Flags for fetch_resource(). */
+#define FETCH_USE_CACHE  1
+#define FETCH_RETRY      2
+#define FETCH_ANY_MIRROR 4 /* Race the host's mirror group, if it has one. */
+
+/* Phases of a timed fetch, in the order they end. */
+#define FETCH_RESOLVED   0
+#define FETCH_CONNECTED  1
+#define FETCH_FIRST_BYTE 2
+#define FETCH_FINISHED   3
+#define FETCH_PHASES     4
+
+/* Why a fetch was made, most urgent first. */
+#define FETCH_PRIORITY_PAGE    0 /* The user is waiting on it. */
+#define FETCH_PRIORITY_FOLLOW  1
+#define FETCH_PRIORITY_PREVIEW 2
+#define FETCH_PRIORITY_CHECK   3
+#define FETCH_PRIORITY_MIRROR  4 /* One replica raced for a page. */
+
+/* How a timed fetch ended. */
+#define FETCH_DONE      0
+#define FETCH_FAILED    1
+#define FETCH_CANCELLED 2
+#define FETCH_CACHE_HIT 3
 
 /* A boolean type for C89 compatibility. */
 typedef int BOOL;
@@ -54,6 +240,11 @@ typedef int BOOL;
 #define SEPARATOR_COLOR     "\033[0;90m"
 #define HEADER_BG           "\033[48;5;17m"
 #define HEADER_FG           "\033[1;37m"
+#define TELEMETRY_COLOR     "\033[0;36m"
+#define SLOW_HOST_COLOR     "\033[0;33m"
+#define DEAD_HOST_COLOR     "\033[0;31m"
+#define ADDED_LINE_COLOR    "\033[1;32m"
+#define CHANGED_LINE_COLOR  "\033[1;36m"
 
 /* Key Code Definitions */
 #define KEY_UP              'A'
@@ -74,8 +265,62 @@ typedef struct GopherItem {
 	int port;
 	BOOL is_selectable;
 	int menu_index;
+	unsigned long link_hash; /* Telemetry keys, computed once at parse time. */
+	unsigned long host_hash;
 } GopherItem;
 
+/* Bits of MenuIndex.flags. */
+#define ITEM_SELECTABLE 0x01
+#define ITEM_LIVE       0x02 /* Link checker results. */
+#define ITEM_SLOW       0x04
+#define ITEM_DEAD       0x08
+#define ITEM_QUEUED     0x10 /* Waiting for the link checker. */
+#define ITEM_CHECKING   0x20 /* Probe in flight. */
+#define ITEM_CHECK_BITS (ITEM_LIVE | ITEM_SLOW | ITEM_DEAD | ITEM_QUEUED | ITEM_CHECKING)
+
+/* Column-oriented copy of the fields that whole-menu scans need. Keeping
+ * them in dense arrays lets selection, coloring and per-type scans walk a
+ * few bytes per item instead of striding over GopherItem records, which are
+ * only parsed for the rows on screen. The columns of a large menu may live
+ * in a private mapping of its saved index instead of the heap. */
+typedef struct MenuIndex {
+	int count;
+	int capacity;
+	int selectable_count;
+	char *types;
+	unsigned char *flags;
+	unsigned long *offsets;     /* Start of each item's line in the page. */
+	unsigned long *link_hashes; /* Telemetry keys; 0 for non-links. */
+	unsigned long *host_hashes;
+	int *selectable_map;        /* menu_index - 1 -> item index. */
+	void *mapping;
+	size_t mapping_size;
+} MenuIndex;
+
+/* Header of a saved menu index, followed by the offsets, link_hashes and
+ * host_hashes columns, the selectable map, then the types and flags.
+ * Written in native byte order; a foreign file fails the magic check. */
+typedef struct MenuIndexHeader {
+	unsigned long magic;
+	unsigned long body_hash;
+	unsigned long body_length;
+	unsigned long count;
+	unsigned long selectable_count;
+} MenuIndexHeader;
+
+/* Marks in LineIndex.marks. */
+#define LINE_ADDED   1
+#define LINE_CHANGED 2
+
+/* Start offset of every line of a text page, built once per fetch. */
+typedef struct LineIndex {
+	int count;
+	int capacity;
+	unsigned long *offsets;
+	unsigned char *marks;  /* Changes since the last visit, or NULL. */
+	int changed_lines;
+} LineIndex;
+
 /* Represents a node in the navigation history (a doubly-linked list). */
 typedef struct NavigationState {
 	char host[MAX_HOST_LENGTH];
@@ -83,14 +328,87 @@ typedef struct NavigationState {
 	char selector[MAX_SELECTOR_LENGTH];
 	char *page_content;
 	char type;
+	BOOL is_error_page;
+	BOOL is_local; /* Generated by tocaia itself; never fetched. */
+	char title[MAX_TITLE_LENGTH + 1]; /* Display string of the link followed, if any. */
+	LineIndex lines;
 	struct NavigationState *prev;
 	struct NavigationState *next;
 } NavigationState;
 
+/* A host name resolved once for the duration of a link check,
+ * or per menu by the preview pane. */
+typedef struct ResolvedHost {
+	unsigned long host_hash;
+	BOOL in_use;
+	BOOL pending; /* A resolver is still looking it up. */
+	BOOL found;
+	struct in_addr addr;
+} ResolvedHost;
+
+/* One in-flight connect and first-byte probe, used by the link checker
+ * and the preview pane. While the host name is looked up, `sock` is the
+ * pipe of a forked resolver instead, so the lookup never blocks a loop. */
+typedef struct LinkProbe {
+	int item; /* Menu item being checked, or -1 when the slot is free. */
+	int sock;
+	BOOL resolving;
+	BOOL connected;
+	pid_t resolver;
+	ResolvedHost *host; /* Where to keep the address, or NULL. */
+	int port;
+	unsigned long started_ms;
+	unsigned long host_hash;
+	unsigned long timing; /* Its record for the waterfall view. */
+} LinkProbe;
+
+/* The start of a page kept for the preview pane. */
+typedef struct PreviewEntry {
+	unsigned long link_hash;
+	char *data;
+	size_t length;
+} PreviewEntry;
+
+/* Preview of the highlighted menu item, shown beside the menu on wide
+ * terminals. Fetches are started once the selection rests and dropped as
+ * soon as it moves, so they never hold up the cursor. */
+typedef struct Preview {
+	int item; /* Menu item the pane is showing, or -1. */
+	BOOL pending;
+	unsigned long start_at_ms;
+	LinkProbe probe;
+	char *buffer;
+	size_t length;
+	const char *status;
+	ResolvedHost hosts[CHECK_RESOLVE_SLOTS];
+	PreviewEntry cache[PREVIEW_CACHE_SLOTS];
+} Preview;
+
+/* Follow mode of the text viewer: the page is refetched on an interval and
+ * only what was added past its known body is appended. */
+typedef struct Follow {
+	BOOL active;
+	struct NavigationState *nav;
+	unsigned long next_at_ms;
+	LinkProbe probe; /* item is 0 while a refetch is in flight, else -1. */
+	size_t body_length;
+	size_t keep;     /* Bytes the new body must repeat: the old one minus its terminator. */
+	size_t received;
+	BOOL rewritten;  /* The new body does not extend the old one. */
+	char *buffer;    /* The tail, or the whole new body once rewritten. */
+	size_t length;
+	size_t capacity;
+	const char *status;
+	ResolvedHost hosts[CHECK_RESOLVE_SLOTS];
+} Follow;
+
 /* Holds the entire state of the application. */
 typedef struct AppState {
 	NavigationState *current_nav;
-	GopherItem *gopher_items;
+	MenuIndex menu;
+	BOOL menu_stale;           /* The menu index needs rebuilding. */
+	GopherItem *item_cache;    /* ITEM_CACHE_SLOTS parsed items. */
+	int *item_cache_ids;
 	int total_items;
 	int selectable_items;
 	int selected_index;
@@ -98,22 +416,351 @@ typedef struct AppState {
 	int text_scroll_line;
 	int total_content_lines;
 	BOOL is_running;
+	BOOL reload_requested;
+	BOOL show_telemetry;
+	BOOL show_waterfall; /* Recent fetches are drawn in place of the menu. */
+	Preview preview;
+	Follow follow;
 	struct winsize terminal_size;
 } AppState;
 
+/* A fetch some process is currently making on behalf of all of them. */
+typedef struct SharedInflight {
+	unsigned long key_hash;
+	long pid;
+	long started_at;
+	BOOL unshared; /* The claimant expects a body too large to share. */
+} SharedInflight;
+
+/* Header at the start of the shared cache segment. */
+typedef struct SharedCacheHeader {
+	unsigned long magic;
+	unsigned long slot_count;
+	unsigned long data_size;
+	volatile unsigned long clock; /* LRU tick shared by every process. */
+	SharedInflight inflight[SHARED_CACHE_INFLIGHT];
+} SharedCacheHeader;
+
+/* A cached page. Readers never lock: a slot is only trusted when its
+ * sequence is even and unchanged across the copy and the body hash matches. */
+typedef struct SharedCacheSlot {
+	volatile unsigned long sequence;
+	unsigned long key_hash;
+	unsigned long body_hash;
+	volatile unsigned long last_used;
+	long stored_at;
+	unsigned long length;
+	char key[MAX_CACHE_KEY_LENGTH];
+	char data[SHARED_CACHE_DATA_SIZE];
+} SharedCacheSlot;
+
+/* Process-local handle on the shared cache segment. */
+typedef struct SharedCache {
+	int fd;
+	size_t size;
+	SharedCacheHeader *header;
+	SharedCacheSlot *slots;
+} SharedCache;
+
+/* Last observed outcome of fetching a link or any link on a host.
+ * Host entries also carry the host's circuit breaker. */
+typedef struct FetchTelemetry {
+	unsigned long key_hash;
+	BOOL in_use;
+	BOOL failed;
+	unsigned long latency_ms;
+	unsigned long size;
+	int consecutive_failures;
+	unsigned long retry_at_ms;
+	unsigned long backoff_ms;
+	unsigned char probe_flags; /* Last link checker result, as ITEM_* bits. */
+	unsigned long probe_ms;
+	int concurrency; /* Parallel bulk fetches allowed; 0 until first tuned. */
+	int concurrency_credit; /* Successes since the limit last grew. */
+	unsigned long baseline_ms; /* Smoothed latency of successful fetches. */
+	unsigned long decreased_at_ms;
+	unsigned long bytes_received; /* This session; kept for hosts only. */
+} FetchTelemetry;
+
+/* A member of a mirror group, with the first byte times of its recent
+ * fetches. Fetches that lost a race add how long they had waited. */
+typedef struct MirrorHost {
+	char host[MAX_HOST_LENGTH];
+	int port;
+	int group;
+	unsigned long first_byte_ms[MIRROR_SAMPLES];
+	int samples; /* Recorded so far; the ring keeps the last MIRROR_SAMPLES. */
+} MirrorHost;
+
+/* Timing of one fetch for the waterfall view. Each phase time is when
+ * that phase ended; only the first `phase` of them are set. */
+typedef struct FetchTiming {
+	unsigned long id; /* 0 while the slot is unused. */
+	char label[FETCH_TIMING_LABEL_LENGTH];
+	int priority;
+	int result;
+	int phase;
+	unsigned long started_ms;
+	unsigned long phase_ms[FETCH_PHASES];
+	unsigned long size;
+	unsigned long expected_ms; /* First byte later than this is reported by the watchdog. */
+} FetchTiming;
+
+/* Memory shared with the watchdog process: a snapshot of the browser
+ * taken on every pass of its input loops, latency histograms and the ring
+ * of recent fetches. The watchdog only reads it, and a torn read at worst
+ * garbles one line of a dump. */
+typedef struct WatchdogState {
+	volatile unsigned long tick_ms; /* Last pass of an input loop. */
+	unsigned long frame_ms[WATCHDOG_BUCKETS]; /* Key press to redrawn screen. */
+	unsigned long fetch_ms[WATCHDOG_BUCKETS]; /* Network fetches, start to end. */
+	char url[MAX_URL_INPUT_LENGTH];
+	const char *page; /* Page whose length was last taken; main process only. */
+	unsigned long page_length;
+	BOOL is_menu;
+	int menu_items;
+	int menu_links;
+	int selected_index;
+	int scroll_offset;
+	int text_lines;
+	int text_scroll_line;
+	int changed_lines;
+	unsigned long preview_length;
+	BOOL follow_active;
+	unsigned long follow_length;
+	unsigned long follow_capacity;
+	BOOL show_waterfall;
+	int rows;
+	int cols;
+	unsigned long session_bytes;
+	unsigned long budget_bytes;
+	FetchTiming timings[FETCH_TIMING_SLOTS];
+} WatchdogState;
+
+/* How often a term occurs in the page being indexed. */
+typedef struct TermCount {
+	unsigned long term;
+	unsigned long count;
+} TermCount;
+
+/* Newest indexed version of a URL. */
+typedef struct IndexedUrl {
+	unsigned long url_hash;
+	unsigned long content_hash;
+	unsigned long doc_id;
+	BOOL in_use;
+} IndexedUrl;
+
+/* The on-disk inverted index lives in <data dir>/index:
+ *   docs      one "type TAB host TAB port TAB selector TAB title" line per page
+ *   docs.idx  16-byte records: docs offset, token count, URL hash, body hash
+ *   pXX       8-byte postings (term hash, 24-bit doc id, capped term count),
+ *             split into 256 files by the term hash's low byte
+ * All files are append-only and writers serialize on a lock over docs.idx.
+ * This struct mirrors docs.idx in memory for deduplication and ranking. */
+typedef struct SearchIndex {
+	BOOL tried_open;
+	BOOL available;
+	char dir[MAX_PATH_LENGTH];
+	unsigned long doc_count;
+	unsigned long doc_capacity;
+	unsigned long total_tokens;
+	unsigned long *doc_lengths;
+	unsigned long *doc_urls;
+	IndexedUrl *urls;
+	unsigned long url_capacity; /* Power of two. */
+	unsigned long url_count;
+} SearchIndex;
+
+/* A binary item mapped for the hex viewer. Only the visible rows are
+ * ever formatted, so the file can be far larger than memory. */
+typedef struct HexView {
+	const unsigned char *data;
+	size_t length;
+	size_t top_row;
+	size_t match;        /* Offset of the highlighted bytes. */
+	size_t match_length; /* 0 when nothing is highlighted. */
+	unsigned char pattern[MAX_BYTE_PATTERN];
+	size_t pattern_length;
+} HexView;
+
+/* Open-addressed set of 32-bit hashes. */
+typedef struct HashSet {
+	unsigned long *slots; /* 0 marks a free slot. */
+	unsigned long count;
+	unsigned long capacity; /* Power of two. */
+} HashSet;
+
+/* The global history lives in <data dir>:
+ *   history      one "time TAB type TAB host TAB port TAB title TAB selector"
+ *                line per page loaded; the selector goes last as it may
+ *                hold a search query after a tab
+ *   history.idx  40-byte records: history offset, URL hash and a 256-bit
+ *                signature with one bit set per trigram of the title, host
+ *                and selector words
+ * Both are append-only and writers serialize on a lock over history.idx.
+ * The finder maps both and ranks visits by the trigrams they share with
+ * the query. Signatures rule most visits out, so it only reads the log
+ * lines of those that could match. */
+typedef struct HistoryFinder {
+	const unsigned char *records;
+	unsigned long record_count;
+	const char *log;
+	size_t log_length;
+	HashSet seen; /* URLs already ranked, so each is listed once. */
+	unsigned long matches[HISTORY_MAX_RESULTS]; /* Log offsets, best first. */
+	int scores[HISTORY_MAX_RESULTS];
+	int match_count;
+} HistoryFinder;
+
+/* A crawl worker's view of one shard, kept between claims. */
+typedef struct CrawlShard {
+	HashSet seen;
+	off_t seen_offset; /* How much of seen.N is already in `seen`. */
+} CrawlShard;
+
+/* One piece of lint work: a byte range of a local gophermap, a remote menu
+ * to fetch, or a remote link to probe. Sent to workers as-is over a pipe. */
+typedef struct LintUnit {
+	char kind; /* LINT_LOCAL, LINT_MENU or LINT_PROBE. */
+	int file;  /* File the unit's lines belong to, or -1 for probes. */
+	int chunk;
+	int ref_file; /* Where the link to this unit was found, or -1. */
+	long ref_line;
+	off_t start;
+	off_t end;
+	char path[MAX_PATH_LENGTH];
+	char root[MAX_PATH_LENGTH]; /* Directory local selectors resolve against. */
+	char host[MAX_HOST_LENGTH];
+	int port;
+	char selector[MAX_SELECTOR_LENGTH];
+	char type;
+} LintUnit;
+
+/* Results of one unit, held until every earlier chunk of its file is in so
+ * that line numbers can be made absolute. */
+typedef struct LintChunk {
+	BOOL done;
+	char *records; /* "line TAB check TAB detail" lines, relative to the chunk. */
+	size_t length;
+	size_t capacity;
+	long lines;
+	long crlf_lines;
+	long lf_lines;
+	long first_crlf;
+	long first_lf;
+} LintChunk;
+
+typedef struct LintFile {
+	char *name; /* Path or gopher:// URL, as reported. */
+	int chunk_count;
+	int next_chunk; /* First chunk not yet reported. */
+	LintChunk *chunks;
+	long base_line;
+	long crlf_lines;
+	long lf_lines;
+	long first_crlf;
+	long first_lf;
+} LintFile;
+
+typedef struct LintWorker {
+	pid_t pid;
+	int command_fd;
+	int result_fd;
+	BOOL busy;
+	LintUnit unit;
+	unsigned long started_ms;
+	BOOL host_failed; /* The unit's host could not be reached. */
+	char *buffer;
+	size_t length;
+	size_t capacity;
+} LintWorker;
+
+/* State of the parent process during a lint run. */
+typedef struct LintRun {
+	LintFile *files;
+	int file_count;
+	int file_capacity;
+	LintUnit *queue;
+	int queue_head;
+	int queue_count;
+	int queue_capacity;
+	LintWorker workers[LINT_MAX_WORKERS];
+	int worker_count;
+	HashSet seen; /* Remote links already queued. */
+	long issues;
+	long lines;
+	const char *internal_host;
+} LintRun;
+
 /* Flag to indicate a pending terminal resize signal. Must be volatile. */
 volatile sig_atomic_t g_resize_pending = 0;
 /* Stores the original terminal settings to restore on exit. */
 struct termios g_original_termios;
+/* Optional page cache shared between concurrent tocaia processes. */
+SharedCache g_shared_cache = { -1, 0, NULL, NULL };
+/* Telemetry of the fetches made during this session. */
+FetchTelemetry g_link_telemetry[TELEMETRY_LINK_SLOTS];
+FetchTelemetry g_host_telemetry[TELEMETRY_HOST_SLOTS];
+/* Ring of the most recent fetches, by id. It moves into the watchdog's
+ * shared memory when the watchdog starts. */
+FetchTiming g_fetch_timing_ring[FETCH_TIMING_SLOTS];
+FetchTiming *g_fetch_timings = g_fetch_timing_ring;
+unsigned long g_fetch_timing_count;
+/* Timing of the blocking fetch in progress, or 0. */
+unsigned long g_fetch_timing_current;
+/* Reference point for millisecond timings. */
+struct timeval g_start_time;
+/* Why the last call to fetch_resource() returned NULL. */
+char g_fetch_error[128];
+/* Full-text index, opened on first use. */
+SearchIndex g_search_index;
+/* Data-saver budget (0 when there is none), bytes received so far this
+ * session, and the host each socket reads from. */
+unsigned long g_budget_bytes;
+unsigned long g_session_bytes;
+unsigned long g_socket_hosts[FD_SETSIZE];
+/* Mirror groups, read on first use; -1 until then. */
+MirrorHost g_mirrors[MIRROR_MAX_HOSTS];
+int g_mirror_count = -1;
+/* Whether this process has swept the page store's unreferenced blobs. */
+BOOL g_page_store_swept = FALSE;
+/* Terminal to report blocking waits on; NULL outside the interactive browser. */
+const struct winsize *g_status_terminal = NULL;
+/* Memory shared with the watchdog process, or NULL when it is not running. */
+WatchdogState *g_watchdog = NULL;
 
 void run_main_loop(AppState *state);
 void fetch_current_content(AppState *state);
 BOOL is_gopher_menu(const NavigationState *nav);
 void calculate_text_lines(AppState *state, const char *content);
+void line_index_build(LineIndex *lines, const char *content, size_t length);
+void line_index_extend(LineIndex *lines, const char *content, size_t from, size_t length);
+void line_index_free(LineIndex *lines);
+unsigned long *hash_lines(const char *content, const unsigned long *offsets, int count, size_t length);
+unsigned long *line_set_build(const unsigned long *hashes, int count, unsigned long *mask_out);
+BOOL line_set_contains(const unsigned long *set, unsigned long mask, unsigned long hash);
+int diff_lines(const unsigned long *old_hashes, int old_count, const unsigned long *new_hashes, int new_count, unsigned char *marks);
+void diff_against_last_visit(NavigationState *nav, size_t length);
+BOOL page_store_path(const char *key, const char *suffix, char *path);
+BOOL page_store_blob_path(const char *data, size_t length, char *path);
+void *page_store_map(const char *key, const char **body_out, size_t *length_out, size_t *map_length_out);
+BOOL page_store_put_blob(const char *blob_path, const char *data, size_t length);
+void page_store_write(const char *key, const char *data, size_t length);
+void page_store_sweep(void);
+char *page_store_read(const char *key, size_t max_length, size_t *length_out);
+int find_change(const LineIndex *lines, int from, int direction);
 
 void trim_whitespace(char* str);
+size_t copy_menu_line(const char *line, size_t length, char *out);
 BOOL parse_gopher_line(char* line, GopherItem* item, const char* current_host, int current_port);
 void process_gopher_response(AppState* state, const char *data);
+GopherItem *get_menu_item(AppState *state, int index);
+void menu_index_append(MenuIndex *menu, const GopherItem *item, unsigned long offset);
+void menu_index_free(MenuIndex *menu);
+BOOL menu_index_path(const NavigationState *nav, char *path);
+BOOL menu_index_load(MenuIndex *menu, const NavigationState *nav, size_t length, unsigned long body_hash);
+void menu_index_save(const MenuIndex *menu, const NavigationState *nav, size_t length, unsigned long body_hash);
 
 void handle_menu_navigation(AppState *state, char input);
 void handle_menu_action(AppState *state, char input);
@@ -121,6 +768,34 @@ BOOL handle_gopher_menu_interaction(AppState* state);
 BOOL handle_text_viewer_interaction(AppState* state);
 void handle_search_prompt(AppState *state, const GopherItem *item);
 void handle_open_prompt(AppState *state);
+BOOL read_prompt(AppState *state, const char *label, char *out, int size);
+void handle_global_search(AppState *state);
+void handle_history_finder(AppState *state);
+void show_local_page(AppState *state, const char *label, char *content);
+void reload_current_page(AppState *state);
+void check_menu_links(AppState *state);
+BOOL link_probe_start(LinkProbe *probe, const GopherItem *item, ResolvedHost *hosts, int priority);
+BOOL link_probe_resolved(LinkProbe *probe);
+BOOL link_probe_connect(LinkProbe *probe, struct in_addr addr);
+void link_probe_watch(const LinkProbe *probe, fd_set *read_fds, fd_set *write_fds, int *max_fd);
+void link_probe_close(LinkProbe *probe, int result, unsigned long size);
+void link_check_result(AppState *state, int item, unsigned char result, unsigned long latency_ms, BOOL host_failed);
+
+BOOL preview_enabled(const AppState *state);
+void preview_select(AppState *state);
+void preview_cancel(Preview *preview);
+BOOL preview_poll(AppState *state, fd_set *read_fds, fd_set *write_fds);
+PreviewEntry *preview_cache_find(Preview *preview, unsigned long link_hash);
+void preview_cache_store(Preview *preview, unsigned long link_hash, char *data, size_t length);
+void draw_preview_pane(AppState *state);
+void draw_waterfall(const AppState *state);
+void draw_history_finder(const AppState *state, const HistoryFinder *finder, const char *query, int selected, unsigned long elapsed_ms);
+
+void follow_start(AppState *state);
+void follow_stop(Follow *follow);
+BOOL follow_poll(AppState *state, fd_set *read_fds, fd_set *write_fds);
+void follow_append(Follow *follow, const char *data, size_t length);
+void follow_apply(AppState *state);
 
 void get_current_url(const NavigationState* nav, char* buffer, size_t size);
 void draw_header(const AppState* state);
@@ -128,6 +803,12 @@ void draw_gopher_menu(AppState* state);
 void draw_text_viewer(AppState* state, const char *content);
 void show_about_screen(const AppState* state);
 
+BOOL is_binary_type(char type);
+void view_binary_item(AppState *state, const GopherItem *item);
+void draw_hex_view(const AppState *state, const HexView *view, const char *title, const char *status);
+BOOL parse_byte_pattern(const char *input, unsigned char *out, size_t *length_out);
+BOOL hex_view_find(HexView *view, size_t from);
+
 NavigationState* create_nav_state(const char *host, int port, const char *selector, char type);
 void free_forward_history(NavigationState *current_state);
 void free_navigation_history(NavigationState *head);
@@ -146,8 +827,118 @@ void print_string_at(const char *str, int row, int col);
 void print_centered_string(const char *str, int row, int term_width);
 void clear_line(int row, int term_width);
 
+int write_all(int fd, const char* buffer, size_t len);
+int connect_with_timeout(int sock, const struct sockaddr_in *addr, int timeout_ms);
 int connect_and_send_request(const char *host, int port, const char *selector);
-char *receive_gopher_data(int sock);
+char *receive_gopher_data(int sock, size_t *length_out);
+int receive_to_file(int sock, int fd, size_t *length_out, const AppState *progress);
+char *fetch_resource(const char *host, int port, const char *selector, int flags, size_t *length_out);
+int fetch_to_temp_file(const char *host, int port, const char *selector, size_t *length_out, const AppState *progress);
+char *make_error_page(const NavigationState *nav, const char *reason);
+
+unsigned long hash_bytes(const char *data, size_t len);
+void make_cache_key(const char *host, int port, const char *selector, char *key_out);
+void lock_file_range(int fd, int lock_type, off_t start, off_t length);
+void shared_cache_lock(int lock_type);
+void shared_cache_lock_slot(const SharedCacheSlot *slot, int lock_type);
+BOOL shared_cache_send(const char *key, int out_fd);
+BOOL shared_cache_open(const char *path);
+void shared_cache_close(void);
+char *shared_cache_lookup(const char *key, size_t *length_out);
+void shared_cache_store(const char *key, const char *data, size_t length);
+BOOL inflight_owner_alive(const SharedInflight *entry);
+BOOL shared_cache_claim_fetch(unsigned long key_hash, BOOL unshared);
+void shared_cache_release_fetch(unsigned long key_hash);
+BOOL shared_cache_wait_for_fetch(unsigned long key_hash);
+
+unsigned long get_elapsed_ms(void);
+unsigned long hash_host_key(const char *host, int port);
+FetchTelemetry *telemetry_slot(FetchTelemetry *table, int slots, unsigned long key_hash, BOOL create);
+void telemetry_record(const char *host, int port, const char *selector, BOOL failed, unsigned long latency_ms, unsigned long size);
+void breaker_record(FetchTelemetry *host, BOOL failed);
+unsigned long fetch_timing_begin(const char *host, int port, const char *selector, int priority);
+FetchTiming *fetch_timing_find(unsigned long id);
+void fetch_timing_mark(unsigned long id, int phase);
+void fetch_timing_end(unsigned long id, int result, unsigned long size);
+void watchdog_start(void);
+void watchdog_run(pid_t parent);
+void watchdog_tick(const AppState *state);
+void watchdog_frame(unsigned long input_ms);
+void watchdog_count(unsigned long *histogram, unsigned long ms);
+void watchdog_dump(const char *reason);
+int host_concurrency_limit(unsigned long host_hash);
+void host_concurrency_record(unsigned long host_hash, BOOL failed, unsigned long latency_ms);
+BOOL breaker_allows_fetch(const char *host, int port, BOOL retry);
+void meter_socket(int sock, unsigned long host_hash);
+ssize_t metered_read(int sock, void *buffer, size_t length);
+void drain_socket(int sock);
+BOOL budget_allows(int priority);
+BOOL parse_size(const char *text, unsigned long *bytes_out);
+void draw_budget(const AppState *state, int used_columns);
+void mirror_load(void);
+int mirror_find(const char *host, int port);
+int mirror_candidates(int member, int *order);
+unsigned long mirror_percentile(const MirrorHost *mirror, int percentile);
+void mirror_sample(MirrorHost *mirror, unsigned long ms);
+char *mirror_cache_lookup(int member, const char *selector, size_t *length_out);
+char *mirror_fetch(int member, const char *selector, BOOL retry, unsigned long timing, size_t *length_out);
+void format_size(unsigned long bytes, char *out);
+const char *format_telemetry_annotation(const GopherItem *item, char *out);
+const char *format_check_annotation(unsigned char flags, const GopherItem *item, char *out);
+
+BOOL get_data_path(const char *name, char *out);
+void put_u32(unsigned char *p, unsigned long value);
+unsigned long get_u32(const unsigned char *p);
+int compare_term_bucket(const void *a, const void *b);
+double approx_log2(double x);
+size_t next_token(const char **cursor, const char *end, char *token);
+void extract_page_title(const char *content, BOOL is_menu, char *title);
+BOOL search_index_open(void);
+void search_index_sync(int idx_fd);
+IndexedUrl *search_index_url(unsigned long url_hash, BOOL create);
+void search_index_page(const NavigationState *nav, const char *content, size_t length, BOOL is_menu);
+char *search_index_query(const char *query);
+void history_record(const NavigationState *nav, BOOL is_menu);
+void history_signature(const char *text, size_t length, unsigned char *signature);
+BOOL history_open(HistoryFinder *finder);
+void history_close(HistoryFinder *finder);
+int history_trigrams(const char *text, char *trigrams, int max_count);
+int history_line_score(const char *line, size_t length, const char *trigrams, int count);
+void history_rank(HistoryFinder *finder, const char *query, int limit);
+time_t history_entry(const HistoryFinder *finder, unsigned long offset, GopherItem *item);
+BOOL contains_ignore_case(const char *text, size_t length, const char *needle);
+
+BOOL proxy_allows(const char *host, int port, const char *default_host, int default_port);
+char *rewrite_menu_for_proxy(const char *menu, const char *proxy_host, int proxy_port, const char *default_host, int default_port);
+void proxy_serve_client(int client, int proxy_port, const char *default_host, int default_port);
+void run_proxy(const char *listen_address, int port, const char *default_host, int default_port);
+
+BOOL hash_set_add(HashSet *set, unsigned long hash);
+int run_crawl(const char *dir, char **seeds, int seed_count, int jobs, int shards, BOOL resync);
+void crawl_resync_start(const char *dir, int shard);
+int crawl_shard_count(const char *dir, int requested);
+void crawl_enqueue(const char *dir, int shards, int *frontier_fds, char type, const char *host, int port, const char *selector);
+void crawl_worker(const char *dir, int shards);
+BOOL crawl_shard(const char *dir, int shards, int shard, CrawlShard *state, HashSet *enqueued,
+                 int *frontier_fds, unsigned long *pages, unsigned long *queued);
+
+int run_lint(char **targets, int target_count, int jobs, const char *internal_host);
+void lint_collect(LintRun *run, const char *path, const char *root);
+int lint_next_unit(LintRun *run);
+int lint_add_file(LintRun *run, const char *name, int chunk_count);
+void lint_queue(LintRun *run, const LintUnit *unit);
+void lint_add_local(LintRun *run, const char *path, const char *root);
+void lint_add_menu(LintRun *run, const char *host, int port, const char *selector, int ref_file, long ref_line);
+BOOL lint_mark_seen(LintRun *run, const char *host, int port, const char *selector);
+void lint_start_worker(LintRun *run, LintWorker *worker);
+void lint_worker_main(int command_fd, int result_fd, const char *internal_host);
+void lint_range(FILE *out, const char *data, size_t length, size_t start, size_t end,
+                const LintUnit *unit, const char *internal_host, LintChunk *counts);
+void lint_line(FILE *out, char *line, size_t length, long line_no, const LintUnit *unit, const char *internal_host);
+BOOL lint_error_reply(const char *data, size_t length, char *reason);
+void lint_handle_record(LintRun *run, LintWorker *worker, char *record);
+void lint_report(LintRun *run, const char *name, long line, const char *check, const char *detail);
+void lint_flush_file(LintRun *run, int file);
 
 void die(const char *msg);
 const char* get_gopher_type_description(char type);
@@ -162,30 +953,142 @@ int main(int argc, char *argv[]) {
 	int initial_port;
 	char initial_selector[MAX_SELECTOR_LENGTH];
 	char initial_type;
+	const char *address = NULL;
+	const char *shared_cache_path = NULL;
+	const char *lint_host = NULL;
+	const char *crawl_dir = NULL;
+	const char *proxy_address = NULL;
+	const char *colon;
+	char **targets;
+	int target_count = 0;
+	int proxy_port = 0;
+	int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN) * 2;
+	int shards = 0;
+	BOOL lint = FALSE;
+	BOOL resync = FALSE;
+	BOOL watchdog = FALSE;
+	int i;
 
-	if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
-		show_help();
-		return EXIT_SUCCESS;
+	targets = malloc(argc * sizeof(char *));
+	if (!targets) {
+		die("Error: Failed to allocate memory for arguments.");
+	}
+	if (jobs < 2) jobs = 2;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+			show_help();
+			return EXIT_SUCCESS;
+		} else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--version") == 0) {
+			show_version();
+			return EXIT_SUCCESS;
+		} else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--shared-cache") == 0) {
+			if (i + 1 >= argc) {
+				die("Error: Missing path for the shared cache.");
+			}
+			shared_cache_path = argv[++i];
+		} else if (strcmp(argv[i], "--proxy") == 0) {
+			if (i + 1 >= argc) {
+				die("Error: Missing [ADDR:]PORT for --proxy.");
+			}
+			proxy_address = argv[++i];
+			colon = strrchr(proxy_address, ':');
+			proxy_port = atoi(colon ? colon + 1 : proxy_address);
+			if (proxy_port <= 0 || proxy_port > 65535) {
+				die("Error: --proxy needs a port between 1 and 65535.");
+			}
+		} else if (strcmp(argv[i], "--lint") == 0) {
+			lint = TRUE;
+		} else if (strcmp(argv[i], "--crawl") == 0) {
+			if (i + 1 >= argc) {
+				die("Error: Missing directory for --crawl.");
+			}
+			crawl_dir = argv[++i];
+		} else if (strcmp(argv[i], "--budget") == 0) {
+			if (i + 1 >= argc || !parse_size(argv[++i], &g_budget_bytes)) {
+				die("Error: --budget needs a size such as 500K, 20M or 1G.");
+			}
+		} else if (strcmp(argv[i], "--resync") == 0) {
+			resync = TRUE;
+		} else if (strcmp(argv[i], "--watchdog") == 0) {
+			watchdog = TRUE;
+		} else if (strcmp(argv[i], "--shards") == 0) {
+			if (i + 1 >= argc || (shards = atoi(argv[++i])) <= 0 || shards > CRAWL_MAX_SHARDS) {
+				die("Error: --shards needs a number between 1 and 256.");
+			}
+		} else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+			if (i + 1 >= argc || (jobs = atoi(argv[++i])) <= 0) {
+				die("Error: --jobs needs a positive number.");
+			}
+		} else if (strcmp(argv[i], "--host") == 0) {
+			if (i + 1 >= argc) {
+				die("Error: Missing name for --host.");
+			}
+			lint_host = argv[++i];
+		} else if (argv[i][0] == '-') {
+			die("Error: Unknown option. See 'tocaia --help'.");
+		} else {
+			address = argv[i];
+			targets[target_count++] = argv[i];
+		}
+	}
+
+	if (lint) {
+		if (target_count == 0) {
+			die("Error: --lint needs a file, directory or Gopher address.");
+		}
+		gettimeofday(&g_start_time, NULL);
+		i = run_lint(targets, target_count, jobs, lint_host);
+		free(targets);
+		return i;
+	}
+	if (resync && !crawl_dir) {
+		die("Error: --resync needs --crawl DIR.");
 	}
-	if (strcmp(argv[1], "-v") == 0 || strcmp(argv[1], "--version") == 0) {
-		show_version();
+	if (crawl_dir) {
+		gettimeofday(&g_start_time, NULL);
+		i = run_crawl(crawl_dir, targets, target_count, jobs, shards ? shards : jobs, resync);
+		free(targets);
+		return i;
+	}
+	free(targets);
+
+	if (address == NULL && proxy_port == 0) {
+		show_help();
 		return EXIT_SUCCESS;
 	}
 
 	/* Try to parse the Gopher address. If it fails, print an error and exit. */
-	if (!parse_gopher_address(argv[1], initial_host, &initial_port, initial_selector, &initial_type)) {
+	if (address && !parse_gopher_address(address, initial_host, &initial_port, initial_selector, &initial_type)) {
 		die("Error: Invalid Gopher address format.");
 	}
 
+	if (shared_cache_path && !shared_cache_open(shared_cache_path)) {
+		die("Error: Failed to open the shared cache.");
+	}
+
+	gettimeofday(&g_start_time, NULL);
+	if (proxy_port) {
+		run_proxy(proxy_address, proxy_port, address ? initial_host : NULL, address ? initial_port : 0);
+		return EXIT_SUCCESS;
+	}
+
 	/* From this point on, the URL is valid, so the terminal will be configured. */
 	/* atexit() ensures restore_terminal() is called on any normal or error exit. */
 	atexit(restore_terminal);
 	setup_terminal_for_app();
+	if (watchdog) {
+		watchdog_start();
+	}
 
 	/* Initialize the application state */
 	memset(&state, 0, sizeof(AppState));
 	state.is_running = TRUE;
+	state.preview.item = -1;
+	state.preview.probe.item = -1;
+	state.follow.probe.item = -1;
 	ioctl(STDOUT_FILENO, TIOCGWINSZ, &state.terminal_size);
+	g_status_terminal = &state.terminal_size;
 	navigate_to(&state, initial_host, initial_port, initial_selector, initial_type);
 
 	if (!state.current_nav) {
@@ -196,9 +1099,15 @@ int main(int argc, char *argv[]) {
 
 	/* Clean up all allocated resources before exiting. */
 	free_navigation_history(state.current_nav);
-	if (state.gopher_items) {
-		free(state.gopher_items);
+	free(state.item_cache);
+	free(state.item_cache_ids);
+	preview_cancel(&state.preview);
+	follow_stop(&state.follow);
+	for (i = 0; i < PREVIEW_CACHE_SLOTS; i++) {
+		free(state.preview.cache[i].data);
 	}
+	menu_index_free(&state.menu);
+	shared_cache_close();
 
 	return EXIT_SUCCESS;
 }
@@ -223,7 +1132,10 @@ void run_main_loop(AppState *state) {
 
 		/* Decide whether to show a menu or a text file. */
 		if (is_gopher_menu(state->current_nav)) {
-			process_gopher_response(state, state->current_nav->page_content);
+			if (state->menu_stale) {
+				process_gopher_response(state, state->current_nav->page_content);
+				state->menu_stale = FALSE;
+			}
 			if (!handle_gopher_menu_interaction(state)) {
 				state->is_running = FALSE;
 			}
@@ -238,34 +1150,57 @@ void run_main_loop(AppState *state) {
 
 /* Fetches the Gopher content for the current navigation state. */
 void fetch_current_content(AppState *state) {
-	int sock;
-	char *response;
+	NavigationState *nav = state->current_nav;
+	size_t length;
+	BOOL is_menu;
+
+	/* A reload always goes to the network, even to a host marked down. */
+	nav->page_content = fetch_resource(nav->host, nav->port, nav->selector,
+	                                   FETCH_ANY_MIRROR | (state->reload_requested ? FETCH_RETRY : FETCH_USE_CACHE), NULL);
+	state->reload_requested = FALSE;
+
+	nav->is_error_page = (nav->page_content == NULL);
+	if (nav->is_error_page) {
+		nav->page_content = make_error_page(nav, g_fetch_error);
+		return;
+	}
 
-	sock = connect_and_send_request(state->current_nav->host, state->current_nav->port, state->current_nav->selector);
-	if (sock == -1) {
-		die("Error: Failed to connect to the Gopher server.");
+	/* Search results embed the query in the selector; they are not pages. */
+	length = strlen(nav->page_content);
+	is_menu = is_gopher_menu(nav);
+	if (strchr(nav->selector, '\t') == NULL) {
+		search_index_page(nav, nav->page_content, length, is_menu);
+		if (!is_menu) {
+			line_index_build(&nav->lines, nav->page_content, length);
+			diff_against_last_visit(nav, length);
+		}
 	}
+	history_record(nav, is_menu);
+}
 
-	response = receive_gopher_data(sock);
-	close(sock);
+/* Builds the text shown in place of a page that could not be fetched. */
+char *make_error_page(const NavigationState *nav, const char *reason) {
+	char *page = malloc(MAX_HOST_LENGTH + sizeof(g_fetch_error) + 128);
 
-	if (response == NULL) {
-		die("Error: Failed to receive data from the Gopher server.");
+	if (!page) {
+		die("Error: Failed to allocate memory for the error page.");
 	}
-
-	state->current_nav->page_content = response;
+	sprintf(page, "Not loaded: %s:%d\n\n%s\n\nPress r to retry now or b to go back.\n",
+	        nav->host, nav->port, reason);
+	return page;
 }
 
 /* Determines if the current content should be treated as a Gopher menu. */
 BOOL is_gopher_menu(const NavigationState *nav) {
 	char selector_type;
-	char *first_line_end;
-	char first_line[MAX_DISPLAY_LENGTH];
-	size_t len;
+	const char *p;
 
-	if (!nav || !nav->page_content) {
+	if (!nav || !nav->page_content || nav->is_error_page) {
 		return FALSE;
 	}
+	if (nav->is_local) {
+		return TRUE;
+	}
 
 	selector_type = nav->selector[0];
 
@@ -281,57 +1216,515 @@ BOOL is_gopher_menu(const NavigationState *nav) {
 		return TRUE;
 	}
 
-	/* Heuristic: Check for a tab character in the first line. */
-	first_line_end = strchr(nav->page_content, '\n');
+	/* Heuristic: a menu has a tab in its first line. Only the start of the
+	 * line is looked at, so a body without newlines is not scanned whole.
+	 * If no tab is found, it's likely a text file, not a menu. */
+	for (p = nav->page_content; *p != '\0' && *p != '\n' && p - nav->page_content < MAX_DISPLAY_LENGTH - 1; p++) {
+		if (*p == '\t') {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
 
-	if (first_line_end) {
-		len = first_line_end - nav->page_content;
-		if (len >= sizeof(first_line)) len = sizeof(first_line) - 1;
-		strncpy(first_line, nav->page_content, len);
-		first_line[len] = '\0';
-	} else {
-		strncpy(first_line, nav->page_content, sizeof(first_line) - 1);
-		first_line[sizeof(first_line) - 1] = '\0';
+/* Calculates the number of lines in a text content string. */
+void calculate_text_lines(AppState *state, const char *content) {
+	LineIndex *lines = &state->current_nav->lines;
+
+	if (lines->offsets == NULL) {
+		line_index_build(lines, content, strlen(content));
+	}
+	state->total_content_lines = lines->count;
+}
+
+/* Records where each line starts. A last line without a newline counts. */
+void line_index_build(LineIndex *lines, const char *content, size_t length) {
+	line_index_free(lines);
+	line_index_extend(lines, content, 0, length);
+	if (lines->offsets == NULL) {
+		/* Empty page: keep a non-NULL index so it is not rebuilt. */
+		lines->offsets = malloc(sizeof(unsigned long));
+		if (!lines->offsets) {
+			die("Error: Failed to allocate memory for the line index.");
+		}
+	}
+}
+
+/* Indexes the lines that start in content[from, length). A line already
+ * indexed that runs into `from` is left as it is. */
+void line_index_extend(LineIndex *lines, const char *content, size_t from, size_t length) {
+	const char *ptr = content + from;
+	const char *end = content + length;
+
+	if (from > 0 && content[from - 1] != '\n') {
+		ptr = memchr(ptr, '\n', end - ptr);
+		if (ptr == NULL) {
+			return;
+		}
+		ptr++;
+	}
+	while (ptr < end) {
+		if (lines->count >= lines->capacity) {
+			lines->capacity = lines->capacity ? lines->capacity * 2 : 256;
+			lines->offsets = realloc(lines->offsets, lines->capacity * sizeof(unsigned long));
+			if (!lines->offsets) {
+				die("Error: Failed to allocate memory for the line index.");
+			}
+		}
+		lines->offsets[lines->count++] = (unsigned long)(ptr - content);
+		ptr = memchr(ptr, '\n', end - ptr);
+		if (ptr == NULL) {
+			break;
+		}
+		ptr++;
+	}
+}
+
+/* Releases a line index and its change marks. */
+void line_index_free(LineIndex *lines) {
+	free(lines->offsets);
+	free(lines->marks);
+	memset(lines, 0, sizeof(LineIndex));
+}
+
+/* Hashes every line, ignoring its line terminator. */
+unsigned long *hash_lines(const char *content, const unsigned long *offsets, int count, size_t length) {
+	unsigned long *hashes = malloc((count + 1) * sizeof(unsigned long));
+	size_t start, end;
+	int i;
+
+	if (!hashes) {
+		die("Error: Failed to allocate memory for line hashes.");
+	}
+	for (i = 0; i < count; i++) {
+		start = offsets[i];
+		end = (i + 1 < count) ? offsets[i + 1] : length;
+		while (end > start && (content[end - 1] == '\n' || content[end - 1] == '\r')) {
+			end--;
+		}
+		hashes[i] = hash_bytes(content + start, end - start);
+	}
+	return hashes;
+}
+
+/* Builds an open-addressed set of line hashes. Zero marks an empty slot. */
+unsigned long *line_set_build(const unsigned long *hashes, int count, unsigned long *mask_out) {
+	unsigned long size = 16;
+	unsigned long *set;
+	unsigned long slot;
+	int i;
+
+	while (size < (unsigned long)count * 2) {
+		size *= 2;
+	}
+	set = calloc(size, sizeof(unsigned long));
+	if (!set) {
+		die("Error: Failed to allocate memory for the line set.");
+	}
+	for (i = 0; i < count; i++) {
+		unsigned long hash = hashes[i] ? hashes[i] : 1;
+		for (slot = hash & (size - 1); set[slot] != 0 && set[slot] != hash; slot = (slot + 1) & (size - 1));
+		set[slot] = hash;
+	}
+	*mask_out = size - 1;
+	return set;
+}
+
+BOOL line_set_contains(const unsigned long *set, unsigned long mask, unsigned long hash) {
+	unsigned long slot;
+
+	if (hash == 0) {
+		hash = 1;
+	}
+	for (slot = hash & mask; set[slot] != 0; slot = (slot + 1) & mask) {
+		if (set[slot] == hash) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Marks the new lines that were added or changed relative to the old ones.
+ * The common prefix and suffix are trimmed first; the remaining middle is
+ * walked once, using hash sets of each side to tell an inserted line (absent
+ * from the old text) from a changed one (both sides have a line the other
+ * lacks at that point). Every step consumes a line, so the cost is linear.
+ * Returns the number of lines marked. */
+int diff_lines(const unsigned long *old_hashes, int old_count, const unsigned long *new_hashes, int new_count, unsigned char *marks) {
+	unsigned long *old_set, *new_set;
+	unsigned long old_mask, new_mask;
+	int prefix = 0, suffix = 0;
+	int old_end, new_end;
+	int i, j;
+	int changed = 0;
+
+	while (prefix < old_count && prefix < new_count && old_hashes[prefix] == new_hashes[prefix]) {
+		prefix++;
+	}
+	while (suffix < old_count - prefix && suffix < new_count - prefix &&
+	        old_hashes[old_count - 1 - suffix] == new_hashes[new_count - 1 - suffix]) {
+		suffix++;
+	}
+	old_end = old_count - suffix;
+	new_end = new_count - suffix;
+	if (prefix >= new_end) {
+		return 0; /* Lines were only removed. */
+	}
+
+	old_set = line_set_build(old_hashes + prefix, old_end - prefix, &old_mask);
+	new_set = line_set_build(new_hashes + prefix, new_end - prefix, &new_mask);
+
+	i = prefix;
+	j = prefix;
+	while (j < new_end) {
+		if (i < old_end && old_hashes[i] == new_hashes[j]) {
+			i++;
+			j++;
+		} else if (!line_set_contains(old_set, old_mask, new_hashes[j])) {
+			if (i < old_end && !line_set_contains(new_set, new_mask, old_hashes[i])) {
+				marks[j] = LINE_CHANGED;
+				i++;
+			} else {
+				marks[j] = LINE_ADDED;
+			}
+			changed++;
+			j++;
+		} else if (i < old_end && !line_set_contains(new_set, new_mask, old_hashes[i])) {
+			i++; /* Removed line. */
+		} else {
+			/* A moved or duplicated line: neither side is new. */
+			if (i < old_end) i++;
+			j++;
+		}
+	}
+
+	free(old_set);
+	free(new_set);
+	return changed;
+}
+
+/* Compares a freshly fetched text page with the copy saved on the previous
+ * visit, marking what changed in its line index, then saves the new copy. */
+void diff_against_last_visit(NavigationState *nav, size_t length) {
+	char key[MAX_CACHE_KEY_LENGTH];
+	size_t old_length = 0;
+	size_t map_length = 0;
+	void *map;
+	const char *old;
+	LineIndex old_lines;
+	unsigned long *old_hashes, *new_hashes;
+	BOOL unchanged = FALSE;
+
+	if (length > PAGE_STORE_MAX_SIZE) {
+		return;
+	}
+	make_cache_key(nav->host, nav->port, nav->selector, key);
+
+	map = page_store_map(key, &old, &old_length, &map_length);
+	if (map) {
+		unchanged = old_length == length && memcmp(old, nav->page_content, length) == 0;
+		if (!unchanged) {
+			memset(&old_lines, 0, sizeof(old_lines));
+			line_index_build(&old_lines, old, old_length);
+			old_hashes = hash_lines(old, old_lines.offsets, old_lines.count, old_length);
+			new_hashes = hash_lines(nav->page_content, nav->lines.offsets, nav->lines.count, length);
+
+			nav->lines.marks = calloc(nav->lines.count + 1, 1);
+			if (!nav->lines.marks) {
+				die("Error: Failed to allocate memory for change marks.");
+			}
+			nav->lines.changed_lines = diff_lines(old_hashes, old_lines.count, new_hashes, nav->lines.count, nav->lines.marks);
+			if (nav->lines.changed_lines == 0) {
+				free(nav->lines.marks);
+				nav->lines.marks = NULL;
+			}
+
+			free(old_hashes);
+			free(new_hashes);
+			line_index_free(&old_lines);
+		}
+		munmap(map, map_length);
+	}
+
+	if (!unchanged) {
+		page_store_write(key, nav->page_content, length);
+	}
+}
+
+/* Names the page store file for a cache key, creating the store if needed. */
+BOOL page_store_path(const char *key, const char *suffix, char *path) {
+	if (!get_data_path(PAGE_STORE_DIR, path) || (mkdir(path, 0700) == -1 && errno != EEXIST) ||
+	        strlen(path) + strlen(suffix) + 10 >= MAX_PATH_LENGTH) {
+		return FALSE;
 	}
+	sprintf(path + strlen(path), "/%08lx%s", hash_bytes(key, strlen(key)), suffix);
+	return TRUE;
+}
 
-	/* If no tab is found, it's likely a text file, not a menu. */
-	if (strchr(first_line, '\t') == NULL) {
+/* Names the blob holding a page body: <data dir>/pages/blobs/<hash>-<length>.
+ * The name is only a hint; a blob's content is compared before it is shared. */
+BOOL page_store_blob_path(const char *data, size_t length, char *path) {
+	if (!get_data_path(PAGE_STORE_BLOB_DIR, path) || (mkdir(path, 0700) == -1 && errno != EEXIST) ||
+	        strlen(path) + 32 >= MAX_PATH_LENGTH) {
 		return FALSE;
 	}
+	sprintf(path + strlen(path), "/%08lx-%lx", hash_bytes(data, length), (unsigned long)length);
+	return TRUE;
+}
+
+/* Maps the stored copy of a page. Each URL has a file in <data dir>/pages
+ * starting with its cache key on its own line. The body follows the key if
+ * it could not be shared; otherwise "<file>.body" is a hard link to its
+ * blob, so a blob's link count tells how many pages use it.
+ * Returns the mapping to unmap, or NULL if there is no copy. */
+void *page_store_map(const char *key, const char **body_out, size_t *length_out, size_t *map_length_out) {
+	char path[MAX_PATH_LENGTH];
+	char header[MAX_CACHE_KEY_LENGTH + 1];
+	size_t key_length = strlen(key);
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (!page_store_path(key, "", path) || (fd = open(path, O_RDONLY)) == -1) {
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < key_length + 1 ||
+	        read(fd, header, key_length + 1) != (ssize_t)(key_length + 1) ||
+	        memcmp(header, key, key_length) != 0 || header[key_length] != '\n') {
+		close(fd);
+		return NULL;
+	}
+
+	if ((size_t)st.st_size > key_length + 1) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED) {
+			return NULL;
+		}
+		*body_out = (const char *)map + key_length + 1;
+		*length_out = st.st_size - key_length - 1;
+		*map_length_out = st.st_size;
+		return map;
+	}
+	close(fd);
+
+	strcat(path, ".body");
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		return NULL;
+	}
+	map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	*body_out = (const char *)map;
+	*length_out = st.st_size;
+	*map_length_out = st.st_size;
+	return map;
+}
+
+/* Makes sure the blob at `blob_path` holds exactly `data`, writing it if it
+ * does not exist. Returns FALSE if another body has the same name. */
+BOOL page_store_put_blob(const char *blob_path, const char *data, size_t length) {
+	char tmp_path[MAX_PATH_LENGTH + 16];
+	struct stat st;
+	void *map;
+	BOOL same = FALSE;
+	int fd;
+
+	fd = open(blob_path, O_RDONLY);
+	if (fd != -1) {
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size == length && length > 0) {
+			map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED) {
+				same = memcmp(map, data, length) == 0;
+				munmap(map, length);
+			}
+		}
+		close(fd);
+		return same;
+	}
 
+	sprintf(tmp_path, "%s.%ld", blob_path, (long)getpid());
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		return FALSE;
+	}
+	if (write_all(fd, data, length) == -1) {
+		close(fd);
+		unlink(tmp_path);
+		return FALSE;
+	}
+	close(fd);
+	if (rename(tmp_path, blob_path) == -1) {
+		unlink(tmp_path);
+		return FALSE;
+	}
 	return TRUE;
 }
 
-/* Calculates the number of lines in a text content string. */
-void calculate_text_lines(AppState *state, const char *content) {
-	const char *ptr = content;
-	int count = 0;
-	while (*ptr != '\0') {
-		if (*ptr == '\n') {
-			count++;
+/* Saves the copy of a page, sharing its body with every other page that has
+ * the same content. Files are replaced atomically, so readers keep mapping
+ * the old ones. */
+void page_store_write(const char *key, const char *data, size_t length) {
+	char path[MAX_PATH_LENGTH];
+	char body_path[MAX_PATH_LENGTH + 8];
+	char blob_path[MAX_PATH_LENGTH];
+	char tmp_path[MAX_PATH_LENGTH + 24];
+	BOOL shared;
+	int fd;
+
+	if (!page_store_path(key, "", path) || !page_store_blob_path(data, length, blob_path)) {
+		return;
+	}
+	page_store_sweep();
+	sprintf(body_path, "%s.body", path);
+
+	/* Point the page at its blob first, so that a reader holding the old
+	 * header still finds a body for this URL. */
+	shared = page_store_put_blob(blob_path, data, length);
+	if (shared) {
+		sprintf(tmp_path, "%s.%ld", body_path, (long)getpid());
+		unlink(tmp_path);
+		shared = link(blob_path, tmp_path) == 0;
+		if (shared && rename(tmp_path, body_path) == -1) {
+			unlink(tmp_path);
+			shared = FALSE;
 		}
-		ptr++;
 	}
-	/* Add one for the last line if it doesn't end with a newline. */
-	if (ptr > content && *(ptr - 1) != '\n') {
-		count++;
+
+	sprintf(tmp_path, "%s.%ld", path, (long)getpid());
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		return;
+	}
+	if (write_all(fd, key, strlen(key)) == -1 || write_all(fd, "\n", 1) == -1 ||
+	        (!shared && write_all(fd, data, length) == -1)) {
+		close(fd);
+		unlink(tmp_path);
+		return;
+	}
+	close(fd);
+	if (rename(tmp_path, path) == -1) {
+		unlink(tmp_path);
+		return;
+	}
+	if (!shared) {
+		unlink(body_path);
+	}
+}
+
+/* Removes blobs no page links to any more, once per process. A blob is left
+ * alone for PAGE_STORE_SWEEP_AGE seconds after its last link change, which
+ * covers a writer between creating a blob and linking a page to it. */
+void page_store_sweep(void) {
+	char path[MAX_PATH_LENGTH];
+	char child[MAX_PATH_LENGTH + 256];
+	struct dirent *entry;
+	struct stat st;
+	time_t now = time(NULL);
+	DIR *dir;
+
+	if (g_page_store_swept || !get_data_path(PAGE_STORE_BLOB_DIR, path) || (dir = opendir(path)) == NULL) {
+		return;
+	}
+	g_page_store_swept = TRUE;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		sprintf(child, "%s/%s", path, entry->d_name);
+		if (lstat(child, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1 &&
+		        now - st.st_ctime >= PAGE_STORE_SWEEP_AGE) {
+			unlink(child);
+		}
 	}
-	state->total_content_lines = count;
+	closedir(dir);
 }
 
-/* Removes leading and trailing whitespace from a string in-place. */
+/* Reads up to `max_length` bytes of the stored copy of a page.
+ * Returns NULL if there is none. */
+char *page_store_read(const char *key, size_t max_length, size_t *length_out) {
+	const char *body;
+	size_t length;
+	size_t map_length;
+	void *map;
+	char *data;
+
+	map = page_store_map(key, &body, &length, &map_length);
+	if (!map) {
+		return NULL;
+	}
+	if (length > max_length) {
+		length = max_length;
+	}
+	data = malloc(length + 1);
+	if (!data) {
+		die("Error: Failed to allocate memory for a stored page.");
+	}
+	memcpy(data, body, length);
+	data[length] = '\0';
+	munmap(map, map_length);
+	*length_out = length;
+	return data;
+}
+
+/* Finds the first line of the next (direction 1) or previous (direction -1)
+ * run of changed lines, starting after `from`. Returns -1 if there is none. */
+int find_change(const LineIndex *lines, int from, int direction) {
+	int i;
+
+	if (!lines->marks) {
+		return -1;
+	}
+	for (i = from + direction; i >= 0 && i < lines->count; i += direction) {
+		if (lines->marks[i] && (i == 0 || !lines->marks[i - 1])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Removes trailing whitespace from a string in-place. Leading whitespace
+ * is kept, as menus use it to align their text. */
 void trim_whitespace(char* str) {
-	char *end;
-	/* Trim leading space */
-	while (isspace((unsigned char)*str)) str++;
-	if (*str == 0) return; /* All spaces? */
+	size_t length = strlen(str);
 
-	/* Trim trailing space */
-	end = str + strlen(str) - 1;
-	while (end > str && isspace((unsigned char)*end)) end--;
+	while (length > 0 && isspace((unsigned char)str[length - 1])) length--;
+	str[length] = '\0';
+}
 
-	/* Write new null terminator */
-	end[1] = '\0';
+/* Copies a menu line of `length` bytes into `out` for parse_gopher_line(),
+ * clipping each field to the most its item field can hold. Parsing a line
+ * thus takes one pass over it and MAX_MENU_LINE_LENGTH + 1 bytes however
+ * long the line is. Returns the length copied. */
+size_t copy_menu_line(const char *line, size_t length, char *out) {
+	const char *end = line + length;
+	const char *tab;
+	size_t limits[4];
+	size_t used = 0;
+	size_t field_length;
+	int field;
+
+	limits[0] = MAX_DISPLAY_LENGTH + 1; /* With the type character. */
+	limits[1] = MAX_SELECTOR_LENGTH;
+	limits[2] = MAX_HOST_LENGTH;
+	limits[3] = 16;
+	for (field = 0; field < 4; field++) {
+		tab = field < 3 ? memchr(line, '\t', end - line) : NULL;
+		field_length = (size_t)((tab ? tab : end) - line);
+		if (field_length > limits[field]) field_length = limits[field];
+		memcpy(out + used, line, field_length);
+		used += field_length;
+		if (!tab) break;
+		out[used++] = '\t';
+		line = tab + 1;
+	}
+	out[used] = '\0';
+	return used;
 }
 
 /* Parses a single Gopher line into a GopherItem structure. */
@@ -339,17 +1732,18 @@ BOOL parse_gopher_line(char* line, GopherItem* item, const char* current_host, i
 	char* token;
 	char *line_content_start;
 	char *fields[4];
+	size_t length = strlen(line);
 	int i;
 
 	memset(item, 0, sizeof(GopherItem));
 
 	/* Gopher lines end with CRLF, remove the CR if present. */
-	if (strlen(line) > 0 && line[strlen(line) - 1] == '\r') {
-		line[strlen(line) - 1] = '\0';
+	if (length > 0 && line[length - 1] == '\r') {
+		line[--length] = '\0';
 	}
 
 	/* Ignore empty lines or the end-of-listing marker ".". */
-	if (line[0] == '\0' || strcmp(line, ".") == 0 || strlen(line) < 2) {
+	if (length < 2) {
 		return FALSE;
 	}
 
@@ -399,10 +1793,15 @@ BOOL parse_gopher_line(char* line, GopherItem* item, const char* current_host, i
 	}
 
 	/* An item is selectable if it's a known link type and not a placeholder. */
-	if (strchr("0127h", item->type) != NULL &&
+	if ((strchr("0127h", item->type) != NULL || is_binary_type(item->type)) &&
 	        strcmp(item->host, "null.host") != 0 &&
 	        strcmp(item->host, "error.host") != 0) {
+		char key[MAX_CACHE_KEY_LENGTH];
+
 		item->is_selectable = TRUE;
+		make_cache_key(item->host, item->port, item->selector, key);
+		item->link_hash = hash_bytes(key, strlen(key));
+		item->host_hash = hash_host_key(item->host, item->port);
 	} else {
 		item->is_selectable = FALSE;
 	}
@@ -410,64 +1809,264 @@ BOOL parse_gopher_line(char* line, GopherItem* item, const char* current_host, i
 	return TRUE;
 }
 
-/* Processes the raw Gopher response data and populates the item list. */
+/* Builds the menu index for a Gopher response, or maps in the one saved
+ * for an identical body. Items themselves are parsed by get_menu_item(). */
 void process_gopher_response(AppState* state, const char *data) {
-	char *data_copy, *line;
-	int capacity = 50;
+	const char *line = data;
+	const char *line_end;
+	char line_copy[MAX_MENU_LINE_LENGTH + 1];
+	size_t line_length;
+	size_t length = strlen(data);
+	unsigned long body_hash = 0;
+	GopherItem current_item;
+	int i;
 
-	if (state->gopher_items) {
-		free(state->gopher_items);
+	if (!state->item_cache) {
+		state->item_cache = malloc(ITEM_CACHE_SLOTS * sizeof(GopherItem));
+		state->item_cache_ids = malloc(ITEM_CACHE_SLOTS * sizeof(int));
+		if (!state->item_cache || !state->item_cache_ids) {
+			die("Error: Failed to allocate memory for Gopher items.");
+		}
 	}
-	state->gopher_items = malloc(capacity * sizeof(GopherItem));
-	if (!state->gopher_items) {
-		die("Error: Failed to allocate memory for Gopher items.");
+	for (i = 0; i < ITEM_CACHE_SLOTS; i++) {
+		state->item_cache_ids[i] = -1;
 	}
-
-	state->total_items = 0;
-	state->selectable_items = 0;
 	state->selected_index = 1;
+	preview_cancel(&state->preview);
+	memset(state->preview.hosts, 0, sizeof(state->preview.hosts));
+
+	if (state->menu.mapping) {
+		menu_index_free(&state->menu);
+	}
+	state->menu.count = 0;
+	state->menu.selectable_count = 0;
 
-	data_copy = malloc(strlen(data) + 1);
-	if (data_copy) {
-		strcpy(data_copy, data);
+	if (length >= MENU_INDEX_MIN_BODY && !state->current_nav->is_local) {
+		body_hash = hash_bytes(data, length);
 	}
-	if (!data_copy) {
-		die("Error: Failed to duplicate response data.");
+	if (body_hash && menu_index_load(&state->menu, state->current_nav, length, body_hash)) {
+		line = data + length; /* Nothing left to parse. */
 	}
 
-	line = strtok(data_copy, "\n");
-	while (line != NULL) {
-		GopherItem current_item;
+	while (line < data + length) {
+		line_end = memchr(line, '\n', data + length - line);
+		line_length = line_end ? (size_t)(line_end - line) : (size_t)(data + length - line);
+		copy_menu_line(line, line_length, line_copy);
 
-		if (parse_gopher_line(line, &current_item, state->current_nav->host, state->current_nav->port)) {
-			if (state->total_items >= capacity) {
-				capacity *= 2;
-				state->gopher_items = realloc(state->gopher_items, capacity * sizeof(GopherItem));
-				if (!state->gopher_items) {
-					die("Error: Failed to reallocate memory for Gopher items.");
-				}
-			}
+		if (parse_gopher_line(line_copy, &current_item, state->current_nav->host, state->current_nav->port)) {
+			menu_index_append(&state->menu, &current_item, (unsigned long)(line - data));
+		}
+		if (!line_end) {
+			break;
+		}
+		line = line_end + 1;
+	}
 
-			if (current_item.is_selectable) {
-				state->selectable_items++;
-				current_item.menu_index = state->selectable_items;
-			}
+	if (body_hash && !state->menu.mapping) {
+		menu_index_save(&state->menu, state->current_nav, length, body_hash);
+	}
+
+	/* Restore link checker verdicts from this session. */
+	for (i = 0; i < state->menu.selectable_count; i++) {
+		int item = state->menu.selectable_map[i];
+		const FetchTelemetry *link = telemetry_slot(g_link_telemetry, TELEMETRY_LINK_SLOTS,
+		                                            state->menu.link_hashes[item], FALSE);
+		if (link && link->probe_flags) {
+			state->menu.flags[item] = ITEM_SELECTABLE | link->probe_flags;
+		}
+	}
+
+	state->total_items = state->menu.count;
+	state->selectable_items = state->menu.selectable_count;
+}
+
+/* Returns the parsed form of a menu item, parsing its line on first use.
+ * The result is only valid until the next call that lands on the same
+ * cache slot, so callers copy it if they need to keep it. */
+GopherItem *get_menu_item(AppState *state, int index) {
+	int slot = index & (ITEM_CACHE_SLOTS - 1);
+	const char *line;
+	const char *line_end;
+	size_t line_length;
+	char line_copy[MAX_MENU_LINE_LENGTH + 1];
+
+	if (state->item_cache_ids[slot] != index) {
+		line = state->current_nav->page_content + state->menu.offsets[index];
+		line_end = strchr(line, '\n');
+		line_length = line_end ? (size_t)(line_end - line) : strlen(line);
+		copy_menu_line(line, line_length, line_copy);
+		parse_gopher_line(line_copy, &state->item_cache[slot], state->current_nav->host, state->current_nav->port);
+		state->item_cache_ids[slot] = index;
+	}
+	return &state->item_cache[slot];
+}
 
-			state->gopher_items[state->total_items] = current_item;
-			state->total_items++;
+/* Appends an item to the menu columns, growing all of them together. */
+void menu_index_append(MenuIndex *menu, const GopherItem *item, unsigned long offset) {
+	if (menu->count >= menu->capacity) {
+		menu->capacity = menu->capacity ? menu->capacity * 2 : 64;
+		menu->types = realloc(menu->types, menu->capacity);
+		menu->flags = realloc(menu->flags, menu->capacity);
+		menu->offsets = realloc(menu->offsets, menu->capacity * sizeof(unsigned long));
+		menu->link_hashes = realloc(menu->link_hashes, menu->capacity * sizeof(unsigned long));
+		menu->host_hashes = realloc(menu->host_hashes, menu->capacity * sizeof(unsigned long));
+		menu->selectable_map = realloc(menu->selectable_map, menu->capacity * sizeof(int));
+		if (!menu->types || !menu->flags || !menu->offsets || !menu->link_hashes ||
+		        !menu->host_hashes || !menu->selectable_map) {
+			die("Error: Failed to allocate memory for the menu index.");
 		}
+	}
+
+	menu->types[menu->count] = item->type;
+	menu->flags[menu->count] = item->is_selectable ? ITEM_SELECTABLE : 0;
+	menu->offsets[menu->count] = offset;
+	menu->link_hashes[menu->count] = item->link_hash;
+	menu->host_hashes[menu->count] = item->host_hash;
+	if (item->is_selectable) {
+		menu->selectable_map[menu->selectable_count++] = menu->count;
+	}
+	menu->count++;
+}
+
+/* Releases the menu columns. */
+void menu_index_free(MenuIndex *menu) {
+	if (menu->mapping) {
+		munmap(menu->mapping, menu->mapping_size);
+	} else {
+		free(menu->types);
+		free(menu->flags);
+		free(menu->offsets);
+		free(menu->link_hashes);
+		free(menu->host_hashes);
+		free(menu->selectable_map);
+	}
+	memset(menu, 0, sizeof(MenuIndex));
+}
+
+/* Names the saved index of a menu: <data dir>/pages/<URL hash>.idx. */
+BOOL menu_index_path(const NavigationState *nav, char *path) {
+	char key[MAX_CACHE_KEY_LENGTH];
+
+	make_cache_key(nav->host, nav->port, nav->selector, key);
+	return page_store_path(key, ".idx", path);
+}
+
+/* Maps the saved index of a menu if it was built from this exact body,
+ * replacing the columns `menu` holds. The mapping is private and writable,
+ * so flag updates stay in memory. */
+BOOL menu_index_load(MenuIndex *menu, const NavigationState *nav, size_t length, unsigned long body_hash) {
+	char path[MAX_PATH_LENGTH];
+	const MenuIndexHeader *header;
+	const unsigned long *offsets;
+	const int *selectable_map;
+	struct stat st;
+	unsigned long count, selectable_count, i;
+	size_t expected;
+	BOOL valid;
+	char *base;
+	void *map;
+	int fd;
+
+	if (!menu_index_path(nav, path) || (fd = open(path, O_RDONLY)) == -1) {
+		return FALSE;
+	}
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(MenuIndexHeader)) {
+		close(fd);
+		return FALSE;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return FALSE;
+	}
+
+	header = (const MenuIndexHeader *)map;
+	count = header->count;
+	selectable_count = header->selectable_count;
+	expected = sizeof(MenuIndexHeader) + count * (3 * sizeof(unsigned long) + 2) + selectable_count * sizeof(int);
+	if (header->magic != MENU_INDEX_MAGIC || header->body_hash != body_hash ||
+	        header->body_length != length || count > length || selectable_count > count ||
+	        (size_t)st.st_size != expected) {
+		munmap(map, st.st_size);
+		return FALSE;
+	}
+
+	/* Offsets index the body and the map indexes the columns. */
+	base = (char *)map + sizeof(MenuIndexHeader);
+	offsets = (const unsigned long *)base;
+	selectable_map = (const int *)(offsets + 3 * count);
+	for (i = 0; i < count && offsets[i] < length; ++i);
+	valid = (i == count);
+	for (i = 0; valid && i < selectable_count; ++i) {
+		valid = selectable_map[i] >= 0 && (unsigned long)selectable_map[i] < count;
+	}
+	if (!valid) {
+		munmap(map, st.st_size);
+		return FALSE;
+	}
+
+	menu_index_free(menu); /* Heap columns kept for reparsing. */
+	menu->offsets = (unsigned long *)base;
+	menu->link_hashes = menu->offsets + count;
+	menu->host_hashes = menu->link_hashes + count;
+	menu->selectable_map = (int *)(menu->host_hashes + count);
+	menu->types = (char *)(menu->selectable_map + selectable_count);
+	menu->flags = (unsigned char *)(menu->types + count);
+	menu->count = menu->capacity = (int)count;
+	menu->selectable_count = (int)selectable_count;
+	menu->mapping = map;
+	menu->mapping_size = st.st_size;
+	return TRUE;
+}
 
-		line = strtok(NULL, "\n");
+/* Saves a freshly built menu index for menu_index_load(). */
+void menu_index_save(const MenuIndex *menu, const NavigationState *nav, size_t length, unsigned long body_hash) {
+	char path[MAX_PATH_LENGTH];
+	char tmp_path[MAX_PATH_LENGTH + 16];
+	MenuIndexHeader header;
+	size_t count = menu->count;
+	int fd;
+	int ok;
+
+	if (!menu_index_path(nav, path)) {
+		return;
+	}
+	sprintf(tmp_path, "%s.%ld", path, (long)getpid());
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		return;
 	}
 
-	free(data_copy);
+	memset(&header, 0, sizeof(header));
+	header.magic = MENU_INDEX_MAGIC;
+	header.body_hash = body_hash;
+	header.body_length = length;
+	header.count = count;
+	header.selectable_count = menu->selectable_count;
+
+	/* Only the selectable bit is a property of the body. */
+	ok = write_all(fd, (const char *)&header, sizeof(header)) != -1 &&
+	     write_all(fd, (const char *)menu->offsets, count * sizeof(unsigned long)) != -1 &&
+	     write_all(fd, (const char *)menu->link_hashes, count * sizeof(unsigned long)) != -1 &&
+	     write_all(fd, (const char *)menu->host_hashes, count * sizeof(unsigned long)) != -1 &&
+	     write_all(fd, (const char *)menu->selectable_map, menu->selectable_count * sizeof(int)) != -1 &&
+	     write_all(fd, menu->types, count) != -1;
+	if (ok) {
+		size_t i;
+		for (i = 0; i < count && ok; i++) {
+			char flag = (char)(menu->flags[i] & ITEM_SELECTABLE);
+			ok = write_all(fd, &flag, 1) != -1;
+		}
+	}
+	close(fd);
+	if (!ok || rename(tmp_path, path) == -1) {
+		unlink(tmp_path);
+	}
 }
 
 /* Handles menu navigation based on user arrow key input. */
 void handle_menu_navigation(AppState *state, char input) {
-	int i;
 	int selected_array_idx = -1;
-	int current_selectable = 0;
 	int viewable_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 0;
 
 	if (state->selectable_items == 0) {
@@ -487,14 +2086,8 @@ void handle_menu_navigation(AppState *state, char input) {
 	}
 
 	/* Find the array index that corresponds to the new selected menu index. */
-	for (i = 0; i < state->total_items; ++i) {
-		if (state->gopher_items[i].is_selectable) {
-			current_selectable++;
-			if (current_selectable == state->selected_index) {
-				selected_array_idx = i;
-				break;
-			}
-		}
+	if (state->selected_index >= 1 && state->selected_index <= state->menu.selectable_count) {
+		selected_array_idx = state->menu.selectable_map[state->selected_index - 1];
 	}
 
 	/* Adjust the scroll offset to keep the selected item in view. */
@@ -509,17 +2102,19 @@ void handle_menu_navigation(AppState *state, char input) {
 
 /* Handles menu actions triggered by single-character input. */
 void handle_menu_action(AppState *state, char input) {
-	int i;
 	if (input == KEY_ENTER || input == KEY_CARRIAGE_RETURN) {
-		for (i = 0; i < state->total_items; ++i) {
-			if (state->gopher_items[i].is_selectable && state->gopher_items[i].menu_index == state->selected_index) {
-				GopherItem selected = state->gopher_items[i];
-				if (selected.type == '7') {
-					handle_search_prompt(state, &selected);
-				} else {
-					navigate_to(state, selected.host, selected.port, selected.selector, selected.type);
-				}
-				return; /* Action handled */
+		if (state->selected_index >= 1 && state->selected_index <= state->menu.selectable_count) {
+			GopherItem selected = *get_menu_item(state, state->menu.selectable_map[state->selected_index - 1]);
+			if (selected.type == '7') {
+				handle_search_prompt(state, &selected);
+			} else if (is_binary_type(selected.type)) {
+				view_binary_item(state, &selected);
+			} else {
+				const char *title = selected.display_string;
+
+				while (*title == ' ') title++;
+				navigate_to(state, selected.host, selected.port, selected.selector, selected.type);
+				sprintf(state->current_nav->title, "%.*s", MAX_TITLE_LENGTH, title);
 			}
 		}
 	} else if (input == 'b' || input == KEY_BACKSPACE) {
@@ -527,12 +2122,19 @@ void handle_menu_action(AppState *state, char input) {
 	} else if (input == 'f') {
 		navigate_forward(state);
 	} else if (input == 'r') {
-		if (state->current_nav->page_content) {
-			free(state->current_nav->page_content);
-			state->current_nav->page_content = NULL;
-		}
+		reload_current_page(state);
+	} else if (input == 's') {
+		handle_global_search(state);
+	} else if (input == 'h') {
+		handle_history_finder(state);
 	} else if (input == 'a') {
 		show_about_screen(state);
+	} else if (input == 't') {
+		state->show_telemetry = !state->show_telemetry;
+	} else if (input == 'w') {
+		state->show_waterfall = !state->show_waterfall;
+	} else if (input == 'c') {
+		check_menu_links(state);
 	} else if (input == 'o') {
 		handle_open_prompt(state);
 	} else if (input == 'q') {
@@ -545,37 +2147,63 @@ BOOL handle_gopher_menu_interaction(AppState* state) {
 	char input_buf[3];
 	ssize_t bytes_read;
 	fd_set read_fds;
+	fd_set write_fds;
 	struct timeval tv;
+	LinkProbe *probe = &state->preview.probe;
+	unsigned long input_ms;
+	int max_fd;
 
+	preview_select(state);
 	draw_gopher_menu(state);
 
 	while (state->is_running) {
+		watchdog_tick(state);
 		if (g_resize_pending) {
 			ioctl(STDOUT_FILENO, TIOCGWINSZ, &state->terminal_size);
+			preview_select(state);
 			draw_gopher_menu(state);
 			g_resize_pending = 0;
 			continue;
 		}
 
 		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
 		FD_SET(STDIN_FILENO, &read_fds);
+		max_fd = STDIN_FILENO;
+		if (probe->item != -1) {
+			link_probe_watch(probe, &read_fds, &write_fds, &max_fd);
+		}
 		tv.tv_sec = 0;
-		tv.tv_usec = 100000; /* 100ms timeout */
+		tv.tv_usec = state->preview.pending ? 50000 : 100000; /* 100ms timeout */
 
-		if (select(STDIN_FILENO + 1, &read_fds, NULL, NULL, &tv) > 0) {
+		if (select(max_fd + 1, &read_fds, &write_fds, NULL, &tv) > 0) {
 			if (FD_ISSET(STDIN_FILENO, &read_fds)) {
 				bytes_read = read(STDIN_FILENO, input_buf, sizeof(input_buf));
 				if (bytes_read <= 0) continue;
+				input_ms = get_elapsed_ms();
 
 				/* Handle 3-byte ANSI escape codes for arrow keys. */
 				if (bytes_read == 3 && input_buf[0] == KEY_ESC && input_buf[1] == '[') {
 					handle_menu_navigation(state, input_buf[2]);
+					preview_select(state);
 					draw_gopher_menu(state);
+					watchdog_frame(input_ms);
 				} else if (bytes_read == 1) {
+					preview_cancel(&state->preview);
 					handle_menu_action(state, input_buf[0]);
 					return state->is_running; /* Return to main loop to process state change. */
 				}
+				continue;
 			}
+		} else {
+			FD_ZERO(&read_fds);
+			FD_ZERO(&write_fds);
+		}
+		if (preview_poll(state, &read_fds, &write_fds) && !state->show_waterfall) {
+			draw_preview_pane(state);
+		}
+		if (state->show_waterfall) {
+			draw_waterfall(state);
 		}
 	}
 	return state->is_running;
@@ -587,11 +2215,17 @@ BOOL handle_text_viewer_interaction(AppState* state) {
 	ssize_t bytes_read;
 	int viewable_rows;
 	fd_set read_fds;
+	fd_set write_fds;
 	struct timeval tv;
+	LinkProbe *probe = &state->follow.probe;
+	unsigned long input_ms;
+	int max_fd;
+	int ready;
 
 	draw_text_viewer(state, state->current_nav->page_content);
 
 	while (state->is_running) {
+		watchdog_tick(state);
 		viewable_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 1;
 		calculate_text_lines(state, state->current_nav->page_content);
 
@@ -611,14 +2245,28 @@ BOOL handle_text_viewer_interaction(AppState* state) {
 		}
 
 		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
 		FD_SET(STDIN_FILENO, &read_fds);
+		max_fd = STDIN_FILENO;
+		if (probe->item != -1) {
+			link_probe_watch(probe, &read_fds, &write_fds, &max_fd);
+		}
 		tv.tv_sec = 0;
 		tv.tv_usec = 100000;
 
-		if (select(STDIN_FILENO + 1, &read_fds, NULL, NULL, &tv) > 0) {
+		ready = select(max_fd + 1, &read_fds, &write_fds, NULL, &tv);
+		if (ready <= 0) {
+			FD_ZERO(&read_fds);
+			FD_ZERO(&write_fds);
+		}
+		if (follow_poll(state, &read_fds, &write_fds)) {
+			draw_text_viewer(state, state->current_nav->page_content);
+		}
+		if (ready > 0) {
 			if (FD_ISSET(STDIN_FILENO, &read_fds)) {
 				bytes_read = read(STDIN_FILENO, input_buf, sizeof(input_buf));
 				if (bytes_read <= 0) continue;
+				input_ms = get_elapsed_ms();
 
 				if (bytes_read == 3 && input_buf[0] == KEY_ESC && input_buf[1] == '[') {
 					char key = input_buf[2];
@@ -633,6 +2281,7 @@ BOOL handle_text_viewer_interaction(AppState* state) {
 						state->text_scroll_line += viewable_rows;
 					}
 					draw_text_viewer(state, state->current_nav->page_content);
+					watchdog_frame(input_ms);
 				} else if (bytes_read == 1) {
 					char c = input_buf[0];
 					if (c == 'b' || c == KEY_BACKSPACE) {
@@ -640,14 +2289,36 @@ BOOL handle_text_viewer_interaction(AppState* state) {
 					} else if (c == 'f') {
 						navigate_forward(state);
 					} else if (c == 'r') {
-						if (state->current_nav->page_content) {
-							free(state->current_nav->page_content);
-							state->current_nav->page_content = NULL;
-						}
+						reload_current_page(state);
+					} else if (c == 's') {
+						handle_global_search(state);
+					} else if (c == 'h') {
+						handle_history_finder(state);
 					} else if (c == 'a') {
 						show_about_screen(state);
 						draw_text_viewer(state, state->current_nav->page_content); /* Redraw after about screen */
 						continue;
+					} else if (c == 'F') {
+						if (state->follow.active) {
+							follow_stop(&state->follow);
+						} else if (!state->current_nav->is_local && !state->current_nav->is_error_page) {
+							follow_start(state);
+						}
+						draw_text_viewer(state, state->current_nav->page_content);
+						continue;
+					} else if (c == 'n' || c == 'p') {
+						int change = find_change(&state->current_nav->lines, state->text_scroll_line, c == 'n' ? 1 : -1);
+						if (change != -1) {
+							state->text_scroll_line = change;
+							if (state->text_scroll_line > state->total_content_lines - viewable_rows) {
+								state->text_scroll_line = state->total_content_lines - viewable_rows;
+							}
+							if (state->text_scroll_line < 0) {
+								state->text_scroll_line = 0;
+							}
+							draw_text_viewer(state, state->current_nav->page_content);
+						}
+						continue;
 					} else if (c == 'o') {
 						handle_open_prompt(state);
 						/* The main loop will handle redrawing */
@@ -769,7 +2440,18 @@ void handle_open_prompt(AppState *state) {
 		}
 
 		if (parse_gopher_address(url_input, new_host, &new_port, new_selector, &new_type)) {
-			navigate_to(state, new_host, new_port, new_selector, new_type);
+			if (is_binary_type(new_type)) {
+				GopherItem item;
+
+				memset(&item, 0, sizeof(item));
+				item.type = new_type;
+				strcpy(item.host, new_host);
+				item.port = new_port;
+				strcpy(item.selector, new_selector);
+				view_binary_item(state, &item);
+			} else {
+				navigate_to(state, new_host, new_port, new_selector, new_type);
+			}
 			return; /* Success */
 		} else {
 			clear_line(rows, state->terminal_size.ws_col);
@@ -781,207 +2463,1705 @@ void handle_open_prompt(AppState *state) {
 	}
 }
 
-/* Formats the current Gopher URL into a string. */
-void get_current_url(const NavigationState* nav, char* buffer, size_t size) {
-	size_t required_size;
+/* Reads a line of input on the bottom row. Returns FALSE if cancelled. */
+BOOL read_prompt(AppState *state, const char *label, char *out, int size) {
+	int rows = state->terminal_size.ws_row;
+	int start_col = (state->terminal_size.ws_col - MAX_CONTENT_DISPLAY_WIDTH) / 2;
+	int i = 0;
+	char c;
 
-	if (nav->selector[0] == '\0' || (nav->selector[0] == '1' && nav->selector[1] == '\0')) {
-		required_size = strlen("gopher://") + strlen(nav->host) + 1 + 5 + 1;
-		if (required_size < size) {
-			sprintf(buffer, "gopher://%s:%d/", nav->host, nav->port);
-		} else {
-			buffer[0] = '\0';
-		}
-	} else {
-		required_size = strlen("gopher://") + strlen(nav->host) + 1 + 5 + 1 + strlen(nav->selector) + 1;
-		if (required_size < size) {
-			sprintf(buffer, "gopher://%s:%d/%c%s", nav->host, nav->port, nav->type, nav->selector);
-		} else {
-			buffer[0] = '\0';
-		}
-	}
-}
+	if (start_col < 1) start_col = 1;
 
-/* Draws the application header with the current URL. */
-void draw_header(const AppState* state) {
-	char url_buffer[MAX_URL_INPUT_LENGTH];
-	char header_background[MAX_CONTENT_DISPLAY_WIDTH + 1];
+	clear_line(rows, state->terminal_size.ws_col);
+	move_cursor(rows, start_col);
+	printf("%s%s%s", FOOTER_COLOR, label, COLOR_RESET);
+	move_cursor(rows, start_col + strlen(label));
+	set_cursor_visibility(1);
+	fflush(stdout);
 
-	get_current_url(state->current_nav, url_buffer, sizeof(url_buffer));
+	while (read(STDIN_FILENO, &c, 1) > 0) {
+		if (c == KEY_ENTER || c == KEY_CARRIAGE_RETURN) {
+			break;
+		} else if (c == KEY_BACKSPACE || c == 8) {
+			if (i > 0) {
+				i--;
+				move_cursor(rows, start_col + strlen(label) + i);
+				printf("\b \b");
+				fflush(stdout);
+			}
+		} else if (c == KEY_ESC) {
+			i = 0; /* Cancel */
+			break;
+		} else if (isprint(c) && i < size - 1) {
+			out[i++] = c;
+			printf("%c", c);
+			fflush(stdout);
+		}
+	}
+	out[i] = '\0';
 
-	/* Create a string of spaces for the background. */
-	memset(header_background, ' ', MAX_CONTENT_DISPLAY_WIDTH);
-	header_background[MAX_CONTENT_DISPLAY_WIDTH] = '\0';
+	set_cursor_visibility(0);
+	clear_line(rows, state->terminal_size.ws_col);
+	return i > 0;
+}
 
-	/* Print the colored background bar, centered. */
-	printf("%s%s", HEADER_BG, HEADER_FG);
-	print_centered_string(header_background, 1, state->terminal_size.ws_col);
+/* Searches every page fetched so far and shows the ranked results as a menu. */
+void handle_global_search(AppState *state) {
+	char query[MAX_SELECTOR_LENGTH];
+	char label[MAX_SELECTOR_LENGTH + 16];
+	char *results;
 
-	/* Print the URL text on top of the background. */
-	print_centered_string(url_buffer, 1, state->terminal_size.ws_col);
-	printf("%s", COLOR_RESET);
+	if (!read_prompt(state, "Search fetched pages: ", query, sizeof(query))) {
+		return;
+	}
 
-	move_cursor(2, 1); /* Move cursor below header for content. */
-	fflush(stdout);
+	results = search_index_query(query);
+	if (!results) {
+		return;
+	}
+	sprintf(label, "search?%s", query);
+	show_local_page(state, label, results);
 }
 
-/* Draws the Gopher menu to the terminal screen. */
-void draw_gopher_menu(AppState* state) {
-	int available_rows;
+/* Fuzzy finder over the global history. The visits are re-ranked on every
+ * key; arrows pick one and Enter opens it. */
+void handle_history_finder(AppState *state) {
+	HistoryFinder finder;
+	GopherItem item;
+	char query[MAX_TITLE_LENGTH + 1];
+	char input_buf[3];
+	ssize_t bytes_read;
+	unsigned long started;
+	unsigned long elapsed = 0;
+	int length = 0;
+	int selected = 0;
+	int limit = state->terminal_size.ws_row - 3;
 	int i;
-	int item_on_screen_count = 0;
-	int start_col;
-	char display_buf[MAX_DISPLAY_LENGTH + 20];
-	const char* color;
-	BOOL is_selected;
-
-	clear_terminal();
-	draw_header(state);
-
-	available_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 0;
-	start_col = (state->terminal_size.ws_col - MAX_CONTENT_DISPLAY_WIDTH) / 2 + 1;
-	if (start_col < 1) start_col = 1;
+	BOOL changed = TRUE;
+	char c;
 
-	for (i = state->scroll_offset; i < state->total_items && item_on_screen_count < available_rows; ++i) {
-		is_selected = state->gopher_items[i].is_selectable && (state->gopher_items[i].menu_index == state->selected_index);
+	if (!history_open(&finder)) {
+		clear_line(state->terminal_size.ws_row, state->terminal_size.ws_col);
+		move_cursor(state->terminal_size.ws_row, 1);
+		printf("%sNo history yet. Press any key.%s", FOOTER_COLOR, COLOR_RESET);
+		fflush(stdout);
+		read(STDIN_FILENO, &c, 1);
+		return;
+	}
+	if (limit > HISTORY_MAX_RESULTS) limit = HISTORY_MAX_RESULTS;
+	if (limit < 1) limit = 1;
+	query[0] = '\0';
 
-		if (state->gopher_items[i].is_selectable) {
-			if (strlen(state->gopher_items[i].display_string) + 3 < sizeof(display_buf)) {
-				sprintf(display_buf, "%s%s", is_selected ? "->" : "  ", state->gopher_items[i].display_string);
-			} else {
-				strncpy(display_buf, state->gopher_items[i].display_string, sizeof(display_buf) - 1);
-				display_buf[sizeof(display_buf) - 1] = '\0';
+	clear_terminal();
+	for (;;) {
+		if (changed) {
+			started = get_elapsed_ms();
+			history_rank(&finder, query, limit);
+			elapsed = get_elapsed_ms() - started;
+			selected = 0;
+			changed = FALSE;
+		}
+		draw_history_finder(state, &finder, query, selected, elapsed);
+
+		bytes_read = read(STDIN_FILENO, input_buf, sizeof(input_buf));
+		if (bytes_read <= 0) continue;
+		if (bytes_read == 3 && input_buf[0] == KEY_ESC && input_buf[1] == '[') {
+			if (input_buf[2] == KEY_UP && selected > 0) {
+				selected--;
+			} else if (input_buf[2] == KEY_DOWN && selected < finder.match_count - 1) {
+				selected++;
 			}
-		} else {
-			if (strlen(state->gopher_items[i].display_string) + 3 < sizeof(display_buf)) {
-				sprintf(display_buf, "  %s", state->gopher_items[i].display_string);
-			} else {
-				strncpy(display_buf, state->gopher_items[i].display_string, sizeof(display_buf) - 1);
-				display_buf[sizeof(display_buf) - 1] = '\0';
+			continue;
+		}
+		if (input_buf[0] == KEY_ESC) {
+			break;
+		}
+		for (i = 0; i < bytes_read; i++) {
+			c = input_buf[i];
+			if (c == KEY_ENTER || c == KEY_CARRIAGE_RETURN) {
+				if (finder.match_count > 0 && history_entry(&finder, finder.matches[selected], &item)) {
+					navigate_to(state, item.host, item.port, item.selector, item.type);
+					strcpy(state->current_nav->title, item.display_string);
+				}
+				history_close(&finder);
+				set_cursor_visibility(0);
+				return;
+			} else if (c == KEY_BACKSPACE || c == 8) {
+				if (length > 0) {
+					query[--length] = '\0';
+					changed = TRUE;
+				}
+			} else if (isprint((unsigned char)c) && length < (int)sizeof(query) - 1) {
+				query[length++] = c;
+				query[length] = '\0';
+				changed = TRUE;
 			}
 		}
-
-		color = get_gopher_item_color(state->gopher_items[i].type, is_selected);
-		printf("%s", color);
-		print_string_at(display_buf, 4 + item_on_screen_count, start_col);
-		printf("%s", COLOR_RESET);
-		item_on_screen_count++;
 	}
-	fflush(stdout);
+	history_close(&finder);
+	set_cursor_visibility(0);
 }
 
-/* Draws the current text content to the terminal screen. */
-void draw_text_viewer(AppState* state, const char *content) {
-	int available_rows;
-	const char *ptr = content;
-	int start_col;
-	int lines_to_skip;
-	int drawn_lines = 0;
+/* Pushes a page generated by tocaia itself onto the history. */
+void show_local_page(AppState *state, const char *label, char *content) {
+	navigate_to(state, "localhost", 0, label, '1');
+	state->current_nav->is_local = TRUE;
+	state->current_nav->page_content = content;
+}
 
-	clear_terminal();
-	draw_header(state);
+/* Probes every link in the current menu concurrently: at most
+ * CHECK_MAX_PARALLEL at once, and per host as many as its tuned
+ * concurrency limit allows. A probe
+ * connects, sends the selector and waits for the first byte of the reply.
+ * The menu is redrawn as results arrive; any key cancels. */
+void check_menu_links(AppState *state) {
+	LinkProbe probes[CHECK_MAX_PARALLEL];
+	ResolvedHost hosts[CHECK_RESOLVE_SLOTS];
+	const GopherItem *item;
+	int queued = 0;
+	int done = 0;
+	int dead = 0;
+	int active = 0;
+	int next_item = 0;
+	int per_host;
+	int max_fd;
+	int i;
+	int j;
+	int error;
+	socklen_t error_len;
+	unsigned long now;
+	fd_set read_fds;
+	fd_set write_fds;
+	struct timeval tv;
+	char byte;
+	char status[MAX_CONTENT_DISPLAY_WIDTH + 1];
+	ssize_t n;
+	BOOL cancelled = FALSE;
+	BOOL dirty = TRUE;
+
+	if (!budget_allows(FETCH_PRIORITY_CHECK)) {
+		clear_line(state->terminal_size.ws_row, state->terminal_size.ws_col);
+		move_cursor(state->terminal_size.ws_row, 1);
+		printf("%sLinks not checked. %s Press any key.%s", FOOTER_COLOR, g_fetch_error, COLOR_RESET);
+		fflush(stdout);
+		read(STDIN_FILENO, &byte, 1);
+		return;
+	}
+	memset(hosts, 0, sizeof(hosts));
+	for (i = 0; i < CHECK_MAX_PARALLEL; i++) {
+		probes[i].item = -1;
+	}
+	for (i = 0; i < state->menu.count; i++) {
+		state->menu.flags[i] &= (unsigned char)~ITEM_CHECK_BITS;
+		if (state->menu.flags[i] & ITEM_SELECTABLE) {
+			state->menu.flags[i] |= ITEM_QUEUED;
+			queued++;
+		}
+	}
 
-	available_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 0;
-	start_col = (state->terminal_size.ws_col - MAX_CONTENT_DISPLAY_WIDTH)/2 + 1;
-	if (start_col < 1) start_col = 1;
+	while (done < queued && !cancelled) {
+		/* Start probes in menu order, skipping hosts already at their cap. */
+		for (i = next_item; i < state->menu.count && active < CHECK_MAX_PARALLEL; i++) {
+			if (!(state->menu.flags[i] & ITEM_QUEUED)) {
+				if (i == next_item) next_item++;
+				continue;
+			}
+			per_host = 0;
+			for (j = 0; j < CHECK_MAX_PARALLEL; j++) {
+				if (probes[j].item != -1 && probes[j].host_hash == state->menu.host_hashes[i]) {
+					/* Until its name is resolved, one probe per host is enough. */
+					per_host += probes[j].resolving ? CHECK_MAX_PARALLEL : 1;
+				}
+			}
+			if (per_host >= host_concurrency_limit(state->menu.host_hashes[i])) {
+				continue;
+			}
+			item = get_menu_item(state, i);
+
+			state->menu.flags[i] = (state->menu.flags[i] & (unsigned char)~ITEM_QUEUED) | ITEM_CHECKING;
+			if (i == next_item) next_item++;
+			if (!breaker_allows_fetch(item->host, item->port, FALSE)) {
+				link_check_result(state, i, ITEM_DEAD, 0, FALSE);
+				done++;
+				dead++;
+				continue;
+			}
+			for (j = 0; probes[j].item != -1; j++);
+			if (!link_probe_start(&probes[j], item, hosts, FETCH_PRIORITY_CHECK)) {
+				link_check_result(state, i, ITEM_DEAD, 0, TRUE);
+				done++;
+				dead++;
+				continue;
+			}
+			probes[j].item = i;
+			active++;
+		}
+
+		if (dirty) {
+			draw_gopher_menu(state);
+			sprintf(status, "Checking links: %d/%d done, %d dead. Any key cancels.", done, queued, dead);
+			clear_line(state->terminal_size.ws_row, state->terminal_size.ws_col);
+			move_cursor(state->terminal_size.ws_row, 1);
+			printf("%s%s%s", FOOTER_COLOR, status, COLOR_RESET);
+			fflush(stdout);
+			dirty = FALSE;
+		} else if (state->show_waterfall) {
+			draw_waterfall(state);
+		}
+		if (done >= queued) {
+			break;
+		}
 
-	printf("%s", TEXT_COLOR);
+		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		FD_SET(STDIN_FILENO, &read_fds);
+		max_fd = STDIN_FILENO;
+		for (j = 0; j < CHECK_MAX_PARALLEL; j++) {
+			if (probes[j].item != -1) link_probe_watch(&probes[j], &read_fds, &write_fds, &max_fd);
+		}
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000;
+		if (select(max_fd + 1, &read_fds, &write_fds, NULL, &tv) < 0) {
+			if (errno != EINTR) break;
+			FD_ZERO(&read_fds);
+			FD_ZERO(&write_fds);
+		}
 
-	/* Skip lines to the current scroll offset. */
-	lines_to_skip = state->text_scroll_line;
-	while (*ptr != '\0' && lines_to_skip > 0) {
-		const char *newline = strchr(ptr, '\n');
-		if (newline == NULL) { /* Reached end of content */
-			ptr = content + strlen(content);
+		if (FD_ISSET(STDIN_FILENO, &read_fds)) {
+			read(STDIN_FILENO, &byte, 1);
+			cancelled = TRUE;
 			break;
 		}
-		ptr = newline + 1;
-		lines_to_skip--;
-	}
+		if (g_resize_pending) {
+			ioctl(STDOUT_FILENO, TIOCGWINSZ, &state->terminal_size);
+			g_resize_pending = 0;
+			dirty = TRUE;
+		}
 
-	/* Draw content from the new starting point, line by line. */
-	while (*ptr != '\0' && drawn_lines < available_rows) {
-		const char* next_newline = strchr(ptr, '\n');
-		size_t line_length = (next_newline != NULL) ? (size_t)(next_newline - ptr) : strlen(ptr);
-		char temp_line[MAX_CONTENT_DISPLAY_WIDTH + 1];
+		now = get_elapsed_ms();
+		for (j = 0; j < CHECK_MAX_PARALLEL; j++) {
+			LinkProbe *probe = &probes[j];
+			unsigned char result = 0;
+			BOOL host_failed = FALSE;
 
-		/* Truncate line if it's too long for the display width. */
-		size_t copy_len = line_length > MAX_CONTENT_DISPLAY_WIDTH ? MAX_CONTENT_DISPLAY_WIDTH : line_length;
-		strncpy(temp_line, ptr, copy_len);
-		temp_line[copy_len] = '\0';
+			if (probe->item == -1) continue;
 
-		print_string_at(temp_line, 4 + drawn_lines, start_col);
+			if (probe->resolving) {
+				if (FD_ISSET(probe->sock, &read_fds) && !link_probe_resolved(probe)) {
+					result = ITEM_DEAD;
+					host_failed = TRUE;
+				}
+			} else if (!probe->connected && FD_ISSET(probe->sock, &write_fds)) {
+				item = get_menu_item(state, probe->item);
+				error = 0;
+				error_len = sizeof(error);
+				if (getsockopt(probe->sock, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1 || error != 0 ||
+				        write_all(probe->sock, item->selector, strlen(item->selector)) == -1 ||
+				        write_all(probe->sock, CRLF, strlen(CRLF)) == -1) {
+					result = ITEM_DEAD;
+					host_failed = TRUE;
+				} else {
+					probe->connected = TRUE;
+					fetch_timing_mark(probe->timing, FETCH_CONNECTED);
+				}
+			} else if (probe->connected && FD_ISSET(probe->sock, &read_fds)) {
+				n = metered_read(probe->sock, &byte, 1);
+				if (n > 0) {
+					fetch_timing_mark(probe->timing, FETCH_FIRST_BYTE);
+					result = now - probe->started_ms >= SLOW_FETCH_MS ? ITEM_SLOW : ITEM_LIVE;
+				} else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+					result = ITEM_DEAD; /* The host answered, but with nothing. */
+				}
+			}
+			if (!result && now - probe->started_ms >= CONNECT_TIMEOUT_MS) {
+				result = ITEM_DEAD;
+				host_failed = TRUE;
+			}
 
-		drawn_lines++;
-		if (next_newline != NULL) {
-			ptr = next_newline + 1;
-		} else {
-			break; /* End of content */
+			if (result) {
+				link_check_result(state, probe->item, result, now - probe->started_ms, host_failed);
+				link_probe_close(probe, result == ITEM_DEAD ? FETCH_FAILED : FETCH_DONE, result == ITEM_DEAD ? 0 : 1);
+				active--;
+				done++;
+				if (result == ITEM_DEAD) dead++;
+				dirty = TRUE;
+			}
 		}
 	}
 
-	printf("%s", COLOR_RESET);
-	fflush(stdout);
+	for (j = 0; j < CHECK_MAX_PARALLEL; j++) {
+		if (probes[j].item != -1) {
+			link_probe_close(&probes[j], FETCH_CANCELLED, 0);
+		}
+	}
+	for (i = 0; i < state->menu.count; i++) {
+		state->menu.flags[i] &= (unsigned char)~(ITEM_QUEUED | ITEM_CHECKING);
+	}
 }
 
-void show_about_screen(const AppState* state) {
-	char c;
-	char header_background[MAX_CONTENT_DISPLAY_WIDTH + 1];
-
-	const char *about_body[] = {
-		"    Welcome to Tocaia %s!",
-		"        \\`~'/",
-		"        (o o)",
-		"       / \\ / \\",
-		"          \"",
-		"",
-		"Shortcuts:",
-		"    Arrows: Navigate",
-		"      Enter: Select",
-		"        b: Back",
-		"        f: Forward",
-		"        o: Open URL",
-		"        r: Reload",
-		"        a: About",
-		"        q: Quit",
-		NULL
-	};
-
-	int body_lines = 0;
-	int max_width = 0;
-	int start_row;
-	int start_col;
-	char version_info[50];
+/* Starts a probe. A host name already in `hosts` is connected to at once;
+ * any other is looked up by a forked resolver first, and the probe waits
+ * on its pipe until link_probe_resolved() is called. Only the first
+ * address of a host is tried.
+ * Returns FALSE if the link is dead before any packet is sent. */
+BOOL link_probe_start(LinkProbe *probe, const GopherItem *item, ResolvedHost *hosts, int priority) {
+	struct hostent *he;
+	int result_pipe[2];
 	int i;
 
-	while (about_body[body_lines] != NULL) {
-		int len = strlen(about_body[body_lines]);
-		if (len > max_width) {
-			max_width = len;
+	probe->timing = fetch_timing_begin(item->host, item->port, item->selector, priority);
+	probe->started_ms = get_elapsed_ms();
+	probe->host_hash = item->host_hash;
+	probe->port = item->port;
+	probe->resolving = FALSE;
+	probe->connected = FALSE;
+	probe->host = NULL;
+	for (i = 0; i < CHECK_RESOLVE_SLOTS; i++) {
+		ResolvedHost *slot = &hosts[(item->host_hash + i) & (CHECK_RESOLVE_SLOTS - 1)];
+		if (!slot->in_use || slot->host_hash == item->host_hash) {
+			probe->host = slot;
+			break;
 		}
-		body_lines++;
+	}
+	if (probe->host && probe->host->in_use && !probe->host->pending) {
+		if (!probe->host->found) {
+			fetch_timing_end(probe->timing, FETCH_FAILED, 0);
+			return FALSE;
+		}
+		if (!link_probe_connect(probe, probe->host->addr)) {
+			fetch_timing_end(probe->timing, FETCH_FAILED, 0);
+			return FALSE;
+		}
+		return TRUE;
+	}
+	if (probe->host && !probe->host->in_use) {
+		probe->host->in_use = TRUE;
+		probe->host->pending = TRUE;
+		probe->host->host_hash = item->host_hash;
 	}
 
-	clear_terminal();
-	memset(header_background, ' ', MAX_CONTENT_DISPLAY_WIDTH);
-	header_background[MAX_CONTENT_DISPLAY_WIDTH] = '\0';
+	if (pipe(result_pipe) == -1) {
+		fetch_timing_end(probe->timing, FETCH_FAILED, 0);
+		return FALSE;
+	}
+	probe->resolver = fork();
+	if (probe->resolver == -1) {
+		close(result_pipe[0]);
+		close(result_pipe[1]);
+		fetch_timing_end(probe->timing, FETCH_FAILED, 0);
+		return FALSE;
+	}
+	if (probe->resolver == 0) {
+		/* The answer is the address, or nothing if the name is unknown. */
+		close(result_pipe[0]);
+		he = gethostbyname(item->host);
+		if (he) write_all(result_pipe[1], he->h_addr_list[0], sizeof(struct in_addr));
+		_exit(EXIT_SUCCESS);
+	}
+	close(result_pipe[1]);
+	probe->sock = result_pipe[0];
+	probe->resolving = TRUE;
+	return TRUE;
+}
 
-	printf("%s%s", HEADER_BG, HEADER_FG);
-	print_centered_string(header_background, 1, state->terminal_size.ws_col);
-	print_centered_string("About Tocaia", 1, state->terminal_size.ws_col);
-	printf(COLOR_RESET);
+/* Takes the answer of a probe's resolver, once its pipe is readable, and
+ * starts the connect. Returns FALSE if the host is unknown or cannot be
+ * connected to; the probe must still be closed. */
+BOOL link_probe_resolved(LinkProbe *probe) {
+	struct in_addr addr;
+	ssize_t n = read(probe->sock, &addr, sizeof(addr));
+
+	close(probe->sock);
+	probe->sock = -1;
+	waitpid(probe->resolver, NULL, 0);
+	probe->resolving = FALSE;
+	if (probe->host) {
+		probe->host->pending = FALSE;
+		probe->host->found = (n == (ssize_t)sizeof(addr));
+		if (probe->host->found) probe->host->addr = addr;
+	}
+	return n == (ssize_t)sizeof(addr) && link_probe_connect(probe, addr);
+}
 
-	move_cursor(2, 1);
+/* Opens the probe's socket and starts a non-blocking connect to `addr`.
+ * Returns FALSE, with no socket open, if it failed at once. */
+BOOL link_probe_connect(LinkProbe *probe, struct in_addr addr) {
+	struct sockaddr_in target;
 
-	start_row = (state->terminal_size.ws_row - body_lines) / 2;
-	if (start_row < 3) start_row = 3;
+	fetch_timing_mark(probe->timing, FETCH_RESOLVED);
+	memset(&target, 0, sizeof(target));
+	target.sin_family = AF_INET;
+	target.sin_port = htons(probe->port);
+	target.sin_addr = addr;
 
-	start_col = (state->terminal_size.ws_col - max_width) / 2;
-	if (start_col < 1) start_col = 1;
+	probe->sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (probe->sock == -1) {
+		return FALSE;
+	}
+	fcntl(probe->sock, F_SETFL, fcntl(probe->sock, F_GETFL, 0) | O_NONBLOCK);
+	meter_socket(probe->sock, probe->host_hash);
+	if (connect(probe->sock, (struct sockaddr *)&target, sizeof(target)) == -1 && errno != EINPROGRESS) {
+		close(probe->sock);
+		probe->sock = -1;
+		return FALSE;
+	}
+	return TRUE;
+}
 
-	sprintf(version_info, "Welcome to Tocaia %s!", PROGRAM_VERSION);
+/* Adds the descriptor a probe is waiting on to the select() sets: the
+ * resolver's pipe or the socket for reading, or the socket for writing
+ * while the connect is in progress. */
+void link_probe_watch(const LinkProbe *probe, fd_set *read_fds, fd_set *write_fds, int *max_fd) {
+	FD_SET(probe->sock, probe->resolving || probe->connected ? read_fds : write_fds);
+	if (probe->sock > *max_fd) *max_fd = probe->sock;
+}
 
-	for (i = 0; i < body_lines; ++i) {
+/* Closes a probe's connection, or stops its resolver, and frees its slot,
+ * completing its timing record with one of the FETCH_DONE... results.
+ * Probes mostly hang up after a partial read, so what already arrived is
+ * drained first to keep the budget honest. */
+void link_probe_close(LinkProbe *probe, int result, unsigned long size) {
+	if (probe->resolving) {
+		kill(probe->resolver, SIGKILL);
+		waitpid(probe->resolver, NULL, 0);
+		probe->resolving = FALSE;
+	} else if (probe->connected) {
+		drain_socket(probe->sock);
+	}
+	if (probe->sock != -1) {
+		close(probe->sock);
+	}
+	probe->item = -1;
+	fetch_timing_end(probe->timing, result, size);
+}
+
+/* Marks a checked item and remembers the verdict in the link telemetry, so
+ * it survives the menu being rebuilt. Unreachable hosts feed the breaker. */
+void link_check_result(AppState *state, int item, unsigned char result, unsigned long latency_ms, BOOL host_failed) {
+	FetchTelemetry *slot;
+
+	state->menu.flags[item] = (state->menu.flags[item] & (unsigned char)~ITEM_CHECK_BITS) | result;
+
+	slot = telemetry_slot(g_link_telemetry, TELEMETRY_LINK_SLOTS, state->menu.link_hashes[item], TRUE);
+	slot->probe_flags = result;
+	slot->probe_ms = latency_ms;
+
+	if (result != ITEM_DEAD || host_failed) {
+		slot = telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS, state->menu.host_hashes[item], TRUE);
+		slot->failed = host_failed;
+		slot->latency_ms = latency_ms;
+		breaker_record(slot, host_failed);
+		host_concurrency_record(state->menu.host_hashes[item], host_failed, latency_ms);
+	}
+}
+
+/* The preview pane needs room for the full menu column beside it. */
+BOOL preview_enabled(const AppState *state) {
+	return state->terminal_size.ws_col >= PREVIEW_MIN_COLUMNS;
+}
+
+/* Points the preview pane at the highlighted item. Copies already held in
+ * memory, in the shared cache or in the page store are shown at once;
+ * anything else is fetched once the selection has rested a moment. */
+void preview_select(AppState *state) {
+	Preview *preview = &state->preview;
+	const GopherItem *item;
+	PreviewEntry *entry;
+	char key[MAX_CACHE_KEY_LENGTH];
+	char *data;
+	size_t length;
+	int selected;
+
+	if (!preview_enabled(state) || state->selected_index < 1 ||
+	        state->selected_index > state->menu.selectable_count) {
+		preview_cancel(preview);
+		return;
+	}
+	selected = state->menu.selectable_map[state->selected_index - 1];
+	if (selected == preview->item) {
+		return;
+	}
+	preview_cancel(preview);
+	preview->item = selected;
+
+	item = get_menu_item(state, selected);
+	if (item->type != '0' && item->type != '1') {
+		preview->status = "No preview for this item type.";
+		return;
+	}
+
+	entry = preview_cache_find(preview, item->link_hash);
+	if (entry) {
+		preview->buffer = malloc(entry->length + 1);
+		if (!preview->buffer) {
+			die("Error: Failed to allocate memory for the preview.");
+		}
+		memcpy(preview->buffer, entry->data, entry->length + 1);
+		preview->length = entry->length;
+		return;
+	}
+
+	make_cache_key(item->host, item->port, item->selector, key);
+	data = shared_cache_lookup(key, &length);
+	if (data) {
+		if (length > PREVIEW_MAX_BYTES) {
+			length = PREVIEW_MAX_BYTES;
+			data[length] = '\0';
+		}
+	} else {
+		data = page_store_read(key, PREVIEW_MAX_BYTES, &length);
+	}
+	if (data) {
+		fetch_timing_end(fetch_timing_begin(item->host, item->port, item->selector, FETCH_PRIORITY_PREVIEW),
+		                 FETCH_CACHE_HIT, length);
+		preview->buffer = data;
+		preview->length = length;
+		preview_cache_store(preview, item->link_hash, data, length);
+		return;
+	}
+
+	if (!breaker_allows_fetch(item->host, item->port, FALSE)) {
+		preview->status = "Host is failing; not fetched.";
+		return;
+	}
+	if (!budget_allows(FETCH_PRIORITY_PREVIEW)) {
+		preview->status = "Data budget low; not fetched.";
+		return;
+	}
+	preview->pending = TRUE;
+	preview->start_at_ms = get_elapsed_ms() + PREVIEW_DELAY_MS;
+	preview->status = "Loading preview...";
+}
+
+/* Drops the pane contents and any fetch in flight. */
+void preview_cancel(Preview *preview) {
+	if (preview->probe.item != -1) {
+		link_probe_close(&preview->probe, FETCH_CANCELLED, preview->length);
+	}
+	free(preview->buffer);
+	preview->buffer = NULL;
+	preview->length = 0;
+	preview->pending = FALSE;
+	preview->status = NULL;
+	preview->item = -1;
+}
+
+/* Advances the preview fetch using the descriptors select() reported.
+ * Returns TRUE if the pane needs redrawing. */
+BOOL preview_poll(AppState *state, fd_set *read_fds, fd_set *write_fds) {
+	Preview *preview = &state->preview;
+	LinkProbe *probe = &preview->probe;
+	const GopherItem *item;
+	unsigned long now = get_elapsed_ms();
+	socklen_t error_len;
+	ssize_t n;
+	int error;
+	int result = FETCH_DONE;
+	BOOL done = FALSE;
+
+	if (!preview->pending) {
+		return FALSE;
+	}
+	item = get_menu_item(state, preview->item);
+
+	if (probe->item == -1) {
+		if (now < preview->start_at_ms) {
+			return FALSE;
+		}
+		if (!link_probe_start(probe, item, preview->hosts, FETCH_PRIORITY_PREVIEW)) {
+			preview->pending = FALSE;
+			preview->status = "Host unreachable.";
+			return TRUE;
+		}
+		probe->item = preview->item;
+		preview->buffer = malloc(PREVIEW_MAX_BYTES + 1);
+		if (!preview->buffer) {
+			die("Error: Failed to allocate memory for the preview.");
+		}
+		preview->length = 0;
+		return FALSE;
+	}
+
+	if (probe->resolving) {
+		if (FD_ISSET(probe->sock, read_fds) && !link_probe_resolved(probe)) {
+			preview->status = "Host unreachable.";
+			result = FETCH_FAILED;
+			done = TRUE;
+		}
+	} else if (!probe->connected && FD_ISSET(probe->sock, write_fds)) {
+		error = 0;
+		error_len = sizeof(error);
+		if (getsockopt(probe->sock, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1 || error != 0 ||
+		        write_all(probe->sock, item->selector, strlen(item->selector)) == -1 ||
+		        write_all(probe->sock, CRLF, strlen(CRLF)) == -1) {
+			preview->status = "Host unreachable.";
+			result = FETCH_FAILED;
+			done = TRUE;
+		} else {
+			probe->connected = TRUE;
+			fetch_timing_mark(probe->timing, FETCH_CONNECTED);
+		}
+	} else if (probe->connected && FD_ISSET(probe->sock, read_fds)) {
+		n = metered_read(probe->sock, preview->buffer + preview->length, PREVIEW_MAX_BYTES - preview->length);
+		if (n > 0) {
+			fetch_timing_mark(probe->timing, FETCH_FIRST_BYTE);
+			preview->length += n;
+			preview->status = NULL;
+		}
+		if (n == 0 || preview->length == PREVIEW_MAX_BYTES ||
+		        (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			done = TRUE;
+		}
+	}
+	if (!done && now - probe->started_ms >= CONNECT_TIMEOUT_MS) {
+		if (preview->length == 0) preview->status = "Preview timed out.";
+		result = FETCH_FAILED;
+		done = TRUE;
+	}
+	preview->buffer[preview->length] = '\0';
+
+	if (done) {
+		link_probe_close(probe, result, preview->length);
+		preview->pending = FALSE;
+		if (preview->length > 0) {
+			preview_cache_store(preview, item->link_hash, preview->buffer, preview->length);
+		} else if (!preview->status) {
+			preview->status = "Empty response.";
+		}
+	}
+	return done || preview->length > 0;
+}
+
+/* Looks up a preview kept in memory by link hash. */
+PreviewEntry *preview_cache_find(Preview *preview, unsigned long link_hash) {
+	PreviewEntry *entry = &preview->cache[link_hash & (PREVIEW_CACHE_SLOTS - 1)];
+	return (entry->data && entry->link_hash == link_hash) ? entry : NULL;
+}
+
+/* Keeps a copy of a preview, replacing whatever shared its slot. */
+void preview_cache_store(Preview *preview, unsigned long link_hash, char *data, size_t length) {
+	PreviewEntry *entry = &preview->cache[link_hash & (PREVIEW_CACHE_SLOTS - 1)];
+
+	free(entry->data);
+	entry->data = malloc(length + 1);
+	if (!entry->data) {
+		die("Error: Failed to allocate memory for the preview.");
+	}
+	memcpy(entry->data, data, length);
+	entry->data[length] = '\0';
+	entry->link_hash = link_hash;
+	entry->length = length;
+}
+
+/* Starts following the page in the text viewer, from its bottom. */
+void follow_start(AppState *state) {
+	Follow *follow = &state->follow;
+	int viewable_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 1;
+
+	follow_stop(follow);
+	follow->active = TRUE;
+	follow->nav = state->current_nav;
+	follow->body_length = strlen(state->current_nav->page_content);
+	follow->next_at_ms = get_elapsed_ms();
+	follow->status = NULL;
+	state->text_scroll_line = state->current_nav->lines.count - viewable_rows;
+	if (state->text_scroll_line < 0) state->text_scroll_line = 0;
+}
+
+/* Leaves follow mode, dropping any refetch in flight. */
+void follow_stop(Follow *follow) {
+	if (follow->probe.item != -1) {
+		link_probe_close(&follow->probe, FETCH_CANCELLED, follow->received);
+	}
+	free(follow->buffer);
+	follow->buffer = NULL;
+	follow->length = 0;
+	follow->capacity = 0;
+	follow->active = FALSE;
+	follow->nav = NULL;
+}
+
+/* Advances the refetch using the descriptors select() reported. Bytes that
+ * repeat the known body are only compared, never kept. Returns TRUE if the
+ * page grew or was replaced. */
+BOOL follow_poll(AppState *state, fd_set *read_fds, fd_set *write_fds) {
+	Follow *follow = &state->follow;
+	NavigationState *nav = follow->nav;
+	LinkProbe *probe = &follow->probe;
+	GopherItem target;
+	char chunk[16384];
+	unsigned long now = get_elapsed_ms();
+	const char *body;
+	socklen_t error_len;
+	ssize_t n;
+	size_t i;
+	size_t keep;
+	int error;
+
+	if (!follow->active) {
+		return FALSE;
+	}
+
+	if (probe->item == -1) {
+		if (now < follow->next_at_ms) {
+			return FALSE;
+		}
+		memset(&target, 0, sizeof(target));
+		strcpy(target.host, nav->host);
+		strcpy(target.selector, nav->selector);
+		target.port = nav->port;
+		target.host_hash = hash_host_key(nav->host, nav->port);
+		follow->next_at_ms = now + FOLLOW_INTERVAL_MS;
+		if (!budget_allows(FETCH_PRIORITY_FOLLOW)) {
+			follow->status = "Following paused; the data budget is low.";
+			return TRUE;
+		}
+		if (!link_probe_start(probe, &target, follow->hosts, FETCH_PRIORITY_FOLLOW)) {
+			follow->status = "Following; the host is unreachable.";
+			return TRUE;
+		}
+		probe->item = 0;
+
+		/* The new body must repeat the old one up to its terminator. */
+		body = nav->page_content;
+		keep = follow->body_length;
+		if (keep >= 3 && memcmp(body + keep - 3, ".\r\n", 3) == 0 && (keep == 3 || body[keep - 4] == '\n')) {
+			keep -= 3;
+		} else if (keep >= 2 && memcmp(body + keep - 2, ".\n", 2) == 0 && (keep == 2 || body[keep - 3] == '\n')) {
+			keep -= 2;
+		}
+		follow->keep = keep;
+		follow->received = 0;
+		follow->rewritten = FALSE;
+		follow->length = 0;
+		return FALSE;
+	}
+
+	if (probe->resolving && FD_ISSET(probe->sock, read_fds)) {
+		if (!link_probe_resolved(probe)) {
+			link_probe_close(probe, FETCH_FAILED, 0);
+			follow->status = "Following; the host is unreachable.";
+			return TRUE;
+		}
+		return FALSE;
+	}
+	if (!probe->connected && !probe->resolving && FD_ISSET(probe->sock, write_fds)) {
+		error = 0;
+		error_len = sizeof(error);
+		if (getsockopt(probe->sock, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1 || error != 0 ||
+		        write_all(probe->sock, nav->selector, strlen(nav->selector)) == -1 ||
+		        write_all(probe->sock, CRLF, strlen(CRLF)) == -1) {
+			link_probe_close(probe, FETCH_FAILED, 0);
+			follow->status = "Following; the host is unreachable.";
+			return TRUE;
+		}
+		probe->connected = TRUE;
+		fetch_timing_mark(probe->timing, FETCH_CONNECTED);
+		return FALSE;
+	}
+	if (!probe->connected || !FD_ISSET(probe->sock, read_fds)) {
+		if (now - probe->started_ms >= READ_TIMEOUT_MS) {
+			link_probe_close(probe, FETCH_FAILED, follow->received);
+			follow->status = "Following; the host stopped responding.";
+			return TRUE;
+		}
+		return FALSE;
+	}
+
+	n = metered_read(probe->sock, chunk, sizeof(chunk));
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return FALSE;
+		}
+		link_probe_close(probe, FETCH_FAILED, follow->received);
+		follow->status = "Following; the refetch failed.";
+		return TRUE;
+	}
+
+	if (n > 0) {
+		fetch_timing_mark(probe->timing, FETCH_FIRST_BYTE);
+		i = 0;
+		if (!follow->rewritten) {
+			/* Compare the part that overlaps the known body. */
+			while (i < (size_t)n && follow->received + i < follow->keep &&
+			        chunk[i] == nav->page_content[follow->received + i]) {
+				i++;
+			}
+			if (i < (size_t)n && follow->received + i < follow->keep) {
+				/* Not an extension after all: keep the whole new body. */
+				follow->rewritten = TRUE;
+				follow_append(follow, nav->page_content, follow->received + i);
+			}
+		}
+		follow_append(follow, chunk + i, n - i);
+		follow->received += n;
+		if (!budget_allows(FETCH_PRIORITY_FOLLOW)) {
+			link_probe_close(probe, FETCH_CANCELLED, follow->received);
+			follow->status = "Following paused; the data budget is low.";
+			return TRUE;
+		}
+		return FALSE;
+	}
+
+	/* End of the refetch. */
+	link_probe_close(probe, FETCH_DONE, follow->received);
+	follow->status = NULL;
+	if (!follow->rewritten && follow->received < follow->keep) {
+		follow->rewritten = TRUE; /* The page shrank. */
+		follow_append(follow, nav->page_content, follow->received);
+	}
+	/* An unchanged page only repeats what followed `keep`: its terminator. */
+	if (!follow->rewritten && follow->length == follow->body_length - follow->keep &&
+	        (follow->length == 0 || memcmp(follow->buffer, nav->page_content + follow->keep, follow->length) == 0)) {
+		return FALSE;
+	}
+	follow_apply(state);
+	return TRUE;
+}
+
+/* Appends received bytes to the follow buffer. */
+void follow_append(Follow *follow, const char *data, size_t length) {
+	if (follow->length + length + 1 > follow->capacity) {
+		follow->capacity = (follow->length + length + 1) * 2;
+		follow->buffer = realloc(follow->buffer, follow->capacity);
+		if (!follow->buffer) {
+			die("Error: Failed to allocate memory for the followed page.");
+		}
+	}
+	memcpy(follow->buffer + follow->length, data, length);
+	follow->length += length;
+	follow->buffer[follow->length] = '\0';
+}
+
+/* Puts a finished refetch into the page. A grown page only has its tail
+ * appended and indexed; a rewritten one is replaced. The view stays on the
+ * last page if it was there. */
+void follow_apply(AppState *state) {
+	Follow *follow = &state->follow;
+	NavigationState *nav = follow->nav;
+	LineIndex *lines = &nav->lines;
+	int viewable_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 1;
+	BOOL at_bottom = state->text_scroll_line >= lines->count - viewable_rows;
+	int old_count;
+	char *content;
+
+	if (follow->rewritten) {
+		free(nav->page_content);
+		nav->page_content = follow->buffer;
+		follow->body_length = follow->length;
+		follow->buffer = NULL;
+		follow->capacity = 0;
+		line_index_build(lines, nav->page_content, follow->body_length);
+	} else {
+		content = realloc(nav->page_content, follow->keep + follow->length + 1);
+		if (!content) {
+			die("Error: Failed to allocate memory for the followed page.");
+		}
+		memcpy(content + follow->keep, follow->buffer, follow->length + 1);
+		nav->page_content = content;
+		follow->body_length = follow->keep + follow->length;
+
+		/* Drop the old terminator line, then index the tail. */
+		while (lines->count > 0 && lines->offsets[lines->count - 1] >= follow->keep) {
+			lines->count--;
+		}
+		old_count = lines->count;
+		line_index_extend(lines, content, follow->keep, follow->body_length);
+		if (lines->marks && lines->count > old_count) {
+			lines->marks = realloc(lines->marks, lines->count);
+			if (!lines->marks) {
+				die("Error: Failed to allocate memory for the line index.");
+			}
+			memset(lines->marks + old_count, 0, lines->count - old_count);
+		}
+	}
+	follow->length = 0;
+
+	if (at_bottom) {
+		state->text_scroll_line = lines->count - viewable_rows;
+		if (state->text_scroll_line < 0) state->text_scroll_line = 0;
+	}
+}
+
+/* Drops the current page so the main loop fetches it again. */
+void reload_current_page(AppState *state) {
+	if (state->current_nav->is_local) {
+		return;
+	}
+	if (state->current_nav->page_content) {
+		free(state->current_nav->page_content);
+		state->current_nav->page_content = NULL;
+	}
+	line_index_free(&state->current_nav->lines);
+	follow_stop(&state->follow);
+	state->menu_stale = TRUE;
+	state->reload_requested = TRUE;
+}
+
+/* Formats the current Gopher URL into a string. */
+void get_current_url(const NavigationState* nav, char* buffer, size_t size) {
+	size_t required_size;
+
+	if (nav->is_local) {
+		required_size = strlen("tocaia:") + strlen(nav->selector) + 1;
+		if (required_size < size) {
+			sprintf(buffer, "tocaia:%s", nav->selector);
+		} else {
+			buffer[0] = '\0';
+		}
+	} else if (nav->selector[0] == '\0' || (nav->selector[0] == '1' && nav->selector[1] == '\0')) {
+		required_size = strlen("gopher://") + strlen(nav->host) + 1 + 5 + 1;
+		if (required_size < size) {
+			sprintf(buffer, "gopher://%s:%d/", nav->host, nav->port);
+		} else {
+			buffer[0] = '\0';
+		}
+	} else {
+		required_size = strlen("gopher://") + strlen(nav->host) + 1 + 5 + 1 + strlen(nav->selector) + 1;
+		if (required_size < size) {
+			sprintf(buffer, "gopher://%s:%d/%c%s", nav->host, nav->port, nav->type, nav->selector);
+		} else {
+			buffer[0] = '\0';
+		}
+	}
+}
+
+/* Draws the application header with the current URL. */
+void draw_header(const AppState* state) {
+	char url_buffer[MAX_URL_INPUT_LENGTH];
+	char header_background[MAX_CONTENT_DISPLAY_WIDTH + 1];
+
+	get_current_url(state->current_nav, url_buffer, sizeof(url_buffer));
+
+	/* Create a string of spaces for the background. */
+	memset(header_background, ' ', MAX_CONTENT_DISPLAY_WIDTH);
+	header_background[MAX_CONTENT_DISPLAY_WIDTH] = '\0';
+
+	/* Print the colored background bar, centered. */
+	printf("%s%s", HEADER_BG, HEADER_FG);
+	print_centered_string(header_background, 1, state->terminal_size.ws_col);
+
+	/* Print the URL text on top of the background. */
+	print_centered_string(url_buffer, 1, state->terminal_size.ws_col);
+	printf("%s", COLOR_RESET);
+
+	move_cursor(2, 1); /* Move cursor below header for content. */
+	fflush(stdout);
+}
+
+/* Draws the Gopher menu to the terminal screen. */
+void draw_gopher_menu(AppState* state) {
+	int available_rows;
+	int i;
+	int item_on_screen_count = 0;
+	int start_col;
+	char display_buf[MAX_DISPLAY_LENGTH + 20];
+	char annotation[32];
+	const char* annotation_color;
+	const char* color;
+	BOOL is_selected;
+	int selected_item = -1;
+
+	clear_terminal();
+	draw_header(state);
+	if (state->show_waterfall) {
+		draw_waterfall(state);
+		return;
+	}
+
+	available_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 0;
+	start_col = (state->terminal_size.ws_col - MAX_CONTENT_DISPLAY_WIDTH) / 2 + 1;
+	if (start_col < 1 || preview_enabled(state)) start_col = 1;
+
+	if (state->selected_index >= 1 && state->selected_index <= state->menu.selectable_count) {
+		selected_item = state->menu.selectable_map[state->selected_index - 1];
+	}
+
+	for (i = state->scroll_offset; i < state->menu.count && item_on_screen_count < available_rows; ++i) {
+		const GopherItem *item = get_menu_item(state, i);
+		is_selected = (i == selected_item);
+
+		if (state->menu.flags[i] & ITEM_SELECTABLE) {
+			if (strlen(item->display_string) + 3 < sizeof(display_buf)) {
+				sprintf(display_buf, "%s%s", is_selected ? "->" : "  ", item->display_string);
+			} else {
+				strncpy(display_buf, item->display_string, sizeof(display_buf) - 1);
+				display_buf[sizeof(display_buf) - 1] = '\0';
+			}
+		} else {
+			if (strlen(item->display_string) + 3 < sizeof(display_buf)) {
+				sprintf(display_buf, "  %s", item->display_string);
+			} else {
+				strncpy(display_buf, item->display_string, sizeof(display_buf) - 1);
+				display_buf[sizeof(display_buf) - 1] = '\0';
+			}
+		}
+
+		annotation_color = format_check_annotation(state->menu.flags[i], item, annotation);
+		if (!annotation_color && state->show_telemetry && (state->menu.flags[i] & ITEM_SELECTABLE)) {
+			annotation_color = format_telemetry_annotation(item, annotation);
+		}
+		if (annotation_color) {
+			/* Make room for the annotation inside the content column. */
+			int limit = MAX_CONTENT_DISPLAY_WIDTH - (int)strlen(annotation) - 1;
+			if ((int)strlen(display_buf) > limit) {
+				display_buf[limit] = '\0';
+			}
+		} else if (preview_enabled(state) && strlen(display_buf) > MAX_CONTENT_DISPLAY_WIDTH) {
+			display_buf[MAX_CONTENT_DISPLAY_WIDTH] = '\0'; /* Keep clear of the preview pane. */
+		}
+
+		color = get_gopher_item_color(state->menu.types[i], is_selected);
+		printf("%s", color);
+		print_string_at(display_buf, 4 + item_on_screen_count, start_col);
+		printf("%s", COLOR_RESET);
+		if (annotation_color) {
+			printf(" %s%s%s", annotation_color, annotation, COLOR_RESET);
+		}
+		item_on_screen_count++;
+	}
+	draw_preview_pane(state);
+	draw_budget(state, 0);
+	fflush(stdout);
+}
+
+/* Draws the preview pane to the right of the menu. Menus are shown by
+ * their display strings, text by its first lines. */
+void draw_preview_pane(AppState *state) {
+	Preview *preview = &state->preview;
+	const char *ptr = preview->buffer;
+	const char *end = preview->buffer + preview->length;
+	const char *line_end;
+	char line[PREVIEW_MAX_WIDTH + 1];
+	int pane_col = MAX_CONTENT_DISPLAY_WIDTH + 4;
+	int width = state->terminal_size.ws_col - pane_col;
+	int last_row = state->terminal_size.ws_row - 1;
+	int row = 4;
+	BOOL is_menu = FALSE;
+	size_t length;
+	size_t i;
+
+	if (!preview_enabled(state)) {
+		return;
+	}
+	if (width > PREVIEW_MAX_WIDTH) width = PREVIEW_MAX_WIDTH;
+
+	if (preview->item != -1) {
+		is_menu = (get_menu_item(state, preview->item)->type == '1');
+	}
+	if (preview->status) {
+		move_cursor(row, pane_col - 2);
+		printf("%s| %s%.*s%s\033[K", FOOTER_COLOR, COLOR_RESET, width, preview->status, COLOR_RESET);
+		row++;
+	}
+
+	for (; row <= last_row; row++) {
+		length = 0;
+		if (ptr && ptr < end) {
+			line_end = memchr(ptr, '\n', end - ptr);
+			if (!line_end) line_end = end;
+			if (is_menu) {
+				/* Type character, then the display string up to the first tab.
+				 * The terminator, "." with or without a CR, ends the menu and
+				 * leaves its row and those below blank. */
+				if (*ptr == '.' && (line_end - ptr == 1 || (line_end - ptr == 2 && ptr[1] == '\r'))) {
+					ptr = end;
+					line_end = end;
+				}
+				if (ptr < line_end) ptr++;
+			}
+			for (i = 0; ptr + i < line_end && length < (size_t)width; i++) {
+				unsigned char c = (unsigned char)ptr[i];
+				if (c == '\t') {
+					if (is_menu) break;
+					c = ' ';
+				}
+				if (c == '\r') continue;
+				line[length++] = (c < 0x20 || c == 0x7f) ? '.' : (char)c;
+			}
+			ptr = line_end < end ? line_end + 1 : end;
+		}
+		line[length] = '\0';
+		move_cursor(row, pane_col - 2);
+		printf("%s| %s%s%s\033[K", FOOTER_COLOR, TEXT_COLOR, line, COLOR_RESET);
+	}
+	fflush(stdout);
+}
+
+/* Draws recent fetches as a waterfall below the header, one row per fetch
+ * with the oldest first. Resolve, connect, first byte wait and transfer
+ * are drawn on a time axis shared by all rows, so fetches that overlapped
+ * line up; those still in flight grow to the right as it is redrawn. */
+void draw_waterfall(const AppState *state) {
+	const char *priority_names[] = { "page", "follow", "preview", "check", "mirror" };
+	const char *result_names[] = { "", "failed", "cancel", "cache" };
+	const char phase_marks[FETCH_PHASES] = { '-', '=', '.', '#' };
+	const char *phase_colors[FETCH_PHASES] = { INFO_COLOR, TELEMETRY_COLOR, SLOW_HOST_COLOR, ADDED_LINE_COLOR };
+	const char *color;
+	const FetchTiming *timing;
+	char bar[WATERFALL_MAX_WIDTH + 1];
+	char size[16];
+	char elapsed[16];
+	unsigned long now = get_elapsed_ms();
+	unsigned long first_id;
+	unsigned long id;
+	unsigned long axis_start;
+	unsigned long axis_span = 1;
+	unsigned long finished;
+	unsigned long from;
+	unsigned long to;
+	int last_row = state->terminal_size.ws_row - 1;
+	int shown = last_row - 3;
+	int label_width = state->terminal_size.ws_col - 56;
+	int width;
+	int in_flight = 0;
+	int row = 4;
+	int phase;
+	int last_phase;
+	int start;
+	int end;
+	int c;
+
+	if (label_width > 30) label_width = 30;
+	if (label_width < 8) label_width = 8;
+	width = state->terminal_size.ws_col - label_width - 32;
+	if (width > WATERFALL_MAX_WIDTH) width = WATERFALL_MAX_WIDTH;
+	if (width < 1) width = 1;
+
+	if (shown < 0) shown = 0;
+	if ((unsigned long)shown > g_fetch_timing_count) shown = (int)g_fetch_timing_count;
+	if (shown > FETCH_TIMING_SLOTS) shown = FETCH_TIMING_SLOTS;
+	first_id = g_fetch_timing_count - shown + 1;
+
+	/* The axis runs from the first shown start to the last end. */
+	axis_start = shown ? fetch_timing_find(first_id)->started_ms : now;
+	for (id = first_id; id <= g_fetch_timing_count; id++) {
+		timing = fetch_timing_find(id);
+		finished = timing->phase == FETCH_PHASES ? timing->phase_ms[FETCH_FINISHED] : now;
+		if (timing->phase < FETCH_PHASES) in_flight++;
+		if (finished - axis_start > axis_span) axis_span = finished - axis_start;
+	}
+
+	move_cursor(2, 1);
+	printf("%s%d recent fetch%s, %d in flight, %lums across.  w: Close%s\033[K", FOOTER_COLOR,
+	       shown, shown == 1 ? "" : "es", in_flight, axis_span, COLOR_RESET);
+	move_cursor(3, 1);
+	printf("%s%-7s %-6s %7s %6s %-*s %.*s%s\033[K", SEPARATOR_COLOR, "Kind", "Result", "Time", "Size",
+	       label_width, "Request", width, "- resolve  = connect  . first byte  # transfer  * cache", COLOR_RESET);
+
+	for (id = first_id; id <= g_fetch_timing_count && row <= last_row; id++, row++) {
+		timing = fetch_timing_find(id);
+		finished = timing->phase == FETCH_PHASES ? timing->phase_ms[FETCH_FINISHED] : now;
+		sprintf(elapsed, "%lums", finished - timing->started_ms);
+		size[0] = '\0';
+		if (timing->phase == FETCH_PHASES) format_size(timing->size, size);
+
+		memset(bar, ' ', width);
+		bar[width] = '\0';
+		from = timing->started_ms;
+		for (phase = 0; phase < FETCH_PHASES && phase <= timing->phase; phase++) {
+			to = phase < timing->phase ? timing->phase_ms[phase] : now;
+			if (to > from) {
+				start = (int)((double)(from - axis_start) * width / axis_span);
+				end = (int)((double)(to - axis_start) * width / axis_span);
+				if (end == start) end++;
+				for (c = start; c < end && c < width; c++) bar[c] = phase_marks[phase];
+			}
+			from = to;
+		}
+		start = (int)((double)(timing->started_ms - axis_start) * width / axis_span);
+		if (start >= width) start = width - 1;
+		if (bar[start] == ' ') bar[start] = timing->result == FETCH_CACHE_HIT ? '*' : '|';
+
+		color = timing->result == FETCH_FAILED ? DEAD_HOST_COLOR :
+		        timing->result == FETCH_CANCELLED ? INFO_COLOR :
+		        timing->result == FETCH_CACHE_HIT ? TELEMETRY_COLOR : COLOR_RESET;
+		move_cursor(row, 1);
+		printf("%s%-7s %-6s %7s %6s %-*.*s%s ", color, priority_names[timing->priority],
+		       result_names[timing->result], elapsed, size, label_width, label_width, timing->label, COLOR_RESET);
+		last_phase = -1;
+		for (c = 0; c < width; c++) {
+			for (phase = 0; phase < FETCH_PHASES && phase_marks[phase] != bar[c]; phase++);
+			if (phase != last_phase) {
+				printf("%s", phase < FETCH_PHASES ? phase_colors[phase] : COLOR_RESET);
+				last_phase = phase;
+			}
+			putchar(bar[c]);
+		}
+		printf("%s\033[K", COLOR_RESET);
+	}
+	for (; row <= last_row; row++) {
+		move_cursor(row, 1);
+		printf("\033[K");
+	}
+	fflush(stdout);
+}
+
+/* Draws the history finder: the query on top, then the best matches with
+ * the date of the visit, its title and its address. */
+void draw_history_finder(const AppState *state, const HistoryFinder *finder, const char *query, int selected, unsigned long elapsed_ms) {
+	GopherItem item;
+	char url[MAX_HOST_LENGTH + MAX_SELECTOR_LENGTH + 24];
+	char date[16];
+	time_t visited;
+	int last_row = state->terminal_size.ws_row - 1;
+	int title_width = state->terminal_size.ws_col / 2 - 12;
+	int url_width;
+	int row = 3;
+	int i;
+	char *p;
+
+	if (title_width > MAX_TITLE_LENGTH) title_width = MAX_TITLE_LENGTH;
+	if (title_width < 10) title_width = 10;
+	url_width = state->terminal_size.ws_col - title_width - 13;
+	if (url_width < 0) url_width = 0;
+
+	move_cursor(2, 1);
+	printf("%s%d match%s from %lu visits in %lums.  Arrows: Pick  Enter: Open  Esc: Cancel%s\033[K",
+	       SEPARATOR_COLOR, finder->match_count, finder->match_count == 1 ? "" : "es",
+	       finder->record_count, elapsed_ms, COLOR_RESET);
+
+	for (i = 0; i < finder->match_count && row <= last_row; i++, row++) {
+		visited = history_entry(finder, finder->matches[i], &item);
+		if (!visited || strftime(date, sizeof(date), "%Y-%m-%d", localtime(&visited)) == 0) {
+			strcpy(date, "----------");
+		}
+		sprintf(url, "gopher://%s:%d/%c%s", item.host, item.port, item.type, item.selector);
+		for (p = url; *p; p++) {
+			if (*p == '\t') *p = ' ';
+		}
+		move_cursor(row, 1);
+		printf("%s%s %-*.*s %s%.*s%s\033[K", i == selected ? SELECTED_ITEM_COLOR : TEXT_COLOR, date,
+		       title_width, title_width, item.display_string, i == selected ? "" : SEPARATOR_COLOR,
+		       url_width, url, COLOR_RESET);
+	}
+	for (; row <= last_row; row++) {
+		move_cursor(row, 1);
+		printf("\033[K");
+	}
+
+	move_cursor(1, 1);
+	printf("%sHistory: %s%s\033[K", FOOTER_COLOR, COLOR_RESET, query);
+	set_cursor_visibility(1);
+	fflush(stdout);
+}
+
+/* Draws the current text content to the terminal screen. */
+void draw_text_viewer(AppState* state, const char *content) {
+	int available_rows;
+	int start_col;
+	int line;
+	int drawn_lines = 0;
+	LineIndex *lines = &state->current_nav->lines;
+	char status[MAX_CONTENT_DISPLAY_WIDTH + 1];
+
+	clear_terminal();
+	draw_header(state);
+
+	available_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 0;
+	start_col = (state->terminal_size.ws_col - MAX_CONTENT_DISPLAY_WIDTH)/2 + 1;
+	if (start_col < 1) start_col = 1;
+
+	if (lines->offsets == NULL) {
+		line_index_build(lines, content, strlen(content));
+	}
+
+	/* Jump straight to the scroll offset through the line index. */
+	for (line = state->text_scroll_line; line < lines->count && drawn_lines < available_rows; line++) {
+		const char *ptr = content + lines->offsets[line];
+		char temp_line[MAX_CONTENT_DISPLAY_WIDTH + 1];
+		const char *color = TEXT_COLOR;
+		size_t copy_len;
+
+		/* Copy no more than the display width, so a long line costs no
+		 * more to draw than a short one. */
+		for (copy_len = 0; copy_len < MAX_CONTENT_DISPLAY_WIDTH && ptr[copy_len] != '\0' &&
+		        ptr[copy_len] != '\n'; copy_len++) {
+			temp_line[copy_len] = ptr[copy_len];
+		}
+		temp_line[copy_len] = '\0';
+
+		if (lines->marks && lines->marks[line] == LINE_ADDED) {
+			color = ADDED_LINE_COLOR;
+		} else if (lines->marks && lines->marks[line] == LINE_CHANGED) {
+			color = CHANGED_LINE_COLOR;
+		}
+		printf("%s", color);
+		print_string_at(temp_line, 4 + drawn_lines, start_col);
+		drawn_lines++;
+	}
+
+	status[0] = '\0';
+	if (state->follow.active) {
+		sprintf(status, "%s F: Stop following", state->follow.status ? state->follow.status : "Following.");
+		printf("%s", FOOTER_COLOR);
+		print_string_at(status, state->terminal_size.ws_row, start_col);
+	} else if (lines->changed_lines > 0) {
+		sprintf(status, "%d lines new or changed since the last visit. n/p: Next/previous change",
+		        lines->changed_lines);
+		printf("%s", FOOTER_COLOR);
+		print_string_at(status, state->terminal_size.ws_row, start_col);
+	}
+	draw_budget(state, status[0] ? start_col + (int)strlen(status) : 0);
+
+	printf("%s", COLOR_RESET);
+	fflush(stdout);
+}
+
+/* Binary item types, which are shown in the hex viewer. */
+BOOL is_binary_type(char type) {
+	return type != '\0' && strchr("459gI", type) != NULL;
+}
+
+/* Fetches a binary item into a temporary file and browses it as hex. */
+void view_binary_item(AppState *state, const GopherItem *item) {
+	char title[MAX_URL_INPUT_LENGTH + 32];
+	char size_text[16];
+	char status[MAX_CONTENT_DISPLAY_WIDTH + 1];
+	char input[MAX_BYTE_PATTERN * 3 + 1];
+	char input_buf[3];
+	char c;
+	HexView view;
+	size_t length = 0;
+	size_t total_rows;
+	size_t offset;
+	int viewable_rows;
+	int fd;
+	char *end;
+	void *map;
+	ssize_t bytes_read;
+	fd_set read_fds;
+	struct timeval tv;
+	BOOL in_view = TRUE;
+
+	clear_line(state->terminal_size.ws_row, state->terminal_size.ws_col);
+	move_cursor(state->terminal_size.ws_row, 1);
+	printf("%sFetching... (any key cancels)%s", FOOTER_COLOR, COLOR_RESET);
+	fflush(stdout);
+
+	fd = fetch_to_temp_file(item->host, item->port, item->selector, &length, state);
+	if (fd == -1) {
+		clear_line(state->terminal_size.ws_row, state->terminal_size.ws_col);
+		move_cursor(state->terminal_size.ws_row, 1);
+		printf("%s%s Press any key.%s", ERROR_COLOR, g_fetch_error, COLOR_RESET);
+		fflush(stdout);
+		read(STDIN_FILENO, &c, 1);
+		return;
+	}
+
+	memset(&view, 0, sizeof(view));
+	view.length = length;
+	if (length > 0) {
+		map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			close(fd);
+			clear_line(state->terminal_size.ws_row, state->terminal_size.ws_col);
+			move_cursor(state->terminal_size.ws_row, 1);
+			printf("%sThe item is too large to map. Press any key.%s", ERROR_COLOR, COLOR_RESET);
+			fflush(stdout);
+			read(STDIN_FILENO, &c, 1);
+			return;
+		}
+		view.data = (const unsigned char *)map;
+	}
+	close(fd); /* The mapping keeps the unlinked file alive. */
+
+	format_size(length, size_text);
+	if (strlen(item->host) + strlen(item->selector) + 32 < sizeof(title)) {
+		sprintf(title, "gopher://%s:%d/%c%s (%s)", item->host, item->port, item->type, item->selector, size_text);
+	} else {
+		sprintf(title, "%s", size_text);
+	}
+	total_rows = (length + HEX_BYTES_PER_ROW - 1) / HEX_BYTES_PER_ROW;
+	status[0] = '\0';
+
+	draw_hex_view(state, &view, title, status);
+
+	while (in_view && state->is_running) {
+		viewable_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 1;
+
+		if (g_resize_pending) {
+			ioctl(STDOUT_FILENO, TIOCGWINSZ, &state->terminal_size);
+			g_resize_pending = 0;
+			draw_hex_view(state, &view, title, status);
+			continue;
+		}
+
+		FD_ZERO(&read_fds);
+		FD_SET(STDIN_FILENO, &read_fds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000;
+
+		if (select(STDIN_FILENO + 1, &read_fds, NULL, NULL, &tv) <= 0) {
+			continue;
+		}
+		bytes_read = read(STDIN_FILENO, input_buf, sizeof(input_buf));
+		if (bytes_read <= 0) continue;
+		status[0] = '\0';
+
+		if (bytes_read == 3 && input_buf[0] == KEY_ESC && input_buf[1] == '[') {
+			char key = input_buf[2];
+			if (key == KEY_UP && view.top_row > 0) {
+				view.top_row--;
+			} else if (key == KEY_DOWN) {
+				view.top_row++;
+			} else if (key == KEY_PGUP) {
+				view.top_row = view.top_row > (size_t)viewable_rows ? view.top_row - viewable_rows : 0;
+			} else if (key == KEY_PGDN) {
+				view.top_row += viewable_rows;
+			}
+		} else if (bytes_read == 1) {
+			c = input_buf[0];
+			if (c == 'b' || c == KEY_BACKSPACE) {
+				in_view = FALSE;
+			} else if (c == 'q') {
+				state->is_running = FALSE;
+			} else if (c == 'g') {
+				if (read_prompt(state, "Go to offset: ", input, sizeof(input))) {
+					offset = strtoul(input, &end, 0);
+					if (*end != '\0' || offset >= length) {
+						strcpy(status, "No such offset.");
+					} else {
+						view.top_row = offset / HEX_BYTES_PER_ROW;
+						view.match = offset;
+						view.match_length = 1;
+					}
+				}
+			} else if (c == '/') {
+				if (read_prompt(state, "Find hex bytes or \"text: ", input, sizeof(input))) {
+					if (!parse_byte_pattern(input, view.pattern, &view.pattern_length)) {
+						strcpy(status, "Invalid pattern.");
+					} else if (!hex_view_find(&view, view.top_row * HEX_BYTES_PER_ROW)) {
+						strcpy(status, "Pattern not found.");
+					}
+				}
+			} else if (c == 'n') {
+				if (view.pattern_length == 0) {
+					strcpy(status, "No pattern to repeat.");
+				} else if (!hex_view_find(&view, view.match_length ? view.match + 1 : 0)) {
+					strcpy(status, "Pattern not found.");
+				}
+			}
+		}
+
+		/* Clamp scroll position to prevent overscrolling. */
+		if (view.top_row + viewable_rows > total_rows) {
+			view.top_row = total_rows > (size_t)viewable_rows ? total_rows - viewable_rows : 0;
+		}
+		if (in_view && state->is_running) {
+			draw_hex_view(state, &view, title, status);
+		}
+	}
+
+	if (view.data) {
+		munmap((void *)view.data, length);
+	}
+}
+
+/* Draws the visible rows of a hex view as offset, hex bytes and ASCII. */
+void draw_hex_view(const AppState *state, const HexView *view, const char *title, const char *status) {
+	char header_background[MAX_CONTENT_DISPLAY_WIDTH + 1];
+	int available_rows;
+	int start_col;
+	int row;
+	int i;
+	size_t offset;
+	BOOL highlight;
+
+	clear_terminal();
+	memset(header_background, ' ', MAX_CONTENT_DISPLAY_WIDTH);
+	header_background[MAX_CONTENT_DISPLAY_WIDTH] = '\0';
+	printf("%s%s", HEADER_BG, HEADER_FG);
+	print_centered_string(header_background, 1, state->terminal_size.ws_col);
+	print_centered_string(title, 1, state->terminal_size.ws_col);
+	printf("%s", COLOR_RESET);
+
+	available_rows = state->terminal_size.ws_row > 4 ? state->terminal_size.ws_row - 4 : 0;
+	start_col = (state->terminal_size.ws_col - MAX_CONTENT_DISPLAY_WIDTH)/2 + 1;
+	if (start_col < 1) start_col = 1;
+
+	for (row = 0; row < available_rows; row++) {
+		offset = (view->top_row + row) * HEX_BYTES_PER_ROW;
+		if (offset >= view->length) {
+			break;
+		}
+		move_cursor(3 + row, start_col);
+		printf("%s%08lx%s ", INFO_COLOR, (unsigned long)offset, COLOR_RESET);
+
+		for (i = 0; i < HEX_BYTES_PER_ROW; i++) {
+			if (i == HEX_BYTES_PER_ROW / 2) {
+				printf(" ");
+			}
+			if (offset + i >= view->length) {
+				printf("   ");
+				continue;
+			}
+			highlight = view->match_length > 0 && offset + i >= view->match &&
+			            offset + i < view->match + view->match_length;
+			printf(" %s%02x%s", highlight ? SELECTED_ITEM_COLOR : BINARY_COLOR,
+			       view->data[offset + i], COLOR_RESET);
+		}
+
+		printf("  %s", TEXT_COLOR);
+		for (i = 0; i < HEX_BYTES_PER_ROW && offset + i < view->length; i++) {
+			unsigned char byte = view->data[offset + i];
+			printf("%c", (byte >= 0x20 && byte < 0x7f) ? byte : '.');
+		}
+		printf("%s", COLOR_RESET);
+	}
+
+	move_cursor(state->terminal_size.ws_row, start_col);
+	if (status[0] != '\0') {
+		printf("%s%s%s", ERROR_COLOR, status, COLOR_RESET);
+	} else {
+		printf("%sg: Offset  /: Find  n: Next  b: Back%s", FOOTER_COLOR, COLOR_RESET);
+	}
+	fflush(stdout);
+}
+
+/* Parses a search pattern: hex byte pairs, optionally separated by spaces,
+ * or text introduced by a double quote. */
+BOOL parse_byte_pattern(const char *input, unsigned char *out, size_t *length_out) {
+	size_t length = 0;
+	char digits[3];
+
+	if (input[0] == '"') {
+		length = strlen(input + 1);
+		if (length > 0 && input[length] == '"') {
+			length--; /* Closing quote is optional. */
+		}
+		if (length == 0 || length > MAX_BYTE_PATTERN) {
+			return FALSE;
+		}
+		memcpy(out, input + 1, length);
+		*length_out = length;
+		return TRUE;
+	}
+
+	digits[2] = '\0';
+	while (*input != '\0') {
+		if (*input == ' ') {
+			input++;
+			continue;
+		}
+		if (!isxdigit((unsigned char)input[0]) || !isxdigit((unsigned char)input[1]) ||
+		        length >= MAX_BYTE_PATTERN) {
+			return FALSE;
+		}
+		digits[0] = input[0];
+		digits[1] = input[1];
+		out[length++] = (unsigned char)strtoul(digits, NULL, 16);
+		input += 2;
+	}
+	if (length == 0) {
+		return FALSE;
+	}
+	*length_out = length;
+	return TRUE;
+}
+
+/* Finds the view's pattern at or after `from`, wrapping around once, and
+ * scrolls to it. Scans the mapping directly so large files are never copied. */
+BOOL hex_view_find(HexView *view, size_t from) {
+	const unsigned char *hit;
+	size_t start;
+	size_t end;
+	size_t limit;
+	int pass;
+
+	if (view->pattern_length == 0 || view->pattern_length > view->length) {
+		return FALSE;
+	}
+	limit = view->length - view->pattern_length + 1; /* Last possible start + 1. */
+	if (from >= limit) {
+		from = 0;
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		start = pass == 0 ? from : 0;
+		end = pass == 0 ? limit : from;
+		while (start < end) {
+			hit = memchr(view->data + start, view->pattern[0], end - start);
+			if (hit == NULL) {
+				break;
+			}
+			start = hit - view->data;
+			if (memcmp(hit, view->pattern, view->pattern_length) == 0) {
+				view->match = start;
+				view->match_length = view->pattern_length;
+				view->top_row = start / HEX_BYTES_PER_ROW;
+				return TRUE;
+			}
+			start++;
+		}
+	}
+	return FALSE;
+}
+
+void show_about_screen(const AppState* state) {
+	char c;
+	char header_background[MAX_CONTENT_DISPLAY_WIDTH + 1];
+
+	const char *about_body[] = {
+		"    Welcome to Tocaia %s!",
+		"        \\`~'/",
+		"        (o o)",
+		"       / \\ / \\",
+		"          \"",
+		"",
+		"Shortcuts:",
+		"    Arrows: Navigate",
+		"      Enter: Select",
+		"        b: Back",
+		"        f: Forward",
+		"        o: Open URL",
+		"        r: Reload",
+		"        s: Search fetched pages",
+		"        h: History",
+		"        t: Link stats",
+		"        c: Check links",
+		"        w: Fetch waterfall",
+		"        F: Follow text page",
+		"        a: About",
+		"        q: Quit",
+		NULL
+	};
+
+	int body_lines = 0;
+	int max_width = 0;
+	int start_row;
+	int start_col;
+	char version_info[50];
+	int i;
+
+	while (about_body[body_lines] != NULL) {
+		int len = strlen(about_body[body_lines]);
+		if (len > max_width) {
+			max_width = len;
+		}
+		body_lines++;
+	}
+
+	clear_terminal();
+	memset(header_background, ' ', MAX_CONTENT_DISPLAY_WIDTH);
+	header_background[MAX_CONTENT_DISPLAY_WIDTH] = '\0';
+
+	printf("%s%s", HEADER_BG, HEADER_FG);
+	print_centered_string(header_background, 1, state->terminal_size.ws_col);
+	print_centered_string("About Tocaia", 1, state->terminal_size.ws_col);
+	printf(COLOR_RESET);
+
+	move_cursor(2, 1);
+
+	start_row = (state->terminal_size.ws_row - body_lines) / 2;
+	if (start_row < 3) start_row = 3;
+
+	start_col = (state->terminal_size.ws_col - max_width) / 2;
+	if (start_col < 1) start_col = 1;
+
+	sprintf(version_info, "Welcome to Tocaia %s!", PROGRAM_VERSION);
+
+	for (i = 0; i < body_lines; ++i) {
 		if (i == 0) {
 			printf("%s", DIRECTORY_COLOR);
 			print_string_at(version_info, start_row + i, start_col);
@@ -992,298 +4172,4010 @@ void show_about_screen(const AppState* state) {
 			printf("%s", DIRECTORY_COLOR);
 			print_string_at(about_body[i], start_row + i, start_col);
 		} else {
-			printf("%s", TEXT_COLOR);
-			print_string_at(about_body[i], start_row + i, start_col);
+			printf("%s", TEXT_COLOR);
+			print_string_at(about_body[i], start_row + i, start_col);
+		}
+	}
+	printf("%s", COLOR_RESET);
+
+	fflush(stdout);
+
+	/* Wait for a key */
+	while (read(STDIN_FILENO, &c, 1) != 1);
+}
+
+/* Creates and initializes a new NavigationState node. */
+NavigationState* create_nav_state(const char *host, int port, const char *selector, char type) {
+	NavigationState *new_state = malloc(sizeof(NavigationState));
+	if (!new_state) {
+		die("Error: Failed to allocate memory for navigation state.");
+	}
+
+	strncpy(new_state->host, host, sizeof(new_state->host) - 1);
+	new_state->host[sizeof(new_state->host)-1] = '\0';
+	strncpy(new_state->selector, selector, sizeof(new_state->selector) - 1);
+	new_state->selector[sizeof(new_state->selector)-1] = '\0';
+	new_state->port = port;
+	new_state->page_content = NULL;
+	new_state->prev = NULL;
+	new_state->next = NULL;
+	new_state->type = type;
+	new_state->is_error_page = FALSE;
+	new_state->is_local = FALSE;
+	new_state->title[0] = '\0';
+	memset(&new_state->lines, 0, sizeof(LineIndex));
+	return new_state;
+}
+
+/* Frees all `NavigationState` nodes in the forward history. */
+void free_forward_history(NavigationState *current_state) {
+	NavigationState *temp;
+	NavigationState *forward_node = current_state ? current_state->next : NULL;
+
+	while (forward_node) {
+		temp = forward_node;
+		forward_node = temp->next;
+		if (temp->page_content) {
+			free(temp->page_content);
+		}
+		line_index_free(&temp->lines);
+		free(temp);
+	}
+	if (current_state) {
+		current_state->next = NULL;
+	}
+}
+
+/* Frees the entire navigation history linked list. */
+void free_navigation_history(NavigationState *current_state) {
+	NavigationState *head = current_state;
+	NavigationState *temp;
+	if (!head) {
+		return;
+	}
+
+	/* Find the head of the list. */
+	while (head->prev) {
+		head = head->prev;
+	}
+
+	/* Traverse from the head and free each node. */
+	while (head) {
+		temp = head;
+		head = temp->next;
+		if (temp->page_content) {
+			free(temp->page_content);
+		}
+		line_index_free(&temp->lines);
+		free(temp);
+	}
+}
+
+/* Navigates to a new Gopher address and adds it to the history. */
+void navigate_to(AppState *state, const char *host, int port, const char *selector, char type) {
+	NavigationState *new_state = create_nav_state(host, port, selector, type);
+
+	follow_stop(&state->follow);
+	if (state->current_nav) {
+		free_forward_history(state->current_nav);
+		state->current_nav->next = new_state;
+		new_state->prev = state->current_nav;
+	}
+	state->current_nav = new_state;
+
+	/* Reset view state for the new page. */
+	state->menu_stale = TRUE;
+	state->selected_index = 1;
+	state->scroll_offset = 0;
+	state->text_scroll_line = 0;
+}
+
+/* Moves the navigation back one step in the history. */
+void navigate_back(AppState *state) {
+	if (state->current_nav && state->current_nav->prev) {
+		follow_stop(&state->follow);
+		state->current_nav = state->current_nav->prev;
+		state->menu_stale = TRUE;
+		state->selected_index = 1;
+		state->scroll_offset = 0;
+		state->text_scroll_line = 0;
+	}
+}
+
+/* Moves the navigation forward one step in the history. */
+void navigate_forward(AppState *state) {
+	if (state->current_nav && state->current_nav->next) {
+		follow_stop(&state->follow);
+		state->current_nav = state->current_nav->next;
+		state->menu_stale = TRUE;
+		state->selected_index = 1;
+		state->scroll_offset = 0;
+		state->text_scroll_line = 0;
+	}
+}
+
+/* Sets the terminal to "raw" mode for direct key input handling. */
+void setup_terminal_for_app(void) {
+	struct termios raw;
+
+	tcgetattr(STDIN_FILENO, &g_original_termios);
+	raw = g_original_termios;
+	/* ICANON: disable canonical mode.
+	 * ECHO: disable echoing input characters.
+	 * ISIG: disable signal-generating characters (e.g., Ctrl-C). */
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+	signal(SIGWINCH, handle_resize_signal);
+	signal(SIGINT, handle_sigint_signal);
+	set_cursor_visibility(0); /* Hide cursor */
+}
+
+/* Restores the terminal to its original state.*/
+void restore_terminal(void) {
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &g_original_termios);
+	clear_terminal();
+	move_cursor(1,1);
+	set_cursor_visibility(1); /* Show cursor */
+	printf("%s", COLOR_RESET); /* Reset any lingering colors. */
+}
+
+/* Signal handler for terminal window resizing (SIGWINCH). */
+void handle_resize_signal(int sig) {
+	(void)sig; /* Unused parameter */
+	g_resize_pending = 1;
+}
+
+/* Signal handler for interrupt signals (SIGINT / Ctrl+C). */
+void handle_sigint_signal(int sig) {
+	(void)sig; /* Unused parameter */
+	restore_terminal();
+	exit(EXIT_SUCCESS);
+}
+
+/* Controls the visibility of the terminal cursor using ANSI escape codes. */
+void set_cursor_visibility(int visible) {
+	printf("\033[?25%c", visible ? 'h' : 'l');
+	fflush(stdout);
+}
+
+/* Clears the entire terminal screen. */
+void clear_terminal(void) {
+	printf("\033[H\033[J");
+	fflush(stdout);
+}
+
+/* Clears a single line in the terminal by overwriting with spaces.*/
+void clear_line(int row, int term_width) {
+	char *clear_str = malloc(term_width + 1);
+	if (clear_str) {
+		memset(clear_str, ' ', term_width);
+		clear_str[term_width] = '\0';
+		move_cursor(row, 1);
+		printf("%s", clear_str);
+		free(clear_str);
+	}
+}
+
+void move_cursor(int row, int col) {
+	printf("\033[%d;%dH", row, col);
+}
+
+void print_string_at(const char *str, int row, int col) {
+	move_cursor(row, col);
+	printf("%s", str);
+}
+
+void print_centered_string(const char *str, int row, int term_width) {
+	int len = strlen(str);
+	int start_col = (term_width - len) / 2;
+	if (start_col < 1) start_col = 1;
+	print_string_at(str, row, start_col);
+}
+
+/* Helper function that ensures all bytes from a buffer are written. */
+int write_all(int fd, const char* buffer, size_t len) {
+	size_t bytes_sent = 0;
+	ssize_t n_sent;
+
+	while (bytes_sent < len) {
+		n_sent = write(fd, buffer + bytes_sent, len - bytes_sent);
+		if (n_sent == -1) {
+			if (errno == EINTR) {
+				continue; /* Interrupted by a signal, try again */
+			}
+			return -1; /* A real error occurred */
+		}
+		bytes_sent += n_sent;
+	}
+	return bytes_sent;
+}
+
+/* Connects to a Gopher server and sends a selector request */
+int connect_and_send_request(const char *host, int port, const char *selector) {
+	int sock = -1;
+	struct hostent *he;
+	struct sockaddr_in server_addr;
+	char request[MAX_SELECTOR_LENGTH + 3]; /* selector + CRLF + null */
+	char **p;
+	size_t request_len;
+
+	request_len = strlen(selector) + strlen(CRLF);
+	if (request_len >= sizeof(request)) {
+		die("Error: The request is too long.");
+	}
+	sprintf(request, "%s%s", selector, CRLF);
+
+	he = gethostbyname(host);
+	if (he == NULL) {
+		strcpy(g_fetch_error, "Could not resolve the host name.");
+		return -1;
+	}
+	fetch_timing_mark(g_fetch_timing_current, FETCH_RESOLVED);
+
+	/* Iterates through the list of addresses returned by gethostbyname */
+	for (p = he->h_addr_list; *p != 0; p++) {
+		/* Creates a socket for each address */
+		if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+			perror("socket");
+			continue;
+		}
+
+		memset(&server_addr, 0, sizeof(server_addr));
+		server_addr.sin_family = AF_INET;
+		server_addr.sin_port = htons(port);
+		memcpy(&server_addr.sin_addr, *p, sizeof(struct in_addr));
+
+		/* Tries to connect to the server */
+		if (connect_with_timeout(sock, &server_addr, CONNECT_TIMEOUT_MS) != -1) {
+			/* Connection successful! Exits the loop. */
+			break;
+		}
+
+		/* If the connection failed, closes the current socket and tries the next address. */
+		close(sock);
+		sock = -1;
+	}
+
+	if (sock == -1) {
+		strcpy(g_fetch_error, "Could not connect to the host.");
+		return -1;
+	}
+	meter_socket(sock, hash_host_key(host, port));
+	fetch_timing_mark(g_fetch_timing_current, FETCH_CONNECTED);
+
+	if (write_all(sock, request, request_len) != request_len) {
+		strcpy(g_fetch_error, "Failed to send the request.");
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/* Connects a socket, giving up after `timeout_ms` instead of the system's
+ * much longer default. Reads on the socket time out as well. */
+int connect_with_timeout(int sock, const struct sockaddr_in *addr, int timeout_ms) {
+	int flags = fcntl(sock, F_GETFL, 0);
+	int error = 0;
+	socklen_t error_len = sizeof(error);
+	unsigned long deadline = get_elapsed_ms() + timeout_ms;
+	unsigned long now;
+	fd_set write_fds;
+	struct timeval tv;
+	int ready;
+
+	fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+	if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) == -1) {
+		if (errno != EINPROGRESS) {
+			return -1;
+		}
+		/* A signal, such as a terminal resize, only interrupts the wait. */
+		do {
+			now = get_elapsed_ms();
+			if (now >= deadline) {
+				return -1;
+			}
+			FD_ZERO(&write_fds);
+			FD_SET(sock, &write_fds);
+			tv.tv_sec = (deadline - now) / 1000;
+			tv.tv_usec = ((deadline - now) % 1000) * 1000L;
+			ready = select(sock + 1, NULL, &write_fds, NULL, &tv);
+		} while (ready == -1 && errno == EINTR);
+		if (ready <= 0) {
+			return -1;
+		}
+		if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1 || error != 0) {
+			return -1;
+		}
+	}
+	fcntl(sock, F_SETFL, flags);
+
+	tv.tv_sec = READ_TIMEOUT_MS / 1000;
+	tv.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return 0;
+}
+
+/* Receives all data from a socket until the connection is closed. Gives up
+ * with the reason in g_fetch_error if the data budget runs out first. */
+char *receive_gopher_data(int sock, size_t *length_out) {
+	size_t buffer_size = INITIAL_BUFFER_SIZE;
+	char *buffer = (char*)malloc(buffer_size);
+	size_t total_bytes = 0;
+	ssize_t bytes_received;
+	char *new_buffer;
+
+	if (!buffer) {
+		die("Error: Failed to allocate memory for receive buffer.");
+	}
+
+	while ((bytes_received = metered_read(sock, buffer + total_bytes, buffer_size - total_bytes - 1)) > 0) {
+		if (total_bytes == 0) {
+			fetch_timing_mark(g_fetch_timing_current, FETCH_FIRST_BYTE);
+		}
+		total_bytes += bytes_received;
+		if (total_bytes >= buffer_size - 1) {
+			buffer_size *= 2;
+			new_buffer = (char*)realloc(buffer, buffer_size);
+			if (!new_buffer) {
+				die("Error: Failed to reallocate memory for receive buffer.");
+			}
+			buffer = new_buffer;
+		}
+		if (!budget_allows(FETCH_PRIORITY_PAGE)) {
+			drain_socket(sock);
+			free(buffer);
+			return NULL;
+		}
+	}
+
+	if (bytes_received < 0) {
+		strcpy(g_fetch_error, (errno == EAGAIN || errno == EWOULDBLOCK) ?
+		       "The host stopped responding." : "Failed to read from the host.");
+		free(buffer);
+		return NULL;
+	}
+
+	/* Give back the slack left by doubling, up to half the buffer. */
+	new_buffer = realloc(buffer, total_bytes + 1);
+	if (new_buffer) {
+		buffer = new_buffer;
+	}
+	buffer[total_bytes] = '\0';
+	if (length_out) {
+		*length_out = total_bytes;
+	}
+	return buffer;
+}
+
+/* Streams a response into `fd` through a fixed buffer, so memory use does not
+ * grow with the size of the item. When `progress` is given, the byte count is
+ * shown on the bottom row and any key cancels the transfer.
+ * Returns 1 when complete, 0 if cancelled or the data budget ran out, and -1
+ * on a read error. */
+int receive_to_file(int sock, int fd, size_t *length_out, const AppState *progress) {
+	char buffer[SPILL_CHUNK_SIZE];
+	size_t total_bytes = 0;
+	size_t next_report = 0;
+	ssize_t bytes_received;
+	fd_set read_fds;
+	struct timeval tv;
+	char size_text[16];
+	char c;
+
+	while ((bytes_received = metered_read(sock, buffer, sizeof(buffer))) > 0) {
+		if (total_bytes == 0) {
+			fetch_timing_mark(g_fetch_timing_current, FETCH_FIRST_BYTE);
+		}
+		if (write_all(fd, buffer, bytes_received) != bytes_received) {
+			strcpy(g_fetch_error, "Failed to write the temporary file.");
+			return -1;
+		}
+		total_bytes += bytes_received;
+		if (!budget_allows(FETCH_PRIORITY_PAGE)) {
+			drain_socket(sock);
+			return 0;
+		}
+
+		if (progress && total_bytes >= next_report) {
+			next_report = total_bytes + SPILL_PROGRESS_BYTES;
+			format_size(total_bytes, size_text);
+			clear_line(progress->terminal_size.ws_row, progress->terminal_size.ws_col);
+			move_cursor(progress->terminal_size.ws_row, 1);
+			printf("%sFetching... %s (any key cancels)%s", FOOTER_COLOR, size_text, COLOR_RESET);
+			fflush(stdout);
+
+			FD_ZERO(&read_fds);
+			FD_SET(STDIN_FILENO, &read_fds);
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+			if (select(STDIN_FILENO + 1, &read_fds, NULL, NULL, &tv) > 0) {
+				read(STDIN_FILENO, &c, 1);
+				strcpy(g_fetch_error, "Fetch cancelled.");
+				return 0;
+			}
+		}
+	}
+
+	if (bytes_received < 0) {
+		strcpy(g_fetch_error, (errno == EAGAIN || errno == EWOULDBLOCK) ?
+		       "The host stopped responding." : "Failed to read from the host.");
+		return -1;
+	}
+
+	*length_out = total_bytes;
+	return 1;
+}
+
+/* Fetches a resource, answering from the shared cache when allowed.
+ * Returns NULL with the reason in g_fetch_error when the host is down. */
+char *fetch_resource(const char *host, int port, const char *selector, int flags, size_t *length_out) {
+	char key[MAX_CACHE_KEY_LENGTH];
+	char *response;
+	size_t length;
+	int sock;
+	int mirror;
+	unsigned long started;
+	unsigned long key_hash;
+	unsigned long timing;
+	const FetchTelemetry *seen;
+	BOOL unshared;
+	BOOL claimed;
+
+	make_cache_key(host, port, selector, key);
+	key_hash = hash_bytes(key, strlen(key));
+	mirror = (flags & FETCH_ANY_MIRROR) ? mirror_find(host, port) : -1;
+	if (flags & FETCH_USE_CACHE) {
+		response = shared_cache_lookup(key, &length);
+		if (!response && mirror != -1) {
+			response = mirror_cache_lookup(mirror, selector, &length);
+		}
+		/* A data saver would rather see the copy kept from the last visit. */
+		if (!response && g_budget_bytes) {
+			response = page_store_read(key, PAGE_STORE_MAX_SIZE, &length);
+		}
+		if (response) {
+			fetch_timing_end(fetch_timing_begin(host, port, selector, FETCH_PRIORITY_PAGE), FETCH_CACHE_HIT, length);
+			if (length_out) *length_out = length;
+			return response;
+		}
+	}
+
+	/* Another process is already fetching this resource: attach to its
+	 * transfer by waiting for the body to land in the shared cache, unless
+	 * either side saw the body outgrow a cache slot last time. */
+	timing = fetch_timing_begin(host, port, selector, FETCH_PRIORITY_PAGE);
+	seen = telemetry_slot(g_link_telemetry, TELEMETRY_LINK_SLOTS, key_hash, FALSE);
+	unshared = seen && seen->size >= SHARED_CACHE_DATA_SIZE;
+	claimed = shared_cache_claim_fetch(key_hash, unshared);
+	if (!claimed && !unshared && shared_cache_wait_for_fetch(key_hash)) {
+		response = shared_cache_lookup(key, &length);
+		if (response) {
+			fetch_timing_end(timing, FETCH_CACHE_HIT, length);
+			if (length_out) *length_out = length;
+			return response;
+		}
+	}
+	/* Nothing was shared: fetch it here, coordinating the next waiters if
+	 * the claimant has gone. */
+	if (!claimed) {
+		claimed = shared_cache_claim_fetch(key_hash, unshared);
+	}
+
+	if (!budget_allows(FETCH_PRIORITY_PAGE)) {
+		fetch_timing_end(timing, FETCH_FAILED, 0);
+		if (claimed) shared_cache_release_fetch(key_hash);
+		return NULL;
+	}
+
+	/* Each replica of a mirror group keeps its own telemetry and breaker. */
+	if (mirror != -1) {
+		response = mirror_fetch(mirror, selector, (flags & FETCH_RETRY) != 0, timing, &length);
+		fetch_timing_end(timing, response ? FETCH_DONE : FETCH_FAILED, response ? length : 0);
+		if (response) {
+			shared_cache_store(key, response, length);
+			if (length_out) *length_out = length;
+		}
+		if (claimed) shared_cache_release_fetch(key_hash);
+		return response;
+	}
+
+	if (!breaker_allows_fetch(host, port, (flags & FETCH_RETRY) != 0)) {
+		fetch_timing_end(timing, FETCH_FAILED, 0);
+		if (claimed) shared_cache_release_fetch(key_hash);
+		return NULL;
+	}
+
+	started = get_elapsed_ms();
+	g_fetch_timing_current = timing;
+	sock = connect_and_send_request(host, port, selector);
+	response = NULL;
+	if (sock != -1) {
+		response = receive_gopher_data(sock, &length);
+		close(sock);
+	}
+	g_fetch_timing_current = 0;
+
+	if (response == NULL) {
+		/* Running out of budget mid-transfer says nothing about the host. */
+		if (budget_allows(FETCH_PRIORITY_PAGE)) {
+			fetch_timing_end(timing, FETCH_FAILED, 0);
+			telemetry_record(host, port, selector, TRUE, get_elapsed_ms() - started, 0);
+		} else {
+			fetch_timing_end(timing, FETCH_CANCELLED, 0);
+		}
+		if (claimed) shared_cache_release_fetch(key_hash);
+		return NULL;
+	}
+
+	fetch_timing_end(timing, FETCH_DONE, length);
+	telemetry_record(host, port, selector, FALSE, get_elapsed_ms() - started, length);
+
+	shared_cache_store(key, response, length);
+	if (claimed) shared_cache_release_fetch(key_hash);
+	if (length_out) *length_out = length;
+	return response;
+}
+
+/* Fetches a resource into an already unlinked temporary file, for items too
+ * large to hold in memory. Returns the descriptor, or -1 with the reason in
+ * g_fetch_error. */
+int fetch_to_temp_file(const char *host, int port, const char *selector, size_t *length_out, const AppState *progress) {
+	char path[MAX_PATH_LENGTH];
+	const char *tmp_dir = getenv("TMPDIR");
+	unsigned long started;
+	unsigned long timing;
+	int fd;
+	int sock;
+	int result = -1;
+
+	if (tmp_dir == NULL || tmp_dir[0] == '\0') {
+		tmp_dir = "/tmp";
+	}
+	if (strlen(tmp_dir) + strlen("/tocaia-XXXXXX") >= sizeof(path)) {
+		strcpy(g_fetch_error, "The temporary directory path is too long.");
+		return -1;
+	}
+	if (!breaker_allows_fetch(host, port, FALSE) || !budget_allows(FETCH_PRIORITY_PAGE)) {
+		return -1;
+	}
+
+	sprintf(path, "%s/tocaia-XXXXXX", tmp_dir);
+	fd = mkstemp(path);
+	if (fd == -1) {
+		strcpy(g_fetch_error, "Could not create a temporary file.");
+		return -1;
+	}
+	unlink(path); /* Reclaimed once the descriptor and any mapping are gone. */
+
+	started = get_elapsed_ms();
+	timing = fetch_timing_begin(host, port, selector, FETCH_PRIORITY_PAGE);
+	g_fetch_timing_current = timing;
+	sock = connect_and_send_request(host, port, selector);
+	if (sock != -1) {
+		result = receive_to_file(sock, fd, length_out, progress);
+		close(sock);
+	}
+	g_fetch_timing_current = 0;
+	fetch_timing_end(timing, result == 1 ? FETCH_DONE : result == 0 ? FETCH_CANCELLED : FETCH_FAILED,
+	                 result == 1 ? (unsigned long)*length_out : 0);
+
+	/* A cancelled transfer says nothing about the host. */
+	if (result != 0) {
+		telemetry_record(host, port, selector, result == -1, get_elapsed_ms() - started,
+		                 result == 1 ? (unsigned long)*length_out : 0);
+	}
+	if (result != 1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* 32-bit FNV-1a hash, kept in an unsigned long for C89 portability. */
+unsigned long hash_bytes(const char *data, size_t len) {
+	unsigned long hash = 2166136261UL;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash = (hash * 16777619UL) & 0xffffffffUL;
+	}
+	return hash;
+}
+
+/* Builds the string that identifies a resource in the caches. */
+void make_cache_key(const char *host, int port, const char *selector, char *key_out) {
+	sprintf(key_out, "%.*s\t%d\t%.*s", MAX_HOST_LENGTH - 1, host, port, MAX_SELECTOR_LENGTH - 1, selector);
+}
+
+/* Tells whether the process that claimed a fetch is still working on it. */
+BOOL inflight_owner_alive(const SharedInflight *entry) {
+	if (entry->pid == 0 || time(NULL) - entry->started_at > INFLIGHT_WAIT_MS / 1000) {
+		return FALSE;
+	}
+	return kill((pid_t)entry->pid, 0) == 0 || errno == EPERM;
+}
+
+/* Registers this process as the one fetching `key_hash`, noting whether it
+ * expects the body to be too large to share. Returns FALSE when a live
+ * process already is; the caller should wait for it instead. */
+BOOL shared_cache_claim_fetch(unsigned long key_hash, BOOL unshared) {
+	SharedInflight *entry;
+	SharedInflight *free_entry = NULL;
+	BOOL claimed = TRUE;
+	int i;
+
+	if (!g_shared_cache.header) {
+		return TRUE;
+	}
+
+	shared_cache_lock(F_WRLCK);
+	for (i = 0; i < SHARED_CACHE_INFLIGHT; ++i) {
+		entry = &g_shared_cache.header->inflight[i];
+		if (!inflight_owner_alive(entry)) {
+			if (!free_entry) free_entry = entry;
+		} else if (entry->key_hash == key_hash && entry->pid != (long)getpid()) {
+			claimed = FALSE;
+			break;
+		}
+	}
+	/* When the table is full the fetch simply goes ahead uncoordinated. */
+	if (claimed && free_entry) {
+		free_entry->key_hash = key_hash;
+		free_entry->pid = (long)getpid();
+		free_entry->started_at = (long)time(NULL);
+		free_entry->unshared = unshared;
+	}
+	shared_cache_lock(F_UNLCK);
+	return claimed;
+}
+
+/* Drops this process's claim on `key_hash` once its body is published. */
+void shared_cache_release_fetch(unsigned long key_hash) {
+	SharedInflight *entry;
+	int i;
+
+	if (!g_shared_cache.header) {
+		return;
+	}
+
+	shared_cache_lock(F_WRLCK);
+	for (i = 0; i < SHARED_CACHE_INFLIGHT; ++i) {
+		entry = &g_shared_cache.header->inflight[i];
+		if (entry->key_hash == key_hash && entry->pid == (long)getpid()) {
+			entry->pid = 0;
+		}
+	}
+	shared_cache_lock(F_UNLCK);
+}
+
+/* Blocks until no live process holds a claim on `key_hash`, for at most
+ * INFLIGHT_WAIT_MS. Returns FALSE at once when the claimant expects a body
+ * too large to share, as there is nothing to wait for. */
+BOOL shared_cache_wait_for_fetch(unsigned long key_hash) {
+	unsigned long waited = 0;
+	struct timeval tv;
+	BOOL pending;
+	BOOL shared = TRUE;
+	int i;
+
+	for (;;) {
+		pending = FALSE;
+		shared_cache_lock(F_WRLCK);
+		for (i = 0; i < SHARED_CACHE_INFLIGHT; ++i) {
+			const SharedInflight *entry = &g_shared_cache.header->inflight[i];
+			if (entry->key_hash == key_hash && inflight_owner_alive(entry)) {
+				pending = TRUE;
+				shared = !entry->unshared;
+				break;
+			}
+		}
+		shared_cache_lock(F_UNLCK);
+		if (!pending || !shared || waited >= INFLIGHT_WAIT_MS) {
+			return shared;
+		}
+
+		if (waited == 0 && g_status_terminal) {
+			clear_line(g_status_terminal->ws_row, g_status_terminal->ws_col);
+			move_cursor(g_status_terminal->ws_row, 1);
+			printf("%sWaiting for another tocaia fetching this page...%s", FOOTER_COLOR, COLOR_RESET);
+			fflush(stdout);
+		}
+		tv.tv_sec = 0;
+		tv.tv_usec = INFLIGHT_POLL_MS * 1000L;
+		select(0, NULL, NULL, NULL, &tv);
+		waited += INFLIGHT_POLL_MS;
+	}
+}
+
+/* Milliseconds elapsed since the program started. */
+unsigned long get_elapsed_ms(void) {
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (unsigned long)((now.tv_sec - g_start_time.tv_sec) * 1000L +
+	                       (now.tv_usec - g_start_time.tv_usec) / 1000L);
+}
+
+/* Hashes the host and port pair that identifies a server. */
+unsigned long hash_host_key(const char *host, int port) {
+	char key[MAX_HOST_LENGTH + 8];
+
+	sprintf(key, "%.*s\t%d", MAX_HOST_LENGTH - 1, host, port);
+	return hash_bytes(key, strlen(key));
+}
+
+/* Finds the telemetry slot for a key in a bounded probe window, so lookups
+ * stay constant-time. With `create`, the window's first slot is recycled
+ * when the key is absent and no slot is free. A new entry starts zeroed;
+ * a zero concurrency reads as HOST_CONCURRENCY_INITIAL. */
+FetchTelemetry *telemetry_slot(FetchTelemetry *table, int slots, unsigned long key_hash, BOOL create) {
+	FetchTelemetry *free_slot = NULL;
+	int i;
+
+	for (i = 0; i < TELEMETRY_PROBES; ++i) {
+		FetchTelemetry *slot = &table[(key_hash + i) & (slots - 1)];
+		if (slot->in_use && slot->key_hash == key_hash) {
+			return slot;
+		}
+		if (!slot->in_use && !free_slot) {
+			free_slot = slot;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	if (!free_slot) {
+		free_slot = &table[key_hash & (slots - 1)];
+	}
+	memset(free_slot, 0, sizeof(*free_slot));
+	free_slot->in_use = TRUE;
+	free_slot->key_hash = key_hash;
+	return free_slot;
+}
+
+/* Records the outcome of a network fetch for the link and for its host. */
+void telemetry_record(const char *host, int port, const char *selector, BOOL failed, unsigned long latency_ms, unsigned long size) {
+	char key[MAX_CACHE_KEY_LENGTH];
+	FetchTelemetry *slot;
+
+	make_cache_key(host, port, selector, key);
+	slot = telemetry_slot(g_link_telemetry, TELEMETRY_LINK_SLOTS, hash_bytes(key, strlen(key)), TRUE);
+	slot->failed = failed;
+	slot->latency_ms = latency_ms;
+	slot->size = size;
+
+	slot = telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS, hash_host_key(host, port), TRUE);
+	slot->failed = failed;
+	slot->latency_ms = latency_ms;
+	slot->size = size;
+	breaker_record(slot, failed);
+}
+
+/* Parallel bulk fetches currently allowed to a host. */
+int host_concurrency_limit(unsigned long host_hash) {
+	const FetchTelemetry *host = telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS, host_hash, FALSE);
+	return (host && host->concurrency) ? host->concurrency : HOST_CONCURRENCY_INITIAL;
+}
+
+/* Tunes a host's limit after a bulk fetch: one more parallel fetch after a
+ * full window of successes, half as many after an error or a slowdown.
+ * Decreases are spaced by the host's usual latency so that the fetches of
+ * one congested window only count once. */
+void host_concurrency_record(unsigned long host_hash, BOOL failed, unsigned long latency_ms) {
+	FetchTelemetry *host = telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS, host_hash, TRUE);
+	unsigned long now = get_elapsed_ms();
+	BOOL slow;
+
+	if (!host->concurrency) {
+		host->concurrency = HOST_CONCURRENCY_INITIAL;
+	}
+	slow = host->baseline_ms && latency_ms >= HOST_SLOWDOWN_MIN_MS &&
+	       latency_ms > host->baseline_ms * HOST_SLOWDOWN_FACTOR;
+
+	if (failed || slow) {
+		if (!host->decreased_at_ms || now - host->decreased_at_ms >= host->baseline_ms) {
+			host->concurrency = host->concurrency > 1 ? host->concurrency / 2 : 1;
+			host->concurrency_credit = 0;
+			host->decreased_at_ms = now;
+		}
+	} else if (++host->concurrency_credit >= host->concurrency && host->concurrency < HOST_CONCURRENCY_MAX) {
+		host->concurrency++;
+		host->concurrency_credit = 0;
+	}
+	if (!failed) {
+		host->baseline_ms = host->baseline_ms ? (host->baseline_ms * 7 + latency_ms) / 8 : latency_ms;
+	}
+}
+
+/* Starts the timing record of a fetch in the ring of recent ones.
+ * Returns its id, which stays valid until the ring wraps around. */
+unsigned long fetch_timing_begin(const char *host, int port, const char *selector, int priority) {
+	FetchTiming *timing = &g_fetch_timings[g_fetch_timing_count % FETCH_TIMING_SLOTS];
+	const FetchTelemetry *seen = telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS, hash_host_key(host, port), FALSE);
+	int i;
+
+	memset(timing, 0, sizeof(*timing));
+	timing->id = ++g_fetch_timing_count;
+	sprintf(timing->label, "%.40s:%d%s%.40s", host, port, selector[0] == '/' ? "" : "/", selector);
+	for (i = 0; timing->label[i]; i++) {
+		if ((unsigned char)timing->label[i] < 0x20) timing->label[i] = ' ';
+	}
+	timing->priority = priority;
+	timing->started_ms = get_elapsed_ms();
+	timing->expected_ms = (seen && !seen->failed) ? seen->latency_ms * WATCHDOG_FETCH_FACTOR : 0;
+	if (timing->expected_ms < WATCHDOG_FETCH_MIN_MS) {
+		timing->expected_ms = WATCHDOG_FETCH_MIN_MS;
+	}
+	return timing->id;
+}
+
+/* Looks up a timing record, or NULL once its slot has been reused. */
+FetchTiming *fetch_timing_find(unsigned long id) {
+	FetchTiming *timing = &g_fetch_timings[(id - 1) % FETCH_TIMING_SLOTS];
+	return (id != 0 && timing->id == id) ? timing : NULL;
+}
+
+/* Marks the end of a phase. Phases skipped over, such as resolving a host
+ * already looked up, end at the same moment. */
+void fetch_timing_mark(unsigned long id, int phase) {
+	FetchTiming *timing = fetch_timing_find(id);
+	unsigned long now = get_elapsed_ms();
+
+	if (!timing) {
+		return;
+	}
+	while (timing->phase <= phase) {
+		timing->phase_ms[timing->phase++] = now;
+	}
+}
+
+/* Completes a timing record with one of the FETCH_DONE... results. */
+void fetch_timing_end(unsigned long id, int result, unsigned long size) {
+	FetchTiming *timing = fetch_timing_find(id);
+
+	if (!timing || timing->phase == FETCH_PHASES) {
+		return;
+	}
+	timing->result = result;
+	timing->size = size;
+	fetch_timing_mark(id, FETCH_FINISHED);
+	if (g_watchdog && (result == FETCH_DONE || result == FETCH_FAILED)) {
+		watchdog_count(g_watchdog->fetch_ms, timing->phase_ms[FETCH_FINISHED] - timing->started_ms);
+	}
+}
+
+/* Starts the watchdog of the interactive browser. It runs as a process of
+ * its own and watches memory shared with the browser, instead of waking it
+ * with signals that would interrupt its blocking reads and connects. The
+ * browser works as before if the watchdog cannot be started. */
+void watchdog_start(void) {
+	const char *tmp_dir = getenv("TMPDIR");
+	char path[MAX_PATH_LENGTH];
+	pid_t parent = getpid();
+	void *shared;
+	int fd;
+
+	if (tmp_dir == NULL || tmp_dir[0] == '\0') {
+		tmp_dir = "/tmp";
+	}
+	if (strlen(tmp_dir) + strlen("/tocaia-XXXXXX") >= sizeof(path)) {
+		return;
+	}
+	sprintf(path, "%s/tocaia-XXXXXX", tmp_dir);
+	fd = mkstemp(path);
+	if (fd == -1) {
+		return;
+	}
+	unlink(path);
+	if (ftruncate(fd, sizeof(WatchdogState)) == -1) {
+		close(fd);
+		return;
+	}
+	shared = mmap(NULL, sizeof(WatchdogState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shared == MAP_FAILED) {
+		return;
+	}
+
+	g_watchdog = (WatchdogState *)shared;
+	memcpy(g_watchdog->timings, g_fetch_timings, sizeof(g_watchdog->timings));
+	g_fetch_timings = g_watchdog->timings;
+	g_watchdog->tick_ms = get_elapsed_ms();
+
+	switch (fork()) {
+	case -1:
+		memcpy(g_fetch_timing_ring, g_watchdog->timings, sizeof(g_fetch_timing_ring));
+		g_fetch_timings = g_fetch_timing_ring;
+		g_watchdog = NULL;
+		munmap(shared, sizeof(WatchdogState));
+		break;
+	case 0:
+		/* _exit() skips the browser's atexit() terminal restore. */
+		watchdog_run(parent);
+		_exit(EXIT_SUCCESS);
+	}
+}
+
+/* Loop of the watchdog process, until the browser exits. Each slow page
+ * fetch and each spell of unread input is dumped once. Input typed while
+ * a page is being fetched is left to the slow fetch check. */
+void watchdog_run(pid_t parent) {
+	unsigned long reported[FETCH_TIMING_SLOTS];
+	unsigned long pending_since = 0;
+	unsigned long now;
+	char reason[FETCH_TIMING_LABEL_LENGTH + 64];
+	FetchTiming timing;
+	BOOL fetching;
+	BOOL stalled = FALSE;
+	int pending = 0;
+	int queued;
+	int i;
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGWINCH, SIG_DFL);
+	memset(reported, 0, sizeof(reported));
+
+	while (getppid() == parent) {
+		usleep(WATCHDOG_POLL_MS * 1000);
+		now = get_elapsed_ms();
+
+		fetching = FALSE;
+		for (i = 0; i < FETCH_TIMING_SLOTS; i++) {
+			timing = g_watchdog->timings[i];
+			if (timing.id == 0 || timing.phase == FETCH_PHASES || timing.priority != FETCH_PRIORITY_PAGE) {
+				continue;
+			}
+			fetching = TRUE;
+			if (timing.phase <= FETCH_FIRST_BYTE && reported[i] != timing.id &&
+			        now - timing.started_ms >= timing.expected_ms) {
+				reported[i] = timing.id;
+				sprintf(reason, "No first byte from %.*s after %lums",
+				        FETCH_TIMING_LABEL_LENGTH - 1, timing.label, now - timing.started_ms);
+				watchdog_dump(reason);
+			}
+		}
+
+		/* The clock restarts whenever the browser reads some of the input. */
+		if (ioctl(STDIN_FILENO, FIONREAD, &queued) == -1) {
+			queued = 0;
+		}
+		if (pending == 0 || queued < pending) {
+			pending_since = now;
+			stalled = FALSE;
+		}
+		pending = queued;
+		if (pending && !stalled && !fetching && now - pending_since >= WATCHDOG_STALL_MS) {
+			stalled = TRUE;
+			sprintf(reason, "Input unread for %lums", now - pending_since);
+			watchdog_dump(reason);
+		}
+	}
+}
+
+/* Publishes a snapshot of the browser for the watchdog. Called on every
+ * pass of the input loops, so it also tells when the browser last got
+ * back to waiting for input. */
+void watchdog_tick(const AppState *state) {
+	WatchdogState *wd = g_watchdog;
+	const NavigationState *nav = state->current_nav;
+
+	if (!wd) {
+		return;
+	}
+	wd->tick_ms = get_elapsed_ms();
+	get_current_url(nav, wd->url, sizeof(wd->url));
+	if (wd->page != nav->page_content) {
+		wd->page = nav->page_content;
+		wd->page_length = wd->page ? strlen(wd->page) : 0;
+	}
+	if (state->follow.active) {
+		wd->page_length = state->follow.body_length;
+	}
+	wd->is_menu = is_gopher_menu(nav);
+	wd->menu_items = state->menu.count;
+	wd->menu_links = state->menu.selectable_count;
+	wd->selected_index = state->selected_index;
+	wd->scroll_offset = state->scroll_offset;
+	wd->text_lines = state->total_content_lines;
+	wd->text_scroll_line = state->text_scroll_line;
+	wd->changed_lines = nav->lines.changed_lines;
+	wd->preview_length = state->preview.length;
+	wd->follow_active = state->follow.active;
+	wd->follow_length = state->follow.length;
+	wd->follow_capacity = state->follow.capacity;
+	wd->show_waterfall = state->show_waterfall;
+	wd->rows = state->terminal_size.ws_row;
+	wd->cols = state->terminal_size.ws_col;
+	wd->session_bytes = g_session_bytes;
+	wd->budget_bytes = g_budget_bytes;
+}
+
+/* Records how long a key press took to reach the screen. */
+void watchdog_frame(unsigned long input_ms) {
+	if (g_watchdog) {
+		watchdog_count(g_watchdog->frame_ms, get_elapsed_ms() - input_ms);
+	}
+}
+
+/* Adds a time to a histogram of WATCHDOG_BUCKETS powers of two. */
+void watchdog_count(unsigned long *histogram, unsigned long ms) {
+	int bucket = 0;
+
+	while (ms && bucket < WATCHDOG_BUCKETS - 1) {
+		ms >>= 1;
+		bucket++;
+	}
+	histogram[bucket]++;
+}
+
+/* Appends what the browser was doing to the watchdog log. */
+void watchdog_dump(const char *reason) {
+	const WatchdogState *wd = g_watchdog;
+	const char *priority_names[] = { "page", "follow", "preview", "check", "mirror" };
+	const char *result_names[] = { "done", "failed", "cancelled", "cached" };
+	const char *phase_names[FETCH_PHASES] = { "resolved", "connected", "first byte", "finished" };
+	const unsigned long *histogram;
+	unsigned long now = get_elapsed_ms();
+	unsigned long newest = 0;
+	char path[MAX_PATH_LENGTH];
+	char old_path[MAX_PATH_LENGTH];
+	char stamp[32];
+	time_t clock = time(NULL);
+	FetchTiming timing;
+	struct stat st;
+	FILE *file;
+	int i, j;
+
+	if (!get_data_path(WATCHDOG_FILE, path)) {
+		return;
+	}
+	if (stat(path, &st) == 0 && st.st_size >= WATCHDOG_LOG_MAX && get_data_path(WATCHDOG_OLD_FILE, old_path)) {
+		rename(path, old_path);
+	}
+	if ((file = fopen(path, "a")) == NULL) {
+		return;
+	}
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&clock));
+	fprintf(file, "%s %s\n", stamp, reason);
+	fprintf(file, "  browser pid %ld, up %lums\n", (long)getppid(), now);
+	if (wd->url[0] == '\0') {
+		fprintf(file, "  no page shown yet\n");
+	} else {
+		fprintf(file, "  input loop last ran %lums ago\n", now - wd->tick_ms);
+		fprintf(file, "  %s %s, %lu bytes\n", wd->is_menu ? "menu" : "text", wd->url, wd->page_length);
+		if (wd->is_menu) {
+			fprintf(file, "  %d items, %d links, link %d selected, scrolled to item %d\n",
+			        wd->menu_items, wd->menu_links, wd->selected_index, wd->scroll_offset);
+		} else {
+			fprintf(file, "  %d lines, scrolled to line %d, %d changed since the last visit\n",
+			        wd->text_lines, wd->text_scroll_line, wd->changed_lines);
+		}
+	}
+	fprintf(file, "  preview %lu bytes, follow %s with %lu of %lu bytes buffered\n",
+	        wd->preview_length, wd->follow_active ? "on" : "off", wd->follow_length, wd->follow_capacity);
+	fprintf(file, "  terminal %dx%d, waterfall %s, %lu bytes received",
+	        wd->cols, wd->rows, wd->show_waterfall ? "shown" : "hidden", wd->session_bytes);
+	if (wd->budget_bytes) {
+		fprintf(file, " of a %lu byte budget", wd->budget_bytes);
+	}
+	fprintf(file, "\n");
+
+	for (i = 0; i < FETCH_TIMING_SLOTS; i++) {
+		if (wd->timings[i].id > newest) newest = wd->timings[i].id;
+	}
+	fprintf(file, "  fetches, newest first, in ms since each started:\n");
+	for (i = 0; i < FETCH_TIMING_SLOTS && (unsigned long)i < newest; i++) {
+		timing = wd->timings[(newest - i - 1) % FETCH_TIMING_SLOTS];
+		if (timing.id != newest - i || timing.priority > FETCH_PRIORITY_MIRROR) {
+			continue;
+		}
+		fprintf(file, "    #%lu %s %.*s", timing.id, priority_names[timing.priority],
+		        FETCH_TIMING_LABEL_LENGTH - 1, timing.label);
+		for (j = 0; j < timing.phase && j < FETCH_PHASES; j++) {
+			fprintf(file, ", %s %lu", phase_names[j], timing.phase_ms[j] - timing.started_ms);
+		}
+		if (timing.phase >= FETCH_PHASES) {
+			fprintf(file, ", %s, %lu bytes\n", result_names[timing.result & 3], timing.size);
+		} else {
+			fprintf(file, ", in flight for %lu, first byte expected within %lu\n",
+			        now - timing.started_ms, timing.expected_ms);
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		histogram = i ? wd->fetch_ms : wd->frame_ms;
+		fprintf(file, "  %s, ms:", i ? "network fetches" : "key to screen");
+		for (j = 0; j < WATCHDOG_BUCKETS - 1; j++) {
+			fprintf(file, " <%lu:%lu", 1UL << j, histogram[j]);
+		}
+		fprintf(file, " >=%lu:%lu\n", 1UL << (WATCHDOG_BUCKETS - 2), histogram[j]);
+	}
+	fprintf(file, "\n");
+	fclose(file);
+}
+
+/* Feeds a host's circuit breaker, backing off exponentially while the host
+ * keeps failing. */
+void breaker_record(FetchTelemetry *host, BOOL failed) {
+	if (!failed) {
+		host->consecutive_failures = 0;
+		host->backoff_ms = 0;
+	} else {
+		host->consecutive_failures++;
+		host->backoff_ms = host->backoff_ms ? host->backoff_ms * 2 : BREAKER_BASE_BACKOFF_MS;
+		if (host->backoff_ms > BREAKER_MAX_BACKOFF_MS) {
+			host->backoff_ms = BREAKER_MAX_BACKOFF_MS;
+		}
+		host->retry_at_ms = get_elapsed_ms() + host->backoff_ms;
+	}
+}
+
+/* Circuit breaker check made before connecting to a host. A host that
+ * failed recently is skipped until its backoff expires; after
+ * BREAKER_THRESHOLD failures in a row the circuit is open and every fetch
+ * fails fast. Once the backoff expires a single probe is let through
+ * (half-open): success closes the circuit, failure reopens it for longer.
+ * An explicit retry always probes. */
+BOOL breaker_allows_fetch(const char *host, int port, BOOL retry) {
+	FetchTelemetry *slot = telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS, hash_host_key(host, port), FALSE);
+	unsigned long now = get_elapsed_ms();
+
+	if (!slot || slot->consecutive_failures == 0 || retry || now >= slot->retry_at_ms) {
+		if (slot && slot->consecutive_failures > 0) {
+			/* Half-open: hold the circuit while this probe is in flight. */
+			slot->retry_at_ms = now + slot->backoff_ms;
+		}
+		return TRUE;
+	}
+
+	if (slot->consecutive_failures >= BREAKER_THRESHOLD) {
+		sprintf(g_fetch_error, "Circuit open after %d failures in a row; next attempt in %lus.",
+		        slot->consecutive_failures, (slot->retry_at_ms - now + 999) / 1000);
+	} else {
+		sprintf(g_fetch_error, "The last attempt failed; next attempt in %lus.",
+		        (slot->retry_at_ms - now + 999) / 1000);
+	}
+	return FALSE;
+}
+
+/* Notes which host a new socket reads from, for metered_read(). */
+void meter_socket(int sock, unsigned long host_hash) {
+	if (sock >= 0 && sock < FD_SETSIZE) {
+		g_socket_hosts[sock] = host_hash;
+	}
+}
+
+/* Reads from a fetch's socket, counting what arrives against the session
+ * and its host. Every fetch reads through here. */
+ssize_t metered_read(int sock, void *buffer, size_t length) {
+	ssize_t n = read(sock, buffer, length);
+	FetchTelemetry *host;
+
+	if (n > 0) {
+		g_session_bytes += n;
+		if (sock < FD_SETSIZE && g_socket_hosts[sock]) {
+			host = telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS, g_socket_hosts[sock], TRUE);
+			host->bytes_received += n;
+		}
+	}
+	return n;
+}
+
+/* Reads what the kernel has already received on a socket that is being
+ * closed before the end of its reply. Those bytes crossed the network, so
+ * they count against the budget even though nobody uses them. Only what
+ * was queued on entry is read, so a fast sender cannot keep it going. */
+void drain_socket(int sock) {
+	char buffer[SPILL_CHUNK_SIZE];
+	int queued = 0;
+	ssize_t n;
+
+	if (ioctl(sock, FIONREAD, &queued) == -1) {
+		return;
+	}
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+	while (queued > 0) {
+		n = metered_read(sock, buffer, (size_t)queued < sizeof(buffer) ? (size_t)queued : sizeof(buffer));
+		if (n <= 0) break;
+		queued -= (int)n;
+	}
+}
+
+/* Data-saver check made before a fetch goes to the network, and after
+ * each read of a long transfer. Without a budget everything is allowed.
+ * Once it is used up nothing is; before that, only fetches the user is
+ * waiting on may eat into the reserve. Sets g_fetch_error when refusing. */
+BOOL budget_allows(int priority) {
+	char size_text[16];
+
+	if (!g_budget_bytes) {
+		return TRUE;
+	}
+	if (g_session_bytes >= g_budget_bytes) {
+		format_size(g_budget_bytes, size_text);
+		sprintf(g_fetch_error, "The data budget of %s is used up.", size_text);
+		return FALSE;
+	}
+	if (priority != FETCH_PRIORITY_PAGE &&
+	        g_budget_bytes - g_session_bytes < g_budget_bytes / 100 * BUDGET_RESERVE_PERCENT) {
+		sprintf(g_fetch_error, "Less than %d%% of the data budget is left.", BUDGET_RESERVE_PERCENT);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Parses a byte count such as "500K", "20M" or "1G". */
+BOOL parse_size(const char *text, unsigned long *bytes_out) {
+	char *end;
+	unsigned long value = strtoul(text, &end, 10);
+	unsigned long unit = 1;
+
+	if (end == text) {
+		return FALSE;
+	}
+	switch (toupper((unsigned char)*end)) {
+	case 'K': unit = 1024UL; end++; break;
+	case 'M': unit = 1024UL * 1024UL; end++; break;
+	case 'G': unit = 1024UL * 1024UL * 1024UL; end++; break;
+	}
+	if (*end != '\0' || value == 0 || value > (unsigned long)-1 / unit) {
+		return FALSE;
+	}
+	*bytes_out = value * unit;
+	return TRUE;
+}
+
+/* Shows what is left of the data budget, and what this host has used, at
+ * the right of the bottom row if it fits after `used_columns`. */
+void draw_budget(const AppState *state, int used_columns) {
+	const FetchTelemetry *host;
+	char left[16], total[16], used[16];
+	char text[96];
+	int column;
+
+	if (!g_budget_bytes) {
+		return;
+	}
+	format_size(g_session_bytes < g_budget_bytes ? g_budget_bytes - g_session_bytes : 0, left);
+	format_size(g_budget_bytes, total);
+	sprintf(text, "%s of %s left", left, total);
+	host = state->current_nav && !state->current_nav->is_local ?
+	       telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS,
+	                      hash_host_key(state->current_nav->host, state->current_nav->port), FALSE) : NULL;
+	if (host && host->bytes_received) {
+		format_size(host->bytes_received, used);
+		sprintf(text + strlen(text), ", %s from this host", used);
+	}
+
+	column = state->terminal_size.ws_col - (int)strlen(text) + 1;
+	if (column <= used_columns + 1) {
+		return;
+	}
+	printf("%s", g_session_bytes >= g_budget_bytes ? DEAD_HOST_COLOR :
+	       g_budget_bytes - g_session_bytes < g_budget_bytes / 100 * BUDGET_RESERVE_PERCENT ? SLOW_HOST_COLOR : FOOTER_COLOR);
+	print_string_at(text, state->terminal_size.ws_row, column);
+	printf("%s", COLOR_RESET);
+}
+
+/* Reads the mirror groups: one group per line, as space separated
+ * host[:port] members. Text after '#' is ignored. */
+void mirror_load(void) {
+	char line[1024];
+	char *word;
+	char *colon;
+	int group = 0;
+	int first;
+	FILE *file;
+	char path[MAX_PATH_LENGTH];
+
+	g_mirror_count = 0;
+	if (!get_data_path(MIRROR_FILE, path) || (file = fopen(path, "r")) == NULL) {
+		return;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		if ((word = strchr(line, '#')) != NULL) *word = '\0';
+		first = g_mirror_count;
+		for (word = strtok(line, " \t\r\n"); word && g_mirror_count < MIRROR_MAX_HOSTS; word = strtok(NULL, " \t\r\n")) {
+			MirrorHost *mirror = &g_mirrors[g_mirror_count];
+			memset(mirror, 0, sizeof(*mirror));
+			colon = strrchr(word, ':');
+			mirror->port = colon ? atoi(colon + 1) : 70;
+			if (colon) *colon = '\0';
+			if (word[0] == '\0' || strlen(word) >= MAX_HOST_LENGTH || mirror->port <= 0 || mirror->port > 65535) {
+				continue;
+			}
+			strcpy(mirror->host, word);
+			mirror->group = group;
+			g_mirror_count++;
+		}
+		/* A group of one has nothing to race. */
+		if (g_mirror_count - first < 2) {
+			g_mirror_count = first;
+		} else {
+			group++;
+		}
+	}
+	fclose(file);
+}
+
+/* Finds a host among the mirror group members. Returns -1 if it has none. */
+int mirror_find(const char *host, int port) {
+	int i;
+
+	if (g_mirror_count == -1) {
+		mirror_load();
+	}
+	for (i = 0; i < g_mirror_count; i++) {
+		if (g_mirrors[i].port == port && strcmp(g_mirrors[i].host, host) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Lists the members of a mirror group fastest first, by their median first
+ * byte time. Members never timed follow, in the order they were declared.
+ * Returns how many there are. */
+int mirror_candidates(int member, int *order) {
+	unsigned long medians[MIRROR_MAX_HOSTS];
+	unsigned long median;
+	int count = 0;
+	int i, j;
+
+	for (i = 0; i < g_mirror_count; i++) {
+		if (g_mirrors[i].group != g_mirrors[member].group) {
+			continue;
+		}
+		median = g_mirrors[i].samples ? mirror_percentile(&g_mirrors[i], 50) : (unsigned long)-1;
+		for (j = count; j > 0 && medians[j - 1] > median; j--) {
+			medians[j] = medians[j - 1];
+			order[j] = order[j - 1];
+		}
+		medians[j] = median;
+		order[j] = i;
+		count++;
+	}
+	return count;
+}
+
+/* Returns the first byte time below which `percentile` percent of a
+ * member's recent fetches answered. */
+unsigned long mirror_percentile(const MirrorHost *mirror, int percentile) {
+	unsigned long sorted[MIRROR_SAMPLES];
+	unsigned long value;
+	int count = mirror->samples < MIRROR_SAMPLES ? mirror->samples : MIRROR_SAMPLES;
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		value = mirror->first_byte_ms[i];
+		for (j = i; j > 0 && sorted[j - 1] > value; j--) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = value;
+	}
+	return count ? sorted[(count - 1) * percentile / 100] : 0;
+}
+
+/* Adds a first byte time to a member's ring of recent ones. */
+void mirror_sample(MirrorHost *mirror, unsigned long ms) {
+	mirror->first_byte_ms[mirror->samples % MIRROR_SAMPLES] = ms;
+	mirror->samples++;
+}
+
+/* Looks up a selector in the shared cache under each member of a mirror
+ * group, since any of them would have served the same body. */
+char *mirror_cache_lookup(int member, const char *selector, size_t *length_out) {
+	char key[MAX_CACHE_KEY_LENGTH];
+	char *response;
+	int i;
+
+	for (i = 0; i < g_mirror_count; i++) {
+		if (i != member && g_mirrors[i].group == g_mirrors[member].group) {
+			make_cache_key(g_mirrors[i].host, g_mirrors[i].port, selector, key);
+			if ((response = shared_cache_lookup(key, length_out)) != NULL) {
+				return response;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Fetches a selector from a mirror group. The fastest member is asked
+ * first; if it has not started to answer within the hedge delay, or fails,
+ * the next one is asked too, keeping up to MIRROR_RACERS requests in
+ * flight. The first to send a byte wins, and the others are closed.
+ * `timing` is the record of the whole fetch, each replica getting its own.
+ * Returns NULL with the reason in g_fetch_error if no member answered. */
+char *mirror_fetch(int member, const char *selector, BOOL retry, unsigned long timing, size_t *length_out) {
+	LinkProbe probes[MIRROR_RACERS];
+	ResolvedHost hosts[CHECK_RESOLVE_SLOTS];
+	GopherItem item;
+	MirrorHost *mirror;
+	int order[MIRROR_MAX_HOSTS];
+	int count;
+	int next = 0;
+	int active = 0;
+	int winner = -1;
+	int max_fd;
+	int error;
+	socklen_t error_len;
+	unsigned long hedge_ms;
+	unsigned long next_start_ms = 0;
+	unsigned long now;
+	unsigned long waited;
+	char *response = NULL;
+	fd_set read_fds, write_fds;
+	struct timeval tv;
+	char byte;
+	ssize_t n;
+	int i;
+
+	count = mirror_candidates(member, order);
+	mirror = &g_mirrors[order[0]];
+	hedge_ms = mirror->samples >= MIRROR_MIN_SAMPLES ?
+	           mirror_percentile(mirror, MIRROR_HEDGE_PERCENTILE) : MIRROR_HEDGE_DEFAULT_MS;
+	if (hedge_ms < MIRROR_HEDGE_MIN_MS) {
+		hedge_ms = MIRROR_HEDGE_MIN_MS;
+	}
+	memset(hosts, 0, sizeof(hosts));
+	for (i = 0; i < MIRROR_RACERS; i++) {
+		probes[i].item = -1;
+	}
+	strcpy(g_fetch_error, "No mirror could be reached.");
+
+	while (winner == -1) {
+		/* Ask the next member when nothing is in flight or the hedge delay
+		 * has passed, unless the data budget is low. Those whose breaker is
+		 * open are skipped. */
+		now = get_elapsed_ms();
+		while (next < count && active < MIRROR_RACERS &&
+		       (active == 0 || (now >= next_start_ms && budget_allows(FETCH_PRIORITY_MIRROR)))) {
+			mirror = &g_mirrors[order[next++]];
+			if (!breaker_allows_fetch(mirror->host, mirror->port, retry)) {
+				continue;
+			}
+			memset(&item, 0, sizeof(item));
+			strcpy(item.host, mirror->host);
+			item.port = mirror->port;
+			strcpy(item.selector, selector);
+			item.host_hash = hash_host_key(item.host, item.port);
+			for (i = 0; probes[i].item != -1; i++);
+			if (!link_probe_start(&probes[i], &item, hosts, FETCH_PRIORITY_MIRROR)) {
+				telemetry_record(mirror->host, mirror->port, selector, TRUE, 0, 0);
+				continue;
+			}
+			probes[i].item = (int)(mirror - g_mirrors);
+			active++;
+			next_start_ms = now + hedge_ms;
+		}
+		if (active == 0) {
+			break;
+		}
+
+		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		max_fd = -1;
+		for (i = 0; i < MIRROR_RACERS; i++) {
+			if (probes[i].item != -1) link_probe_watch(&probes[i], &read_fds, &write_fds, &max_fd);
+		}
+		waited = (next < count && active < MIRROR_RACERS && next_start_ms > now) ? next_start_ms - now : 100;
+		tv.tv_sec = 0;
+		tv.tv_usec = (waited < 100 ? waited : 100) * 1000L;
+		if (select(max_fd + 1, &read_fds, &write_fds, NULL, &tv) < 0 && errno != EINTR) {
+			break;
+		}
+
+		now = get_elapsed_ms();
+		for (i = 0; i < MIRROR_RACERS && winner == -1; i++) {
+			LinkProbe *probe = &probes[i];
+			BOOL failed = FALSE;
+
+			if (probe->item == -1) continue;
+			mirror = &g_mirrors[probe->item];
+			if (probe->resolving) {
+				if (FD_ISSET(probe->sock, &read_fds) && !link_probe_resolved(probe)) {
+					failed = TRUE;
+				}
+			} else if (!probe->connected && FD_ISSET(probe->sock, &write_fds)) {
+				error = 0;
+				error_len = sizeof(error);
+				if (getsockopt(probe->sock, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1 || error != 0 ||
+				        write_all(probe->sock, selector, strlen(selector)) == -1 ||
+				        write_all(probe->sock, CRLF, strlen(CRLF)) == -1) {
+					failed = TRUE;
+				} else {
+					probe->connected = TRUE;
+					fetch_timing_mark(probe->timing, FETCH_CONNECTED);
+				}
+			} else if (probe->connected && FD_ISSET(probe->sock, &read_fds)) {
+				/* An empty answer is an answer too. */
+				n = recv(probe->sock, &byte, 1, MSG_PEEK);
+				if (n >= 0) {
+					winner = i;
+				} else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+					failed = TRUE;
+				}
+			}
+			if (winner == -1 && !failed &&
+			        now - probe->started_ms >= (probe->connected ? READ_TIMEOUT_MS : CONNECT_TIMEOUT_MS)) {
+				failed = TRUE;
+			}
+			if (failed) {
+				telemetry_record(mirror->host, mirror->port, selector, TRUE, now - probe->started_ms, 0);
+				link_probe_close(probe, FETCH_FAILED, 0);
+				active--;
+				next_start_ms = now;
+			}
+		}
+	}
+
+	if (winner == -1) {
+		for (i = 0; i < MIRROR_RACERS; i++) {
+			if (probes[i].item != -1) link_probe_close(&probes[i], FETCH_CANCELLED, 0);
+		}
+		return NULL;
+	}
+
+	/* Losers only tell that they would have taken longer than the winner. */
+	waited = now - probes[winner].started_ms;
+	for (i = 0; i < MIRROR_RACERS; i++) {
+		if (i != winner && probes[i].item != -1) {
+			if (now - probes[i].started_ms >= waited) {
+				mirror_sample(&g_mirrors[probes[i].item], now - probes[i].started_ms);
+			}
+			link_probe_close(&probes[i], FETCH_CANCELLED, 0);
+		}
+	}
+
+	mirror = &g_mirrors[probes[winner].item];
+	mirror_sample(mirror, waited);
+	fetch_timing_mark(probes[winner].timing, FETCH_FIRST_BYTE);
+	fetch_timing_mark(timing, FETCH_FIRST_BYTE);
+	fcntl(probes[winner].sock, F_SETFL, fcntl(probes[winner].sock, F_GETFL, 0) & ~O_NONBLOCK);
+	tv.tv_sec = READ_TIMEOUT_MS / 1000;
+	tv.tv_usec = 0;
+	setsockopt(probes[winner].sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	g_fetch_timing_current = probes[winner].timing;
+	response = receive_gopher_data(probes[winner].sock, length_out);
+	g_fetch_timing_current = 0;
+	if (response || budget_allows(FETCH_PRIORITY_PAGE)) {
+		telemetry_record(mirror->host, mirror->port, selector, response == NULL,
+		                 get_elapsed_ms() - probes[winner].started_ms, response ? (unsigned long)*length_out : 0);
+	}
+	link_probe_close(&probes[winner], response ? FETCH_DONE : FETCH_FAILED, response ? (unsigned long)*length_out : 0);
+	return response;
+}
+
+/* Formats a byte count compactly, e.g. "512B", "4.2K" or "31M". */
+void format_size(unsigned long bytes, char *out) {
+	if (bytes < 1024UL) {
+		sprintf(out, "%luB", bytes);
+	} else if (bytes < 10UL * 1024UL) {
+		sprintf(out, "%lu.%luK", bytes / 1024UL, (bytes % 1024UL) * 10UL / 1024UL);
+	} else if (bytes < 1024UL * 1024UL) {
+		sprintf(out, "%luK", bytes / 1024UL);
+	} else if (bytes < 10UL * 1024UL * 1024UL) {
+		sprintf(out, "%lu.%luM", bytes / (1024UL * 1024UL), (bytes % (1024UL * 1024UL)) * 10UL / (1024UL * 1024UL));
+	} else {
+		sprintf(out, "%luM", bytes / (1024UL * 1024UL));
+	}
+}
+
+/* Describes what is known about a link, falling back to its host.
+ * Returns the color to print the annotation in, or NULL if nothing is known. */
+const char *format_telemetry_annotation(const GopherItem *item, char *out) {
+	const FetchTelemetry *link = telemetry_slot(g_link_telemetry, TELEMETRY_LINK_SLOTS, item->link_hash, FALSE);
+	const FetchTelemetry *host = telemetry_slot(g_host_telemetry, TELEMETRY_HOST_SLOTS, item->host_hash, FALSE);
+	char size[16];
+	char limit[8] = "";
+
+	if (host && host->failed) {
+		strcpy(out, "[host down]");
+		return DEAD_HOST_COLOR;
+	}
+	if (link && link->failed) {
+		strcpy(out, "[failed]");
+		return DEAD_HOST_COLOR;
+	}
+	if (host && host->concurrency) {
+		sprintf(limit, " x%d", host->concurrency); /* Tuned parallel fetch limit. */
+	}
+	if (link) {
+		format_size(link->size, size);
+		sprintf(out, "[%lums %s%s]", link->latency_ms, size, limit);
+		return link->latency_ms >= SLOW_FETCH_MS ? SLOW_HOST_COLOR : TELEMETRY_COLOR;
+	}
+	if (host) {
+		sprintf(out, "[host %lums%s]", host->latency_ms, limit);
+		return host->latency_ms >= SLOW_FETCH_MS ? SLOW_HOST_COLOR : TELEMETRY_COLOR;
+	}
+	return NULL;
+}
+
+/* Describes the link checker's verdict on an item.
+ * Returns the color to print it in, or NULL if the item was not checked. */
+const char *format_check_annotation(unsigned char flags, const GopherItem *item, char *out) {
+	const FetchTelemetry *link = telemetry_slot(g_link_telemetry, TELEMETRY_LINK_SLOTS, item->link_hash, FALSE);
+	unsigned long latency_ms = link ? link->probe_ms : 0;
+
+	if (flags & ITEM_DEAD) {
+		strcpy(out, "[dead]");
+		return DEAD_HOST_COLOR;
+	}
+	if (flags & ITEM_SLOW) {
+		sprintf(out, "[slow %lums]", latency_ms);
+		return SLOW_HOST_COLOR;
+	}
+	if (flags & ITEM_LIVE) {
+		sprintf(out, "[live %lums]", latency_ms);
+		return TELEMETRY_COLOR;
+	}
+	if (flags & (ITEM_QUEUED | ITEM_CHECKING)) {
+		strcpy(out, "[...]");
+		return INFO_COLOR;
+	}
+	return NULL;
+}
+
+/* Takes or releases a POSIX record lock, waiting for it if needed.
+ * A zero length covers the whole file. */
+void lock_file_range(int fd, int lock_type, off_t start, off_t length) {
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = lock_type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = start;
+	fl.l_len = length;
+	while (fcntl(fd, F_SETLKW, &fl) == -1 && errno == EINTR);
+}
+
+/* Takes or releases the lock over the segment header.
+ * Only writers serialize on it; lookups never lock. */
+void shared_cache_lock(int lock_type) {
+	lock_file_range(g_shared_cache.fd, lock_type, 0, sizeof(SharedCacheHeader));
+}
+
+/* Takes or releases the lock over one slot. Writers hold it while they
+ * rewrite the slot, so a reader holding it can send straight from it. */
+void shared_cache_lock_slot(const SharedCacheSlot *slot, int lock_type) {
+	lock_file_range(g_shared_cache.fd, lock_type, (off_t)((const char *)slot - (const char *)g_shared_cache.header),
+	                sizeof(SharedCacheSlot));
+}
+
+/* Maps the shared cache segment backed by `path`, creating it if needed. */
+BOOL shared_cache_open(const char *path) {
+	size_t size = sizeof(SharedCacheHeader) + SHARED_CACHE_SLOTS * sizeof(SharedCacheSlot);
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd == -1) {
+		return FALSE;
+	}
+	g_shared_cache.fd = fd;
+
+	/* Size and initialise the segment once, under the writer lock. */
+	shared_cache_lock(F_WRLCK);
+	if (fstat(fd, &st) == -1 || ((size_t)st.st_size < size && ftruncate(fd, size) == -1)) {
+		shared_cache_lock(F_UNLCK);
+		close(fd);
+		g_shared_cache.fd = -1;
+		return FALSE;
+	}
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		shared_cache_lock(F_UNLCK);
+		close(fd);
+		g_shared_cache.fd = -1;
+		return FALSE;
+	}
+
+	g_shared_cache.size = size;
+	g_shared_cache.header = (SharedCacheHeader *)base;
+	g_shared_cache.slots = (SharedCacheSlot *)((char *)base + sizeof(SharedCacheHeader));
+
+	if (g_shared_cache.header->magic != SHARED_CACHE_MAGIC ||
+	        g_shared_cache.header->slot_count != SHARED_CACHE_SLOTS ||
+	        g_shared_cache.header->data_size != SHARED_CACHE_DATA_SIZE) {
+		memset(base, 0, size);
+		g_shared_cache.header->slot_count = SHARED_CACHE_SLOTS;
+		g_shared_cache.header->data_size = SHARED_CACHE_DATA_SIZE;
+		g_shared_cache.header->magic = SHARED_CACHE_MAGIC;
+	}
+	shared_cache_lock(F_UNLCK);
+	return TRUE;
+}
+
+/* Unmaps the shared cache segment, if one is open. */
+void shared_cache_close(void) {
+	if (g_shared_cache.header) {
+		munmap((void *)g_shared_cache.header, g_shared_cache.size);
+		g_shared_cache.header = NULL;
+		g_shared_cache.slots = NULL;
+	}
+	if (g_shared_cache.fd != -1) {
+		close(g_shared_cache.fd);
+		g_shared_cache.fd = -1;
+	}
+}
+
+/* Returns a private copy of a fresh cached page, or NULL on a miss. */
+char *shared_cache_lookup(const char *key, size_t *length_out) {
+	unsigned long key_hash = hash_bytes(key, strlen(key));
+	unsigned long sequence;
+	SharedCacheSlot *slot;
+	char *copy;
+	size_t length;
+	int i;
+
+	if (!g_shared_cache.slots) {
+		return NULL;
+	}
+
+	for (i = 0; i < SHARED_CACHE_PROBES; ++i) {
+		slot = &g_shared_cache.slots[(key_hash + i) % SHARED_CACHE_SLOTS];
+		sequence = slot->sequence;
+		if ((sequence & 1) || slot->key_hash != key_hash || strcmp(slot->key, key) != 0) {
+			continue;
+		}
+		/* In data-saver mode a stale copy still beats a refetch. */
+		if (!g_budget_bytes && time(NULL) - slot->stored_at > SHARED_CACHE_TTL) {
+			return NULL;
+		}
+
+		length = slot->length;
+		if (length >= SHARED_CACHE_DATA_SIZE) {
+			continue;
+		}
+		copy = malloc(length + 1);
+		if (!copy) {
+			return NULL;
+		}
+		memcpy(copy, slot->data, length);
+		copy[length] = '\0';
+
+		/* Discard the copy if a writer touched the slot meanwhile. */
+		if (slot->sequence != sequence || hash_bytes(copy, length) != slot->body_hash) {
+			free(copy);
+			return NULL;
+		}
+		slot->last_used = ++g_shared_cache.header->clock;
+		*length_out = length;
+		return copy;
+	}
+	return NULL;
+}
+
+/* Publishes a page to the other processes, evicting the least recently used
+ * slot in the key's probe window when no free one is left. */
+void shared_cache_store(const char *key, const char *data, size_t length) {
+	unsigned long key_hash = hash_bytes(key, strlen(key));
+	SharedCacheSlot *slot;
+	SharedCacheSlot *victim = NULL;
+	int i;
+
+	if (!g_shared_cache.slots || length >= SHARED_CACHE_DATA_SIZE || strlen(key) >= MAX_CACHE_KEY_LENGTH) {
+		return;
+	}
+
+	shared_cache_lock(F_WRLCK);
+	for (i = 0; i < SHARED_CACHE_PROBES; ++i) {
+		slot = &g_shared_cache.slots[(key_hash + i) % SHARED_CACHE_SLOTS];
+		if (slot->key_hash == key_hash && strcmp(slot->key, key) == 0) {
+			victim = slot;
+			break;
+		}
+		if (victim && victim->length == 0) {
+			continue; /* Keep the first free slot. */
+		}
+		if (!victim || slot->length == 0 || slot->last_used < victim->last_used) {
+			victim = slot;
+		}
+	}
+
+	shared_cache_lock_slot(victim, F_WRLCK);
+	victim->sequence++;
+	victim->key_hash = key_hash;
+	strcpy(victim->key, key);
+	memcpy(victim->data, data, length);
+	victim->length = length;
+	victim->body_hash = hash_bytes(data, length);
+	victim->stored_at = (long)time(NULL);
+	victim->last_used = ++g_shared_cache.header->clock;
+	victim->sequence++;
+	shared_cache_lock_slot(victim, F_UNLCK);
+	shared_cache_lock(F_UNLCK);
+}
+
+/* Writes a fresh cached body straight to `out_fd` without copying it
+ * through this process, using sendfile() where available. The slot's read
+ * lock keeps writers out for the duration of the transfer. */
+BOOL shared_cache_send(const char *key, int out_fd) {
+	unsigned long key_hash = hash_bytes(key, strlen(key));
+	SharedCacheSlot *slot;
+	BOOL sent = FALSE;
+	int i;
+
+	if (!g_shared_cache.slots) {
+		return FALSE;
+	}
+
+	for (i = 0; i < SHARED_CACHE_PROBES && !sent; ++i) {
+		slot = &g_shared_cache.slots[(key_hash + i) % SHARED_CACHE_SLOTS];
+		if (slot->key_hash != key_hash) {
+			continue;
+		}
+
+		shared_cache_lock_slot(slot, F_RDLCK);
+		if (slot->key_hash == key_hash && strcmp(slot->key, key) == 0 &&
+		        time(NULL) - slot->stored_at <= SHARED_CACHE_TTL && slot->length < SHARED_CACHE_DATA_SIZE) {
+#ifdef __linux__
+			off_t offset = (off_t)(slot->data - (char *)g_shared_cache.header);
+			size_t remaining = slot->length;
+			ssize_t n = 0;
+
+			while (remaining > 0 && (n = sendfile(out_fd, g_shared_cache.fd, &offset, remaining)) > 0) {
+				remaining -= n;
+			}
+			sent = (remaining == 0);
+#else
+			sent = (write_all(out_fd, slot->data, slot->length) == (int)slot->length);
+#endif
+			slot->last_used = ++g_shared_cache.header->clock;
+		}
+		shared_cache_lock_slot(slot, F_UNLCK);
+	}
+	return sent;
+}
+
+/* Builds the path of `name` inside the data directory ($TOCAIA_HOME, or
+ * ~/.tocaia), creating the directory if needed. */
+BOOL get_data_path(const char *name, char *out) {
+	const char *base = getenv("TOCAIA_HOME");
+	const char *home;
+
+	if (base && base[0] != '\0') {
+		if (strlen(base) + strlen(name) + 2 >= MAX_PATH_LENGTH) return FALSE;
+		sprintf(out, "%s", base);
+	} else {
+		home = getenv("HOME");
+		if (!home || home[0] == '\0' || strlen(home) + strlen(name) + 10 >= MAX_PATH_LENGTH) {
+			return FALSE;
+		}
+		sprintf(out, "%s/.tocaia", home);
+	}
+	if (mkdir(out, 0700) == -1 && errno != EEXIST) {
+		return FALSE;
+	}
+	strcat(out, "/");
+	strcat(out, name);
+	return TRUE;
+}
+
+/* Stores a 32-bit value big-endian, so index files are portable. */
+void put_u32(unsigned char *p, unsigned long value) {
+	p[0] = (unsigned char)((value >> 24) & 0xff);
+	p[1] = (unsigned char)((value >> 16) & 0xff);
+	p[2] = (unsigned char)((value >> 8) & 0xff);
+	p[3] = (unsigned char)(value & 0xff);
+}
+
+/* Loads a 32-bit big-endian value. */
+unsigned long get_u32(const unsigned char *p) {
+	return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+	       ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+}
+
+/* Copies the next lowercased word at `*cursor` into `token` and advances
+ * the cursor. Words are runs of ASCII letters and digits plus any non-ASCII
+ * bytes, so UTF-8 text is kept whole. Returns 0 at the end of the input. */
+size_t next_token(const char **cursor, const char *end, char *token) {
+	const char *p = *cursor;
+	size_t len;
+
+	for (;;) {
+		while (p < end && !isalnum((unsigned char)*p) && !((unsigned char)*p & 0x80)) p++;
+		if (p >= end) {
+			*cursor = p;
+			return 0;
+		}
+		len = 0;
+		while (p < end && (isalnum((unsigned char)*p) || ((unsigned char)*p & 0x80))) {
+			if (len < MAX_TOKEN_LENGTH) {
+				token[len] = (char)tolower((unsigned char)*p);
+			}
+			len++;
+			p++;
+		}
+		if (len >= MIN_TOKEN_LENGTH && len <= MAX_TOKEN_LENGTH) {
+			token[len] = '\0';
+			*cursor = p;
+			return len;
+		}
+	}
+}
+
+/* Picks a title for a page: its first informational line for a menu,
+ * its first non-blank line otherwise. */
+void extract_page_title(const char *content, BOOL is_menu, char *title) {
+	const char *line = content;
+	size_t len = 0;
+	size_t i;
+
+	title[0] = '\0';
+	while (*line != '\0') {
+		const char *end = line + strcspn(line, is_menu ? "\t\r\n" : "\r\n");
+		const char *start = line;
+
+		if (is_menu) {
+			start = (*line == 'i') ? line + 1 : end;
+		}
+		while (start < end && isspace((unsigned char)*start)) start++;
+		if (start < end) {
+			len = end - start;
+			if (len > MAX_TITLE_LENGTH) len = MAX_TITLE_LENGTH;
+			memcpy(title, start, len);
+			title[len] = '\0';
+			break;
+		}
+		line += strcspn(line, "\n");
+		if (*line == '\n') line++;
+	}
+	for (i = 0; i < len; ++i) {
+		if (title[i] == '\t' || (unsigned char)title[i] < ' ') title[i] = ' ';
+	}
+}
+
+/* Prepares the index directory. Failure silently disables indexing. */
+BOOL search_index_open(void) {
+	if (g_search_index.tried_open) {
+		return g_search_index.available;
+	}
+	g_search_index.tried_open = TRUE;
+
+	if (!get_data_path("index", g_search_index.dir)) {
+		return FALSE;
+	}
+	if (mkdir(g_search_index.dir, 0700) == -1 && errno != EEXIST) {
+		return FALSE;
+	}
+	g_search_index.available = TRUE;
+	return TRUE;
+}
+
+/* Finds the newest indexed version of a URL, optionally adding a slot. */
+IndexedUrl *search_index_url(unsigned long url_hash, BOOL create) {
+	SearchIndex *index = &g_search_index;
+	unsigned long i;
+
+	if (create && (index->url_count + 1) * 2 > index->url_capacity) {
+		IndexedUrl *old = index->urls;
+		unsigned long old_capacity = index->url_capacity;
+
+		index->url_capacity = old_capacity ? old_capacity * 2 : 1024;
+		index->urls = calloc(index->url_capacity, sizeof(IndexedUrl));
+		if (!index->urls) {
+			die("Error: Failed to allocate memory for the search index.");
+		}
+		index->url_count = 0;
+		for (i = 0; i < old_capacity; ++i) {
+			if (old[i].in_use) {
+				*search_index_url(old[i].url_hash, TRUE) = old[i];
+			}
+		}
+		free(old);
+	}
+	if (!index->urls) {
+		return NULL;
+	}
+
+	for (i = url_hash & (index->url_capacity - 1); index->urls[i].in_use; i = (i + 1) & (index->url_capacity - 1)) {
+		if (index->urls[i].url_hash == url_hash) {
+			return &index->urls[i];
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	index->urls[i].in_use = TRUE;
+	index->urls[i].url_hash = url_hash;
+	index->url_count++;
+	return &index->urls[i];
+}
+
+/* Loads the docs.idx records appended since the last sync, including those
+ * written by other processes. The caller holds a lock on `idx_fd`. */
+void search_index_sync(int idx_fd) {
+	SearchIndex *index = &g_search_index;
+	unsigned char record[INDEX_DOC_RECORD];
+	struct stat st;
+	unsigned long total;
+	IndexedUrl *url;
+
+	if (fstat(idx_fd, &st) == -1) {
+		return;
+	}
+	total = (unsigned long)st.st_size / INDEX_DOC_RECORD;
+	if (total <= index->doc_count) {
+		return;
+	}
+
+	if (total > index->doc_capacity) {
+		index->doc_capacity = total + total / 2 + 64;
+		index->doc_lengths = realloc(index->doc_lengths, index->doc_capacity * sizeof(unsigned long));
+		index->doc_urls = realloc(index->doc_urls, index->doc_capacity * sizeof(unsigned long));
+		if (!index->doc_lengths || !index->doc_urls) {
+			die("Error: Failed to allocate memory for the search index.");
+		}
+	}
+
+	while (index->doc_count < total) {
+		if (pread(idx_fd, record, INDEX_DOC_RECORD, (off_t)index->doc_count * INDEX_DOC_RECORD) != INDEX_DOC_RECORD) {
+			break;
+		}
+		index->doc_lengths[index->doc_count] = get_u32(record + 4);
+		index->doc_urls[index->doc_count] = get_u32(record + 8);
+		index->total_tokens += get_u32(record + 4);
+
+		url = search_index_url(get_u32(record + 8), TRUE);
+		url->content_hash = get_u32(record + 12);
+		url->doc_id = index->doc_count;
+		index->doc_count++;
+	}
+}
+
+/* Compares term counts by posting bucket. */
+int compare_term_bucket(const void *a, const void *b) {
+	unsigned long bucket_a = ((const TermCount *)a)->term & (INDEX_BUCKETS - 1);
+	unsigned long bucket_b = ((const TermCount *)b)->term & (INDEX_BUCKETS - 1);
+	return (bucket_a > bucket_b) - (bucket_a < bucket_b);
+}
+
+/* Adds a fetched page to the index unless this exact version is there. */
+void search_index_page(const NavigationState *nav, const char *content, size_t length, BOOL is_menu) {
+	char path[MAX_PATH_LENGTH + 16];
+	char key[MAX_CACHE_KEY_LENGTH];
+	char title[MAX_TITLE_LENGTH + 1];
+	char token[MAX_TOKEN_LENGTH + 1];
+	char doc_line[MAX_URL_INPUT_LENGTH + MAX_TITLE_LENGTH + 16];
+	const char *line_end;
+	unsigned char record[INDEX_DOC_RECORD];
+	unsigned char *postings;
+	unsigned long url_hash, content_hash, term;
+	unsigned long tokens = 0, unique = 0, capacity = 256, slot, doc_id;
+	const char *cursor, *end;
+	TermCount *terms;
+	IndexedUrl *url;
+	off_t docs_offset;
+	size_t i, run, token_len;
+	int idx_fd, docs_fd, fd;
+
+	if (!search_index_open()) {
+		return;
+	}
+
+	make_cache_key(nav->host, nav->port, nav->selector, key);
+	url_hash = hash_bytes(key, strlen(key));
+	content_hash = hash_bytes(content, length);
+
+	sprintf(path, "%s/docs.idx", g_search_index.dir);
+	idx_fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (idx_fd == -1) {
+		return;
+	}
+	lock_file_range(idx_fd, F_WRLCK, 0, 0);
+
+	search_index_sync(idx_fd);
+	url = search_index_url(url_hash, FALSE);
+	if ((url && url->content_hash == content_hash) || g_search_index.doc_count >= INDEX_MAX_DOCS) {
+		close(idx_fd); /* Closing drops the lock. */
+		return;
+	}
+
+	/* Count the page's terms. Menus contribute only their display strings. */
+	terms = calloc(capacity, sizeof(TermCount));
+	if (!terms) {
+		die("Error: Failed to allocate memory for the search index.");
+	}
+	cursor = content;
+	while (cursor < content + length) {
+		end = cursor;
+		while (end < content + length && *end != '\n') end++;
+		line_end = end;
+		if (is_menu) {
+			const char *tab = cursor;
+			while (tab < end && *tab != '\t') tab++;
+			end = tab;
+			if (cursor < end) cursor++; /* Skip the item type. */
+		}
+		while ((token_len = next_token(&cursor, end, token)) > 0) {
+			term = hash_bytes(token, token_len);
+			if ((unique + 1) * 2 > capacity) {
+				TermCount *grown = calloc(capacity * 2, sizeof(TermCount));
+				if (!grown) {
+					die("Error: Failed to allocate memory for the search index.");
+				}
+				for (i = 0; i < capacity; ++i) {
+					if (terms[i].count == 0) continue;
+					for (slot = terms[i].term & (capacity * 2 - 1); grown[slot].count; slot = (slot + 1) & (capacity * 2 - 1));
+					grown[slot] = terms[i];
+				}
+				free(terms);
+				terms = grown;
+				capacity *= 2;
+			}
+			for (slot = term & (capacity - 1); terms[slot].count && terms[slot].term != term; slot = (slot + 1) & (capacity - 1));
+			if (terms[slot].count == 0) {
+				terms[slot].term = term;
+				unique++;
+			}
+			terms[slot].count++;
+			tokens++;
+		}
+		cursor = line_end + 1;
+	}
+
+	/* Compact the table and group the terms by posting file. */
+	for (i = 0, slot = 0; slot < capacity; ++slot) {
+		if (terms[slot].count) terms[i++] = terms[slot];
+	}
+	qsort(terms, unique, sizeof(TermCount), compare_term_bucket);
+
+	/* Append the document line, then its docs.idx record, then postings. */
+	sprintf(path, "%s/docs", g_search_index.dir);
+	docs_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (docs_fd == -1) {
+		free(terms);
+		close(idx_fd);
+		return;
+	}
+	extract_page_title(content, is_menu, title);
+	if (title[0] == '\0') {
+		sprintf(title, "%.*s", MAX_TITLE_LENGTH, nav->selector[0] ? nav->selector : nav->host);
+	}
+	docs_offset = lseek(docs_fd, 0, SEEK_END);
+	/* A bare "gopher://host/" address leaves the type unset. */
+	sprintf(doc_line, "%c\t%s\t%d\t%s\t%s\n", is_menu ? '1' : (nav->type ? nav->type : '0'),
+	        nav->host, nav->port, nav->selector, title);
+	write_all(docs_fd, doc_line, strlen(doc_line));
+	close(docs_fd);
+
+	doc_id = g_search_index.doc_count;
+	put_u32(record, (unsigned long)docs_offset);
+	put_u32(record + 4, tokens);
+	put_u32(record + 8, url_hash);
+	put_u32(record + 12, content_hash);
+	pwrite(idx_fd, record, INDEX_DOC_RECORD, (off_t)doc_id * INDEX_DOC_RECORD);
+
+	postings = malloc(unique * INDEX_POSTING_RECORD + 1);
+	if (!postings) {
+		die("Error: Failed to allocate memory for the search index.");
+	}
+	for (i = 0; i < unique; i += run) {
+		unsigned long bucket = terms[i].term & (INDEX_BUCKETS - 1);
+		for (run = 0; i + run < unique && (terms[i + run].term & (INDEX_BUCKETS - 1)) == bucket; ++run) {
+			unsigned char *p = postings + run * INDEX_POSTING_RECORD;
+			put_u32(p, terms[i + run].term);
+			put_u32(p + 4, (doc_id << 8) | (terms[i + run].count > 255 ? 255 : terms[i + run].count));
+		}
+		sprintf(path, "%s/p%02lx", g_search_index.dir, bucket);
+		fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+		if (fd != -1) {
+			write_all(fd, (const char *)postings, run * INDEX_POSTING_RECORD);
+			close(fd);
+		}
+	}
+	free(postings);
+	free(terms);
+
+	search_index_sync(idx_fd);
+	close(idx_fd);
+}
+
+/* Cheap log2 for ranking, avoiding a libm dependency. */
+double approx_log2(double x) {
+	double result = 0.0;
+
+	while (x >= 2.0) {
+		x /= 2.0;
+		result += 1.0;
+	}
+	return result + (x - 1.0);
+}
+
+/* Ranks indexed pages against a query with BM25 and renders the best
+ * matches as a Gopher menu. Only the posting files of the query's terms
+ * are read, and only the newest version of each URL is listed. */
+char *search_index_query(const char *query) {
+	SearchIndex *index = &g_search_index;
+	unsigned long terms[INDEX_MAX_QUERY_TERMS];
+	unsigned long best[INDEX_MAX_RESULTS];
+	unsigned char chunk[INDEX_POSTING_RECORD * 4096];
+	char token[MAX_TOKEN_LENGTH + 1];
+	char path[MAX_PATH_LENGTH + 16];
+	char line[MAX_URL_INPUT_LENGTH + MAX_TITLE_LENGTH + 16];
+	const char *cursor = query;
+	unsigned long *matches = NULL;
+	unsigned long match_capacity = 0, match_count, doc, value;
+	int term_count = 0, best_count = 0, i, j, fd, idx_fd;
+	size_t token_len, used = 0, capacity, needed;
+	double average_length, idf, tf;
+	float *scores;
+	char *page;
+	ssize_t n;
+	IndexedUrl *url;
+
+	while (term_count < INDEX_MAX_QUERY_TERMS && (token_len = next_token(&cursor, query + strlen(query), token)) > 0) {
+		terms[term_count++] = hash_bytes(token, token_len);
+	}
+
+	if (search_index_open()) {
+		sprintf(path, "%s/docs.idx", index->dir);
+		fd = open(path, O_RDONLY);
+		if (fd != -1) {
+			lock_file_range(fd, F_RDLCK, 0, 0);
+			search_index_sync(fd);
+			close(fd);
+		}
+	}
+
+	scores = index->doc_count ? calloc(index->doc_count, sizeof(float)) : NULL;
+	average_length = index->doc_count ? (double)index->total_tokens / index->doc_count : 1.0;
+	if (average_length < 1.0) average_length = 1.0;
+
+	for (i = 0; scores && i < term_count; ++i) {
+		sprintf(path, "%s/p%02lx", index->dir, terms[i] & (INDEX_BUCKETS - 1));
+		fd = open(path, O_RDONLY);
+		if (fd == -1) continue;
+
+		match_count = 0;
+		while ((n = read(fd, chunk, sizeof(chunk))) >= INDEX_POSTING_RECORD) {
+			for (j = 0; j + INDEX_POSTING_RECORD <= n; j += INDEX_POSTING_RECORD) {
+				if (get_u32(chunk + j) != terms[i]) continue;
+				value = get_u32(chunk + j + 4);
+				if ((value >> 8) >= index->doc_count) continue;
+				if (match_count >= match_capacity) {
+					match_capacity = match_capacity ? match_capacity * 2 : 1024;
+					matches = realloc(matches, match_capacity * sizeof(unsigned long));
+					if (!matches) die("Error: Failed to allocate memory for search results.");
+				}
+				matches[match_count++] = value;
+			}
+		}
+		close(fd);
+
+		/* BM25 with k1 = 1.2 and b = 0.75. */
+		idf = approx_log2(1.0 + (index->doc_count - match_count + 0.5) / (match_count + 0.5));
+		for (value = 0; value < match_count; ++value) {
+			doc = matches[value] >> 8;
+			tf = (double)(matches[value] & 0xff);
+			scores[doc] += (float)(idf * tf * 2.2 /
+			                       (tf + 1.2 * (0.25 + 0.75 * index->doc_lengths[doc] / average_length)));
+		}
+	}
+	free(matches);
+
+	/* Keep the best-scoring current version of each URL. */
+	for (doc = 0; scores && doc < index->doc_count; ++doc) {
+		if (scores[doc] <= 0.0f) continue;
+		url = search_index_url(index->doc_urls[doc], FALSE);
+		if (!url || url->doc_id != doc) continue;
+		for (i = best_count; i > 0 && scores[best[i - 1]] < scores[doc]; --i) {
+			if (i < INDEX_MAX_RESULTS) best[i] = best[i - 1];
+		}
+		if (i < INDEX_MAX_RESULTS) {
+			best[i] = doc;
+			if (best_count < INDEX_MAX_RESULTS) best_count++;
+		}
+	}
+
+	capacity = (best_count + 2) * sizeof(line);
+	page = malloc(capacity);
+	if (!page) {
+		die("Error: Failed to allocate memory for search results.");
+	}
+	used += sprintf(page, "i%d matching pages for \"%.*s\"\t\tnull.host\t1\r\ni\t\tnull.host\t1\r\n",
+	                best_count, MAX_TITLE_LENGTH, query);
+
+	sprintf(path, "%s/docs", index->dir);
+	fd = best_count ? open(path, O_RDONLY) : -1;
+	sprintf(path, "%s/docs.idx", index->dir);
+	idx_fd = best_count ? open(path, O_RDONLY) : -1;
+	for (i = 0; fd != -1 && idx_fd != -1 && i < best_count; ++i) {
+		unsigned char record[INDEX_DOC_RECORD];
+		char *fields[5];
+		int field;
+
+		if (pread(idx_fd, record, INDEX_DOC_RECORD, (off_t)best[i] * INDEX_DOC_RECORD) != INDEX_DOC_RECORD) {
+			continue;
+		}
+
+		n = pread(fd, line, sizeof(line) - 1, (off_t)get_u32(record));
+		if (n <= 0) continue;
+		line[n] = '\0';
+		line[strcspn(line, "\n")] = '\0';
+
+		fields[0] = line;
+		for (field = 1; field < 5; ++field) {
+			fields[field] = strchr(fields[field - 1], '\t');
+			if (!fields[field]) break;
+			*fields[field]++ = '\0';
+		}
+		if (field < 5) continue;
+
+		/* The row repeats the host, so it can outgrow the docs line. */
+		needed = (size_t)n + strlen(fields[1]) + 16;
+		if (used + needed >= capacity) {
+			capacity = capacity * 2 + needed;
+			page = realloc(page, capacity);
+			if (!page) {
+				die("Error: Failed to allocate memory for search results.");
+			}
+		}
+		used += sprintf(page + used, "%c%s (%s)\t%s\t%s\t%s\r\n",
+		                fields[0][0], fields[4], fields[1], fields[3], fields[1], fields[2]);
+	}
+	if (fd != -1) close(fd);
+	if (idx_fd != -1) close(idx_fd);
+	free(scores);
+	return page;
+}
+
+/* Appends a page load to the history log and its signature record to
+ * history.idx. Pages reached through a link keep the link's display
+ * string as their title; others are titled like in the search index. */
+void history_record(const NavigationState *nav, BOOL is_menu) {
+	char path[MAX_PATH_LENGTH];
+	char key[MAX_CACHE_KEY_LENGTH];
+	char title[MAX_TITLE_LENGTH + 1];
+	char line[MAX_URL_INPUT_LENGTH + MAX_TITLE_LENGTH + 32];
+	unsigned char record[HISTORY_RECORD];
+	struct stat st;
+	off_t offset;
+	int idx_fd;
+	int log_fd;
+	size_t i;
+
+	if (!get_data_path("history.idx", path) || (idx_fd = open(path, O_RDWR | O_CREAT, 0600)) == -1) {
+		return;
+	}
+	lock_file_range(idx_fd, F_WRLCK, 0, 0);
+	if (!get_data_path("history", path) || (log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600)) == -1) {
+		close(idx_fd);
+		return;
+	}
+
+	strcpy(title, nav->title);
+	if (title[0] == '\0') {
+		extract_page_title(nav->page_content, is_menu, title);
+	}
+	if (title[0] == '\0') {
+		sprintf(title, "%.*s", MAX_TITLE_LENGTH, nav->selector[0] ? nav->selector : nav->host);
+	}
+	for (i = 0; title[i]; i++) {
+		if ((unsigned char)title[i] < ' ') title[i] = ' ';
+	}
+
+	offset = lseek(log_fd, 0, SEEK_END);
+	sprintf(line, "%lu\t%c\t%s\t%d\t%s\t%s\n", (unsigned long)time(NULL),
+	        is_menu ? '1' : (nav->type ? nav->type : '0'), nav->host, nav->port, title, nav->selector);
+	if (write_all(log_fd, line, strlen(line)) == (int)strlen(line) && fstat(idx_fd, &st) == 0) {
+		make_cache_key(nav->host, nav->port, nav->selector, key);
+		memset(record, 0, sizeof(record));
+		put_u32(record, (unsigned long)offset);
+		put_u32(record + 4, hash_bytes(key, strlen(key)));
+		history_signature(title, strlen(title), record + 8);
+		history_signature(nav->host, strlen(nav->host), record + 8);
+		history_signature(nav->selector, strlen(nav->selector), record + 8);
+		pwrite(idx_fd, record, HISTORY_RECORD, st.st_size - st.st_size % HISTORY_RECORD);
+	}
+	close(log_fd);
+	close(idx_fd); /* Closing drops the lock. */
+}
+
+/* Sets the signature bit of every trigram within the words of `text`,
+ * lowercased. Words are split like next_token() does. */
+void history_signature(const char *text, size_t length, unsigned char *signature) {
+	char trigram[3];
+	unsigned long bit;
+	size_t run = 0;
+	size_t i;
+
+	memset(trigram, 0, sizeof(trigram));
+	for (i = 0; i < length; i++) {
+		unsigned char c = (unsigned char)text[i];
+
+		if (!isalnum(c) && !(c & 0x80)) {
+			run = 0;
+			continue;
+		}
+		trigram[0] = trigram[1];
+		trigram[1] = trigram[2];
+		trigram[2] = (char)tolower(c);
+		if (++run >= 3) {
+			bit = hash_bytes(trigram, 3) & (HISTORY_SIGNATURE_BITS - 1);
+			signature[bit / 8] |= (unsigned char)(1 << (bit % 8));
+		}
+	}
+}
+
+/* Maps the history log and its index for the finder.
+ * Returns FALSE if there is no history yet. */
+BOOL history_open(HistoryFinder *finder) {
+	char path[MAX_PATH_LENGTH];
+	struct stat st;
+	void *map;
+	int fd;
+
+	memset(finder, 0, sizeof(*finder));
+	if (!get_data_path("history.idx", path) || (fd = open(path, O_RDONLY)) == -1) {
+		return FALSE;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size >= HISTORY_RECORD) {
+		finder->record_count = (unsigned long)st.st_size / HISTORY_RECORD;
+		map = mmap(NULL, finder->record_count * HISTORY_RECORD, PROT_READ, MAP_PRIVATE, fd, 0);
+		finder->records = (map == MAP_FAILED) ? NULL : map;
+	}
+	close(fd);
+
+	if (finder->records && get_data_path("history", path) && (fd = open(path, O_RDONLY)) != -1) {
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED) {
+				finder->log = map;
+				finder->log_length = st.st_size;
+			}
+		}
+		close(fd);
+	}
+	if (!finder->log) {
+		history_close(finder);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Unmaps what history_open() mapped. */
+void history_close(HistoryFinder *finder) {
+	if (finder->records) {
+		munmap((void *)finder->records, finder->record_count * HISTORY_RECORD);
+	}
+	if (finder->log) {
+		munmap((void *)finder->log, finder->log_length);
+	}
+	free(finder->seen.slots);
+	memset(finder, 0, sizeof(*finder));
+}
+
+/* Collects the distinct trigrams within the words of `text`, lowercased
+ * like history_signature() sees them, as NUL-terminated strings 4 bytes
+ * apart. Returns how many there are, at most `max_count`. */
+int history_trigrams(const char *text, char *trigrams, int max_count) {
+	char trigram[4];
+	size_t run = 0;
+	int count = 0;
+	int j;
+
+	memset(trigram, 0, sizeof(trigram));
+	for (; *text && count < max_count; text++) {
+		unsigned char c = (unsigned char)*text;
+
+		if (!isalnum(c) && !(c & 0x80)) {
+			run = 0;
+			continue;
+		}
+		trigram[0] = trigram[1];
+		trigram[1] = trigram[2];
+		trigram[2] = (char)tolower(c);
+		if (++run < 3) continue;
+		for (j = 0; j < count && memcmp(trigrams + j * 4, trigram, 3) != 0; j++);
+		if (j == count) {
+			memcpy(trigrams + count++ * 4, trigram, 4);
+		}
+	}
+	return count;
+}
+
+/* Counts the trigrams a logged visit really has in its host, title or
+ * selector. Signature bits are shared by many trigrams, so only this
+ * tells a match from a collision. */
+int history_line_score(const char *line, size_t length, const char *trigrams, int count) {
+	const char *end = line + length;
+	const char *fields[6];
+	const char *tab;
+	int score = 0;
+	int field;
+	int j;
+
+	fields[0] = line;
+	for (field = 1; field < 6; field++) {
+		tab = memchr(fields[field - 1], '\t', end - fields[field - 1]);
+		if (!tab) return 0;
+		fields[field] = tab + 1;
+	}
+	for (j = 0; j < count; j++) {
+		if (contains_ignore_case(fields[2], fields[3] - 1 - fields[2], trigrams + j * 4) ||
+		        contains_ignore_case(fields[4], end - fields[4], trigrams + j * 4)) {
+			score++;
+		}
+	}
+	return score;
+}
+
+/* Ranks the visits against `query` and keeps the best `limit` of them,
+ * one per URL. A visit scores one point per query trigram its log line
+ * has and needs at least half of them, so a typo or a missing word costs
+ * points instead of the match. Only visits whose signature has the bits
+ * for enough trigrams have their line read. Ties go to the newest visit.
+ * Queries too short for a trigram are matched as substrings instead, and
+ * an empty one lists the latest visits. */
+void history_rank(HistoryFinder *finder, const char *query, int limit) {
+	char trigrams[MAX_TITLE_LENGTH * 4];
+	unsigned long bits[MAX_TITLE_LENGTH];
+	int count;
+	const unsigned char *record;
+	const char *line;
+	const char *line_end;
+	unsigned long offset;
+	unsigned long i;
+	int score;
+	int j;
+
+	count = history_trigrams(query, trigrams, MAX_TITLE_LENGTH);
+	for (j = 0; j < count; j++) {
+		bits[j] = hash_bytes(trigrams + j * 4, 3) & (HISTORY_SIGNATURE_BITS - 1);
+	}
+
+	finder->match_count = 0;
+	if (finder->seen.slots) {
+		memset(finder->seen.slots, 0, finder->seen.capacity * sizeof(unsigned long));
+		finder->seen.count = 0;
+	}
+
+	for (i = finder->record_count; i-- > 0;) {
+		/* Nothing older can beat a full list of perfect scores. */
+		if (finder->match_count == limit && finder->scores[limit - 1] >= count) {
+			break;
+		}
+		record = finder->records + i * HISTORY_RECORD;
+		offset = get_u32(record);
+		if (offset >= finder->log_length) {
+			continue;
+		}
+
+		/* The signature bounds the score from above. */
+		score = 0;
+		for (j = 0; j < count; j++) {
+			if (record[8 + bits[j] / 8] & (1 << (bits[j] % 8))) score++;
+		}
+		if (score * 2 < count || (finder->match_count == limit && score <= finder->scores[limit - 1])) {
+			continue;
+		}
+		if (query[0] != '\0') {
+			line = finder->log + offset;
+			line_end = memchr(line, '\n', finder->log_length - offset);
+			if (!line_end) {
+				continue;
+			}
+			if (count == 0) {
+				if (!contains_ignore_case(line, line_end - line, query)) continue;
+			} else {
+				score = history_line_score(line, line_end - line, trigrams, count);
+				if (score * 2 < count) continue;
+			}
+		}
+		if (finder->match_count == limit && score <= finder->scores[limit - 1]) {
+			continue;
+		}
+		if (!hash_set_add(&finder->seen, get_u32(record + 4))) {
+			continue;
+		}
+
+		/* Insert after every entry that scored at least as well. */
+		j = finder->match_count < limit ? finder->match_count++ : limit - 1;
+		for (; j > 0 && finder->scores[j - 1] < score; j--) {
+			finder->matches[j] = finder->matches[j - 1];
+			finder->scores[j] = finder->scores[j - 1];
+		}
+		finder->matches[j] = offset;
+		finder->scores[j] = score;
+	}
+}
+
+/* Reads the visit logged at `offset` into `item`, titled by its display
+ * string. Returns the time of the visit, or 0 if the line is malformed. */
+time_t history_entry(const HistoryFinder *finder, unsigned long offset, GopherItem *item) {
+	char line[MAX_URL_INPUT_LENGTH + MAX_TITLE_LENGTH + 32];
+	const char *start = finder->log + offset;
+	const char *end = memchr(start, '\n', finder->log_length - offset);
+	char *fields[6];
+	int field;
+
+	memset(item, 0, sizeof(*item));
+	if (!end || (size_t)(end - start) >= sizeof(line)) {
+		return 0;
+	}
+	memcpy(line, start, end - start);
+	line[end - start] = '\0';
+
+	fields[0] = line;
+	for (field = 1; field < 6; ++field) {
+		fields[field] = strchr(fields[field - 1], '\t');
+		if (!fields[field]) return 0;
+		*fields[field]++ = '\0';
+	}
+	if (strlen(fields[2]) >= sizeof(item->host) || strlen(fields[5]) >= sizeof(item->selector)) {
+		return 0;
+	}
+	item->type = fields[1][0];
+	strcpy(item->host, fields[2]);
+	item->port = atoi(fields[3]);
+	sprintf(item->display_string, "%.*s", MAX_TITLE_LENGTH, fields[4]);
+	strcpy(item->selector, fields[5]);
+	item->is_selectable = TRUE;
+	return (time_t)strtoul(fields[0], NULL, 10);
+}
+
+/* Case-insensitive substring test over a buffer that is not terminated. */
+BOOL contains_ignore_case(const char *text, size_t length, const char *needle) {
+	size_t needle_length = strlen(needle);
+	size_t i;
+	size_t j;
+
+	for (i = 0; i + needle_length <= length; i++) {
+		for (j = 0; j < needle_length &&
+		        tolower((unsigned char)text[i + j]) == tolower((unsigned char)needle[j]); j++);
+		if (j == needle_length) return TRUE;
+	}
+	return FALSE;
+}
+
+/* Decides whether the proxy may fetch from host:port on a client's behalf.
+ * Only Gopher's own port and the default upstream are reachable, so the
+ * proxy cannot be used to talk to other services, such as a database
+ * listening on the proxy's loopback. */
+BOOL proxy_allows(const char *host, int port, const char *default_host, int default_port) {
+	if (port == PROXY_GOPHER_PORT) return TRUE;
+	return default_host != NULL && strcmp(host, default_host) == 0 && port == default_port;
+}
+
+/* Rewrites the links of an upstream menu so that following them goes
+ * through the proxy again. Every link becomes a gopher:// URL selector,
+ * which carries the item type, so the proxy knows which replies are menus.
+ * Links the proxy would refuse to follow are left pointing at their host. */
+char *rewrite_menu_for_proxy(const char *menu, const char *proxy_host, int proxy_port, const char *default_host, int default_port) {
+	size_t capacity = strlen(menu) * 2 + 1024;
+	size_t used = 0;
+	char *out = malloc(capacity);
+	const char *line = menu;
+	char buffer[MAX_DISPLAY_LENGTH + MAX_SELECTOR_LENGTH + MAX_HOST_LENGTH + 16];
+	char *fields[4];
+	size_t len, needed;
+	int count;
+
+	if (!out) {
+		die("Error: Failed to allocate memory for the proxied menu.");
+	}
+
+	while (*line != '\0') {
+		len = strcspn(line, "\n");
+
+		/* Split well-formed links into fields; anything else passes through. */
+		count = 0;
+		if (len < sizeof(buffer) && line[0] != 'i' && line[0] != '3') {
+			memcpy(buffer, line, len);
+			buffer[len] = '\0';
+			if (len > 0 && buffer[len - 1] == '\r') buffer[len - 1] = '\0';
+			fields[0] = buffer;
+			for (count = 1; count < 4 && (fields[count] = strchr(fields[count - 1], '\t')) != NULL; ++count) {
+				*fields[count]++ = '\0';
+			}
+		}
+
+		needed = (count == 4 ? len + strlen(proxy_host) : len) + 64;
+		if (used + needed >= capacity) {
+			capacity = capacity * 2 + needed;
+			out = realloc(out, capacity);
+			if (!out) {
+				die("Error: Failed to allocate memory for the proxied menu.");
+			}
+		}
+
+		if (count == 4 && fields[2][0] != '\0' && proxy_allows(fields[2], atoi(fields[3]), default_host, default_port)) {
+			used += sprintf(out + used, "%s\tgopher://%s:%d/%c%s\t%s\t%d\r\n", fields[0], fields[2],
+			                atoi(fields[3]), fields[0][0], fields[1], proxy_host, proxy_port);
+		} else {
+			memcpy(out + used, line, len);
+			used += len;
+			if (line[len] == '\n') out[used++] = '\n';
 		}
+
+		line += len;
+		if (*line == '\n') line++;
+	}
+	out[used] = '\0';
+	return out;
+}
+
+/* Answers one proxied request. Runs in its own process. */
+void proxy_serve_client(int client, int proxy_port, const char *default_host, int default_port) {
+	char request[MAX_URL_INPUT_LENGTH + 3];
+	char key[MAX_URL_INPUT_LENGTH + 96];
+	char host[MAX_HOST_LENGTH];
+	char selector[MAX_SELECTOR_LENGTH];
+	char proxy_host[64];
+	char error[sizeof(g_fetch_error) + 32];
+	struct sockaddr_in local;
+	socklen_t local_len = sizeof(local);
+	struct timeval tv;
+	char type = '\0';
+	char *body;
+	char *reply;
+	size_t used = 0;
+	size_t length;
+	ssize_t n;
+	int port;
+
+	tv.tv_sec = READ_TIMEOUT_MS / 1000;
+	tv.tv_usec = 0;
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	while (used < sizeof(request) - 1 && (n = read(client, request + used, sizeof(request) - 1 - used)) > 0) {
+		used += n;
+		if (memchr(request, '\n', used)) break;
+	}
+	request[used] = '\0';
+	request[strcspn(request, "\r\n")] = '\0';
+
+	/* Menus link back to the address the client connected to, so each
+	 * address keeps its own copies. Repeats are answered straight from the
+	 * shared cache. */
+	proxy_host[0] = '\0';
+	if (getsockname(client, (struct sockaddr *)&local, &local_len) == 0) {
+		strcpy(proxy_host, inet_ntoa(local.sin_addr));
+	}
+	sprintf(key, "proxy\t%s\t%s", proxy_host, request);
+	if (shared_cache_send(key, client)) {
+		fprintf(stderr, "hit   %s\n", request);
+		return;
+	}
+
+	if (strncmp(request, "gopher://", 9) == 0) {
+		if (!parse_gopher_address(request, host, &port, selector, &type)) {
+			sprintf(error, "3Invalid gopher URL\t\terror.host\t1\r\n.\r\n");
+			write_all(client, error, strlen(error));
+			return;
+		}
+		if (!proxy_allows(host, port, default_host, default_port)) {
+			sprintf(error, "3Refusing to relay to port %d\t\terror.host\t1\r\n.\r\n", port);
+			write_all(client, error, strlen(error));
+			fprintf(stderr, "deny  %s\n", request);
+			return;
+		}
+	} else if (default_host) {
+		strcpy(host, default_host);
+		port = default_port;
+		strncpy(selector, request, sizeof(selector) - 1);
+		selector[sizeof(selector) - 1] = '\0';
+	} else {
+		sprintf(error, "3No upstream server configured\t\terror.host\t1\r\n.\r\n");
+		write_all(client, error, strlen(error));
+		return;
+	}
+
+	body = fetch_resource(host, port, selector, FETCH_USE_CACHE | FETCH_ANY_MIRROR, &length);
+	if (!body) {
+		sprintf(error, "3%s\t\terror.host\t1\r\n.\r\n", g_fetch_error);
+		write_all(client, error, strlen(error));
+		fprintf(stderr, "fail  %s: %s\n", request, g_fetch_error);
+		return;
+	}
+
+	/* Only replies known to be menus are rewritten: a plain selector has no
+	 * type, except the empty one, which asks for the root menu. Anything
+	 * else, binaries included, passes through byte for byte. */
+	reply = body;
+	if ((type == '1' || type == '7' || (type == '\0' && selector[0] == '\0')) && proxy_host[0] != '\0') {
+		reply = rewrite_menu_for_proxy(body, proxy_host, proxy_port, default_host, default_port);
+		length = strlen(reply);
+	}
+
+	write_all(client, reply, length);
+	shared_cache_store(key, reply, length);
+	fprintf(stderr, "miss  %s (%lu bytes)\n", request, (unsigned long)length);
+
+	if (reply != body) free(reply);
+	free(body);
+}
+
+/* Runs tocaia as a caching Gopher server on `port`, listening on the
+ * address before the colon in `listen_address`, or on loopback when there
+ * is none. Each client is served by a forked process; all of them share
+ * one cache segment, so repeats are cache hits and identical concurrent
+ * requests reach upstream once. */
+void run_proxy(const char *listen_address, int port, const char *default_host, int default_port) {
+	struct sockaddr_in addr;
+	char temp_path[] = "/tmp/tocaia-proxy-XXXXXX";
+	char bind_host[MAX_HOST_LENGTH];
+	const char *colon = strrchr(listen_address, ':');
+	int listener, client, fd;
+	int yes = 1;
+
+	if (!g_shared_cache.header) {
+		/* No cache given: back one with an unlinked temporary file. */
+		fd = mkstemp(temp_path);
+		if (fd == -1 || !shared_cache_open(temp_path)) {
+			die("Error: Failed to create the proxy cache.");
+		}
+		close(fd);
+		unlink(temp_path);
+	}
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener == -1) {
+		die("Error: Failed to create the proxy socket.");
+	}
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	strcpy(bind_host, PROXY_DEFAULT_ADDRESS);
+	if (colon) {
+		if ((size_t)(colon - listen_address) >= sizeof(bind_host)) {
+			die("Error: The proxy address is too long.");
+		}
+		memcpy(bind_host, listen_address, colon - listen_address);
+		bind_host[colon - listen_address] = '\0';
+	}
+	addr.sin_addr.s_addr = inet_addr(bind_host);
+	if (addr.sin_addr.s_addr == (in_addr_t)-1) {
+		die("Error: The proxy address must be an IPv4 address such as 0.0.0.0.");
+	}
+	addr.sin_port = htons(port);
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listener, PROXY_BACKLOG) == -1) {
+		die("Error: Failed to listen on the proxy port.");
+	}
+
+	signal(SIGCHLD, SIG_IGN); /* Children are reaped automatically. */
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "Tocaia %s proxying Gopher on %s:%d\n", PROGRAM_VERSION, bind_host, port);
+
+	for (;;) {
+		client = accept(listener, NULL, NULL);
+		if (client == -1) {
+			if (errno == EINTR) continue;
+			die("Error: Failed to accept a proxy connection.");
+		}
+
+		if (fork() == 0) {
+			close(listener);
+			proxy_serve_client(client, port, default_host, default_port);
+			close(client);
+			_exit(EXIT_SUCCESS);
+		}
+		close(client);
+	}
+}
+
+/* Adds a hash to a set. Returns FALSE if it was already there. */
+BOOL hash_set_add(HashSet *set, unsigned long hash) {
+	unsigned long *old_slots;
+	unsigned long old_capacity;
+	unsigned long i;
+	unsigned long j;
+
+	if (!hash) hash = 1; /* 0 marks a free slot. */
+	if ((set->count + 1) * 2 > set->capacity) {
+		old_slots = set->slots;
+		old_capacity = set->capacity;
+		set->capacity = old_capacity ? old_capacity * 2 : HASH_SET_INITIAL;
+		set->slots = calloc(set->capacity, sizeof(unsigned long));
+		if (!set->slots) {
+			die("Error: Failed to allocate memory for a hash set.");
+		}
+		for (i = 0; i < old_capacity; i++) {
+			if (!old_slots[i]) continue;
+			for (j = old_slots[i]; set->slots[j & (set->capacity - 1)]; j++);
+			set->slots[j & (set->capacity - 1)] = old_slots[i];
+		}
+		free(old_slots);
+	}
+
+	for (i = hash; set->slots[i & (set->capacity - 1)]; i++) {
+		if (set->slots[i & (set->capacity - 1)] == hash) {
+			return FALSE;
+		}
+	}
+	set->slots[i & (set->capacity - 1)] = hash;
+	set->count++;
+	return TRUE;
+}
+
+/* Crawls gopherspace from `seeds` into the search index under `dir`, with
+ * `jobs` local worker processes. Work is split into shards by host hash and
+ * a shard is crawled by one worker at a time, so no host is fetched from
+ * twice at once. The directory holds everything the workers share, which
+ * lets more of them join from other machines that mount it:
+ *   shards          the shard count, fixed when the crawl is created
+ *   frontier.N      append-only "type TAB host TAB port TAB selector" lines
+ *   seen.N          4-byte hashes of the URLs shard N has fetched
+ *   cursor.N        how far into frontier.N the crawl has got
+ *   lock.N          locked by the worker crawling shard N
+ *   index/          the search index all workers add to
+ * Returns the exit status. */
+int run_crawl(const char *dir, char **seeds, int seed_count, int jobs, int shards, BOOL resync) {
+	char host[MAX_HOST_LENGTH];
+	char selector[MAX_SELECTOR_LENGTH];
+	char path[MAX_PATH_LENGTH];
+	int frontier_fds[CRAWL_MAX_SHARDS];
+	struct stat st;
+	char type;
+	int port;
+	int i;
+	pid_t pid;
+
+	if (strlen(dir) + 16 >= MAX_PATH_LENGTH || (mkdir(dir, 0700) == -1 && errno != EEXIST)) {
+		die("Error: Failed to create the crawl directory.");
+	}
+	sprintf(path, "%s/shards", dir);
+	if (resync && stat(path, &st) == -1) {
+		die("Error: --resync needs an existing crawl.");
+	}
+	shards = crawl_shard_count(dir, shards);
+	if (resync) {
+		for (i = 0; i < shards; i++) {
+			crawl_resync_start(dir, i);
+		}
+	}
+
+	/* Workers index into <dir>/index through the usual data directory. */
+	if (setenv("TOCAIA_HOME", dir, 1) == -1) {
+		die("Error: Failed to set the crawl directory.");
+	}
+
+	for (i = 0; i < CRAWL_MAX_SHARDS; i++) {
+		frontier_fds[i] = -1;
+	}
+	for (i = 0; i < seed_count; i++) {
+		if (!parse_gopher_address(seeds[i], host, &port, selector, &type)) {
+			fprintf(stderr, "tocaia: %s: Invalid Gopher address.\n", seeds[i]);
+			continue;
+		}
+		crawl_enqueue(dir, shards, frontier_fds, type ? type : '1', host, port, selector);
+	}
+	for (i = 0; i < CRAWL_MAX_SHARDS; i++) {
+		if (frontier_fds[i] != -1) close(frontier_fds[i]);
 	}
-	printf("%s", COLOR_RESET);
 
 	fflush(stdout);
+	for (i = 0; i < jobs; i++) {
+		pid = fork();
+		if (pid == -1) {
+			die("Error: Failed to start a crawl worker.");
+		}
+		if (pid == 0) {
+			crawl_worker(dir, shards);
+			_exit(EXIT_SUCCESS);
+		}
+	}
+	while (wait(NULL) > 0 || errno == EINTR);
+	return EXIT_SUCCESS;
+}
 
-	/* Wait for a key */
-	while (read(STDIN_FILENO, &c, 1) != 1);
+/* Reads the crawl's shard count, fixing it at `requested` for a new crawl. */
+int crawl_shard_count(const char *dir, int requested) {
+	char path[MAX_PATH_LENGTH];
+	char text[16];
+	ssize_t n;
+	int shards;
+	int fd;
+
+	sprintf(path, "%s/shards", dir);
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd != -1) {
+		sprintf(text, "%d\n", requested);
+		write_all(fd, text, strlen(text));
+		close(fd);
+		return requested;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || (n = read(fd, text, sizeof(text) - 1)) <= 0) {
+		die("Error: Failed to read the crawl's shard count.");
+	}
+	close(fd);
+	text[n] = '\0';
+	shards = atoi(text);
+	if (shards < 1 || shards > CRAWL_MAX_SHARDS) {
+		die("Error: The crawl's shard count is invalid.");
+	}
+	return shards;
 }
 
-/* Creates and initializes a new NavigationState node. */
-NavigationState* create_nav_state(const char *host, int port, const char *selector, char type) {
-	NavigationState *new_state = malloc(sizeof(NavigationState));
-	if (!new_state) {
-		die("Error: Failed to allocate memory for navigation state.");
+/* Starts a resync pass over a shard: the frontier is read again from the
+ * start with nothing seen, and the lines queued so far, before its current
+ * end saved in resync.N, only have their menus refetched. Run it while no
+ * worker is crawling. */
+void crawl_resync_start(const char *dir, int shard) {
+	char path[MAX_PATH_LENGTH];
+	char text[32];
+	struct stat st;
+	int fd;
+
+	sprintf(path, "%s/frontier.%d", dir, shard);
+	sprintf(text, "%ld\n", stat(path, &st) == 0 ? (long)st.st_size : 0L);
+	sprintf(path, "%s/resync.%d", dir, shard);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1 || write_all(fd, text, strlen(text)) == -1) {
+		die("Error: Failed to start the resync.");
 	}
+	close(fd);
+	sprintf(path, "%s/seen.%d", dir, shard);
+	truncate(path, 0);
+	sprintf(path, "%s/cursor.%d", dir, shard);
+	truncate(path, 0);
+}
 
-	strncpy(new_state->host, host, sizeof(new_state->host) - 1);
-	new_state->host[sizeof(new_state->host)-1] = '\0';
-	strncpy(new_state->selector, selector, sizeof(new_state->selector) - 1);
-	new_state->selector[sizeof(new_state->selector)-1] = '\0';
-	new_state->port = port;
-	new_state->page_content = NULL;
-	new_state->prev = NULL;
-	new_state->next = NULL;
-	new_state->type = type;
-	return new_state;
+/* Appends a URL to the frontier of the shard that owns its host. The append
+ * is locked, so lines from workers on other machines never interleave. */
+void crawl_enqueue(const char *dir, int shards, int *frontier_fds, char type, const char *host, int port, const char *selector) {
+	char path[MAX_PATH_LENGTH];
+	char line[MAX_URL_INPUT_LENGTH + 16];
+	int shard = (int)(hash_host_key(host, port) % shards);
+
+	if (frontier_fds[shard] == -1) {
+		sprintf(path, "%s/frontier.%d", dir, shard);
+		frontier_fds[shard] = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+		if (frontier_fds[shard] == -1) {
+			return;
+		}
+	}
+	sprintf(line, "%c\t%s\t%d\t%s\n", type, host, port, selector);
+	lock_file_range(frontier_fds[shard], F_WRLCK, 0, 0);
+	write_all(frontier_fds[shard], line, strlen(line));
+	lock_file_range(frontier_fds[shard], F_UNLCK, 0, 0);
 }
 
-/* Frees all `NavigationState` nodes in the forward history. */
-void free_forward_history(NavigationState *current_state) {
-	NavigationState *temp;
-	NavigationState *forward_node = current_state ? current_state->next : NULL;
+/* Crawls whichever shards are free and have work, one claim at a time, so
+ * any number of workers can share any number of shards. Stops once no
+ * shard has had new work for CRAWL_IDLE_MS. */
+void crawl_worker(const char *dir, int shards) {
+	CrawlShard *states;
+	HashSet enqueued;
+	int frontier_fds[CRAWL_MAX_SHARDS];
+	unsigned long pages = 0;
+	unsigned long queued = 0;
+	unsigned long idle_since = get_elapsed_ms();
+	int first = (int)(getpid() % shards);
+	BOOL progress;
+	int i;
 
-	while (forward_node) {
-		temp = forward_node;
-		forward_node = temp->next;
-		if (temp->page_content) {
-			free(temp->page_content);
+	states = calloc(shards, sizeof(CrawlShard));
+	if (!states) {
+		die("Error: Failed to allocate memory for crawl shards.");
+	}
+	memset(&enqueued, 0, sizeof(enqueued));
+	for (i = 0; i < CRAWL_MAX_SHARDS; i++) {
+		frontier_fds[i] = -1;
+	}
+
+	for (;;) {
+		progress = FALSE;
+		for (i = 0; i < shards; i++) {
+			if (crawl_shard(dir, shards, (first + i) % shards, &states[(first + i) % shards], &enqueued,
+			                frontier_fds, &pages, &queued)) {
+				progress = TRUE;
+			}
+		}
+		if (progress) {
+			idle_since = get_elapsed_ms();
+		} else if (get_elapsed_ms() - idle_since >= CRAWL_IDLE_MS) {
+			break;
+		} else {
+			usleep(CRAWL_POLL_MS * 1000);
 		}
-		free(temp);
 	}
-	if (current_state) {
-		current_state->next = NULL;
+
+	fprintf(stderr, "Crawl worker %ld: %lu pages fetched, %lu links queued.\n", (long)getpid(), pages, queued);
+	for (i = 0; i < CRAWL_MAX_SHARDS; i++) {
+		if (frontier_fds[i] != -1) close(frontier_fds[i]);
+	}
+	for (i = 0; i < shards; i++) {
+		free(states[i].seen.slots);
+	}
+	free(states);
+	free(enqueued.slots);
+}
+
+/* Claims a shard if no other worker holds it, and crawls up to
+ * CRAWL_BATCH_PAGES of its frontier from the saved cursor. Fetched pages go
+ * to the search index. Menus are also kept in the page store, and only the
+ * links on lines that differ from the kept copy go to the frontiers of their
+ * own shards. Below the resync offset, only menus are fetched again.
+ * Returns TRUE if any frontier line was consumed. */
+BOOL crawl_shard(const char *dir, int shards, int shard, CrawlShard *state, HashSet *enqueued,
+                 int *frontier_fds, unsigned long *pages, unsigned long *queued) {
+	char path[MAX_PATH_LENGTH];
+	char key[MAX_CACHE_KEY_LENGTH];
+	char text[32];
+	char *buffer;
+	char *newline;
+	char *body;
+	char *fields[4];
+	char *menu_line;
+	char *menu_end;
+	const char *old;
+	const char *old_end;
+	const char *line_end;
+	unsigned char record[4];
+	unsigned long hash;
+	unsigned long fetched = 0;
+	NavigationState nav;
+	GopherItem item;
+	HashSet old_lines;
+	struct flock fl;
+	off_t cursor = 0;
+	off_t resync = 0;
+	off_t start;
+	size_t length = 0;
+	size_t body_length;
+	size_t old_length;
+	size_t map_length;
+	void *map;
+	ssize_t n;
+	int lock_fd;
+	int seen_fd;
+	int frontier_fd;
+	int cursor_fd;
+	int i;
+
+	sprintf(path, "%s/lock.%d", dir, shard);
+	lock_fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (lock_fd == -1) {
+		return FALSE;
+	}
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	if (fcntl(lock_fd, F_SETLK, &fl) == -1) {
+		close(lock_fd); /* Another worker has it. */
+		return FALSE;
+	}
+
+	/* Catch up on what other workers fetched for this shard. */
+	sprintf(path, "%s/seen.%d", dir, shard);
+	seen_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+	sprintf(path, "%s/cursor.%d", dir, shard);
+	cursor_fd = open(path, O_RDWR | O_CREAT, 0600);
+	sprintf(path, "%s/frontier.%d", dir, shard);
+	frontier_fd = open(path, O_RDONLY | O_CREAT, 0600);
+	buffer = malloc(CRAWL_READ_SIZE + 1);
+	if (seen_fd == -1 || cursor_fd == -1 || frontier_fd == -1 || !buffer) {
+		die("Error: Failed to open the crawl shard.");
+	}
+	lseek(seen_fd, state->seen_offset, SEEK_SET);
+	while (read(seen_fd, record, sizeof(record)) == sizeof(record)) {
+		hash_set_add(&state->seen, get_u32(record));
+	}
+	if ((n = read(cursor_fd, text, sizeof(text) - 1)) > 0) {
+		text[n] = '\0';
+		cursor = (off_t)strtol(text, NULL, 10);
+	}
+	lseek(frontier_fd, cursor, SEEK_SET);
+	start = cursor;
+	sprintf(path, "%s/resync.%d", dir, shard);
+	if ((i = open(path, O_RDONLY)) != -1) {
+		if ((n = read(i, text, sizeof(text) - 1)) > 0) {
+			text[n] = '\0';
+			resync = (off_t)strtol(text, NULL, 10);
+		}
+		close(i);
+	}
+
+	while (fetched < CRAWL_BATCH_PAGES) {
+		newline = memchr(buffer, '\n', length);
+		if (!newline) {
+			if (length == CRAWL_READ_SIZE) {
+				cursor += length; /* No line is this long: skip it. */
+				length = 0;
+			}
+			n = read(frontier_fd, buffer + length, CRAWL_READ_SIZE - length);
+			if (n <= 0) {
+				break;
+			}
+			length += n;
+			continue;
+		}
+		*newline = '\0';
+
+		/* type TAB host TAB port TAB selector */
+		fields[0] = buffer;
+		for (i = 1; i < 4 && (fields[i] = strchr(fields[i - 1], '\t')) != NULL; i++) {
+			*fields[i]++ = '\0';
+		}
+		if (i == 4 && strlen(fields[1]) < MAX_HOST_LENGTH && strlen(fields[3]) < MAX_SELECTOR_LENGTH) {
+			memset(&nav, 0, sizeof(nav));
+			nav.type = fields[0][0];
+			strcpy(nav.host, fields[1]);
+			nav.port = atoi(fields[2]);
+			strcpy(nav.selector, fields[3]);
+			make_cache_key(nav.host, nav.port, nav.selector, key);
+			hash = hash_bytes(key, strlen(key));
+
+			/* Items queued before a resync are only fetched again if a
+			 * menu lists them differently, which queues them anew. They
+			 * are not marked seen, so that later line is not skipped. */
+			if ((cursor >= resync || nav.type == '1') && hash_set_add(&state->seen, hash)) {
+				put_u32(record, hash);
+				write_all(seen_fd, (const char *)record, sizeof(record));
+
+				body = fetch_resource(nav.host, nav.port, nav.selector, 0, &body_length);
+				fetched++;
+				if (body) {
+					(*pages)++;
+					search_index_page(&nav, body, body_length, nav.type == '1');
+					memset(&old_lines, 0, sizeof(old_lines));
+					if (nav.type == '1') {
+						map = page_store_map(key, &old, &old_length, &map_length);
+						if (map) {
+							for (old_end = old + old_length; old < old_end; old = line_end + 1) {
+								line_end = memchr(old, '\n', old_end - old);
+								if (!line_end) line_end = old_end;
+								hash_set_add(&old_lines, hash_bytes(old, line_end - old));
+							}
+							munmap(map, map_length);
+						}
+						if (body_length <= PAGE_STORE_MAX_SIZE) {
+							page_store_write(key, body, body_length);
+						}
+					}
+					for (menu_line = body; nav.type == '1' && *menu_line; menu_line = menu_end + 1) {
+						menu_end = strchr(menu_line, '\n');
+						if (menu_end) *menu_end = '\0';
+						if (hash_set_add(&old_lines, hash_bytes(menu_line, strlen(menu_line))) &&
+						        parse_gopher_line(menu_line, &item, nav.host, nav.port) && item.is_selectable &&
+						        (item.type == '0' || item.type == '1') && strchr(item.selector, '\t') == NULL &&
+						        hash_set_add(enqueued, item.link_hash)) {
+							crawl_enqueue(dir, shards, frontier_fds, item.type, item.host, item.port, item.selector);
+							(*queued)++;
+						}
+						if (!menu_end) break;
+					}
+					free(old_lines.slots);
+					free(body);
+				}
+			}
+		}
+
+		cursor += newline + 1 - buffer;
+		length -= newline + 1 - buffer;
+		memmove(buffer, newline + 1, length);
+	}
+
+	/* Save the cursor before the lock goes, so the next owner resumes here. */
+	sprintf(text, "%ld\n", (long)cursor);
+	lseek(cursor_fd, 0, SEEK_SET);
+	write_all(cursor_fd, text, strlen(text));
+	ftruncate(cursor_fd, (off_t)strlen(text));
+	state->seen_offset = lseek(seen_fd, 0, SEEK_END);
+
+	free(buffer);
+	close(frontier_fd);
+	close(cursor_fd);
+	close(seen_fd);
+	close(lock_fd);
+	return cursor != start;
+}
+
+/* Checks gophermaps against the rules parse_gopher_line() applies. Local
+ * files are cut into chunks and remote trees into menus, and both are
+ * spread over forked workers. Problems stream to stdout as
+ * "source TAB line TAB check TAB detail". Returns the exit status. */
+int run_lint(char **targets, int target_count, int jobs, const char *internal_host) {
+	LintRun run;
+	LintWorker *worker;
+	struct stat st;
+	char host[MAX_HOST_LENGTH];
+	char selector[MAX_SELECTOR_LENGTH];
+	char root[MAX_PATH_LENGTH];
+	char *slash;
+	char *record;
+	char *newline;
+	char type;
+	int port;
+	int busy;
+	int next;
+	int max_fd;
+	int i;
+	ssize_t n;
+	fd_set read_fds;
+
+	memset(&run, 0, sizeof(run));
+	run.internal_host = internal_host;
+	if (jobs > LINT_MAX_WORKERS) jobs = LINT_MAX_WORKERS;
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < target_count; i++) {
+		if (stat(targets[i], &st) == 0) {
+			if (strlen(targets[i]) >= MAX_PATH_LENGTH) {
+				lint_report(&run, targets[i], 0, "unreadable", "The path is too long.");
+			} else if (S_ISDIR(st.st_mode)) {
+				lint_collect(&run, targets[i], targets[i]);
+			} else {
+				/* Selectors in a lone file resolve against its directory. */
+				strcpy(root, targets[i]);
+				slash = strrchr(root, '/');
+				if (slash) {
+					*slash = '\0';
+				} else {
+					strcpy(root, ".");
+				}
+				lint_add_local(&run, targets[i], root);
+			}
+		} else if (parse_gopher_address(targets[i], host, &port, selector, &type)) {
+			lint_mark_seen(&run, host, port, selector);
+			lint_add_menu(&run, host, port, selector, -1, 0);
+		} else {
+			lint_report(&run, targets[i], 0, "unreadable", "No such file or Gopher address.");
+		}
+	}
+
+	for (;;) {
+		/* Hand queued units to idle workers, forking more up to `jobs`. */
+		busy = 0;
+		for (i = 0; i < jobs; i++) {
+			worker = &run.workers[i];
+			if (!worker->busy && (next = lint_next_unit(&run)) != -1) {
+				if (i == run.worker_count) {
+					lint_start_worker(&run, worker);
+					run.worker_count++;
+				}
+				/* Take the unit out by swapping it with the head. */
+				worker->unit = run.queue[next];
+				run.queue[next] = run.queue[run.queue_head++];
+				run.queue_count--;
+				worker->started_ms = get_elapsed_ms();
+				worker->host_failed = FALSE;
+				if (write_all(worker->command_fd, (const char *)&worker->unit, sizeof(LintUnit)) != sizeof(LintUnit)) {
+					die("Error: Failed to hand work to a lint worker.");
+				}
+				worker->busy = TRUE;
+			}
+			if (worker->busy) busy++;
+		}
+		if (busy == 0) {
+			break;
+		}
+
+		FD_ZERO(&read_fds);
+		max_fd = -1;
+		for (i = 0; i < run.worker_count; i++) {
+			if (run.workers[i].busy) {
+				FD_SET(run.workers[i].result_fd, &read_fds);
+				if (run.workers[i].result_fd > max_fd) max_fd = run.workers[i].result_fd;
+			}
+		}
+		if (select(max_fd + 1, &read_fds, NULL, NULL, NULL) < 0) {
+			if (errno == EINTR) continue;
+			die("Error: Failed to wait for lint workers.");
+		}
+
+		for (i = 0; i < run.worker_count; i++) {
+			worker = &run.workers[i];
+			if (!worker->busy || !FD_ISSET(worker->result_fd, &read_fds)) {
+				continue;
+			}
+			if (worker->length + 4096 > worker->capacity) {
+				worker->capacity = worker->capacity ? worker->capacity * 2 : 65536;
+				worker->buffer = realloc(worker->buffer, worker->capacity);
+				if (!worker->buffer) {
+					die("Error: Failed to allocate memory for lint results.");
+				}
+			}
+			n = read(worker->result_fd, worker->buffer + worker->length, worker->capacity - worker->length);
+			if (n <= 0) {
+				if (n < 0 && errno == EINTR) continue;
+				die("Error: A lint worker exited unexpectedly.");
+			}
+			worker->length += n;
+
+			/* Act on every complete record; keep the partial tail. */
+			record = worker->buffer;
+			while ((newline = memchr(record, '\n', worker->buffer + worker->length - record)) != NULL) {
+				*newline = '\0';
+				lint_handle_record(&run, worker, record);
+				record = newline + 1;
+			}
+			worker->length -= record - worker->buffer;
+			memmove(worker->buffer, record, worker->length);
+		}
+	}
+
+	for (i = 0; i < run.worker_count; i++) {
+		close(run.workers[i].command_fd);
+		close(run.workers[i].result_fd);
+		waitpid(run.workers[i].pid, NULL, 0);
+		free(run.workers[i].buffer);
+	}
+	for (i = 0; i < run.file_count; i++) {
+		free(run.files[i].name);
+		free(run.files[i].chunks);
+	}
+	free(run.files);
+	free(run.queue);
+	free(run.seen.slots);
+
+	fflush(stdout);
+	fprintf(stderr, "%d file%s, %ld lines checked, %ld issue%s found.\n", run.file_count,
+	        run.file_count == 1 ? "" : "s", run.lines, run.issues, run.issues == 1 ? "" : "s");
+	for (i = 0; i < target_count; i++) {
+		if (stat(targets[i], &st) == -1 && parse_gopher_address(targets[i], host, &port, selector, &type)) {
+			fprintf(stderr, "%s:%d: up to %d parallel fetches.\n", host, port,
+			        host_concurrency_limit(hash_host_key(host, port)));
+		}
 	}
+	return run.issues ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-/* Frees the entire navigation history linked list. */
-void free_navigation_history(NavigationState *current_state) {
-	NavigationState *head = current_state;
-	NavigationState *temp;
-	if (!head) {
+/* Queues every gophermap under a directory: files named "gophermap" or
+ * ending in ".gph". Symbolic links are not followed. */
+void lint_collect(LintRun *run, const char *path, const char *root) {
+	DIR *dir = opendir(path);
+	struct dirent *entry;
+	struct stat st;
+	char child[MAX_PATH_LENGTH];
+	size_t name_length;
+
+	if (!dir) {
+		lint_report(run, path, 0, "unreadable", strerror(errno));
 		return;
 	}
-
-	/* Find the head of the list. */
-	while (head->prev) {
-		head = head->prev;
-	}
-
-	/* Traverse from the head and free each node. */
-	while (head) {
-		temp = head;
-		head = temp->next;
-		if (temp->page_content) {
-			free(temp->page_content);
+	while ((entry = readdir(dir)) != NULL) {
+		name_length = strlen(entry->d_name);
+		if (entry->d_name[0] == '.' || strlen(path) + name_length + 2 > sizeof(child)) {
+			continue;
+		}
+		sprintf(child, "%s/%s", path, entry->d_name);
+		if (lstat(child, &st) == -1) {
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			lint_collect(run, child, root);
+		} else if (S_ISREG(st.st_mode) && (strcmp(entry->d_name, "gophermap") == 0 ||
+		           (name_length > 4 && strcmp(entry->d_name + name_length - 4, ".gph") == 0))) {
+			lint_add_local(run, child, root);
 		}
-		free(temp);
 	}
+	closedir(dir);
 }
 
-/* Navigates to a new Gopher address and adds it to the history. */
-void navigate_to(AppState *state, const char *host, int port, const char *selector, char type) {
-	NavigationState *new_state = create_nav_state(host, port, selector, type);
+/* Picks the next unit to hand out: the oldest of the first
+ * LINT_SCHEDULE_WINDOW queued whose host is below its concurrency limit.
+ * Returns its queue index, or -1 if none may start yet. */
+int lint_next_unit(LintRun *run) {
+	unsigned long host_hash;
+	int in_flight;
+	int i;
+	int j;
 
-	if (state->current_nav) {
-		free_forward_history(state->current_nav);
-		state->current_nav->next = new_state;
-		new_state->prev = state->current_nav;
+	for (i = run->queue_head; i < run->queue_head + run->queue_count && i < run->queue_head + LINT_SCHEDULE_WINDOW; i++) {
+		if (run->queue[i].kind == LINT_LOCAL) {
+			return i;
+		}
+		host_hash = hash_host_key(run->queue[i].host, run->queue[i].port);
+		in_flight = 0;
+		for (j = 0; j < run->worker_count; j++) {
+			if (run->workers[j].busy && run->workers[j].unit.kind != LINT_LOCAL &&
+			        hash_host_key(run->workers[j].unit.host, run->workers[j].unit.port) == host_hash) {
+				in_flight++;
+			}
+		}
+		if (in_flight < host_concurrency_limit(host_hash)) {
+			return i;
+		}
 	}
-	state->current_nav = new_state;
-
-	/* Reset view state for the new page. */
-	state->selected_index = 1;
-	state->scroll_offset = 0;
-	state->text_scroll_line = 0;
+	return -1;
 }
 
-/* Moves the navigation back one step in the history. */
-void navigate_back(AppState *state) {
-	if (state->current_nav && state->current_nav->prev) {
-		state->current_nav = state->current_nav->prev;
-		state->selected_index = 1;
-		state->scroll_offset = 0;
-		state->text_scroll_line = 0;
+/* Adds a file to report on. Returns its index. */
+int lint_add_file(LintRun *run, const char *name, int chunk_count) {
+	LintFile *file;
+
+	if (run->file_count == run->file_capacity) {
+		run->file_capacity = run->file_capacity ? run->file_capacity * 2 : 64;
+		run->files = realloc(run->files, run->file_capacity * sizeof(LintFile));
+		if (!run->files) {
+			die("Error: Failed to allocate memory for lint files.");
+		}
 	}
+	file = &run->files[run->file_count];
+	memset(file, 0, sizeof(LintFile));
+	file->name = malloc(strlen(name) + 1);
+	file->chunks = calloc(chunk_count, sizeof(LintChunk));
+	if (!file->name || !file->chunks) {
+		die("Error: Failed to allocate memory for lint files.");
+	}
+	strcpy(file->name, name);
+	file->chunk_count = chunk_count;
+	return run->file_count++;
 }
 
-/* Moves the navigation forward one step in the history. */
-void navigate_forward(AppState *state) {
-	if (state->current_nav && state->current_nav->next) {
-		state->current_nav = state->current_nav->next;
-		state->selected_index = 1;
-		state->scroll_offset = 0;
-		state->text_scroll_line = 0;
+/* Appends a unit to the work queue. */
+void lint_queue(LintRun *run, const LintUnit *unit) {
+	if (run->queue_head + run->queue_count == run->queue_capacity) {
+		if (run->queue_head > 0) {
+			memmove(run->queue, run->queue + run->queue_head, run->queue_count * sizeof(LintUnit));
+			run->queue_head = 0;
+		} else {
+			run->queue_capacity = run->queue_capacity ? run->queue_capacity * 2 : 64;
+			run->queue = realloc(run->queue, run->queue_capacity * sizeof(LintUnit));
+			if (!run->queue) {
+				die("Error: Failed to allocate memory for the lint queue.");
+			}
+		}
 	}
+	run->queue[run->queue_head + run->queue_count++] = *unit;
 }
 
-/* Sets the terminal to "raw" mode for direct key input handling. */
-void setup_terminal_for_app(void) {
-	struct termios raw;
-
-	tcgetattr(STDIN_FILENO, &g_original_termios);
-	raw = g_original_termios;
-	/* ICANON: disable canonical mode.
-	 * ECHO: disable echoing input characters.
-	 * ISIG: disable signal-generating characters (e.g., Ctrl-C). */
-	raw.c_lflag &= ~(ICANON | ECHO | ISIG);
-	tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+/* Queues a local gophermap, one unit per LINT_CHUNK_SIZE bytes. */
+void lint_add_local(LintRun *run, const char *path, const char *root) {
+	LintUnit unit;
+	struct stat st;
+	int chunk_count;
+	int i;
 
-	signal(SIGWINCH, handle_resize_signal);
-	signal(SIGINT, handle_sigint_signal);
-	set_cursor_visibility(0); /* Hide cursor */
+	if (stat(path, &st) == -1) {
+		lint_report(run, path, 0, "unreadable", strerror(errno));
+		return;
+	}
+	chunk_count = (int)((st.st_size + LINT_CHUNK_SIZE - 1) / LINT_CHUNK_SIZE);
+	if (chunk_count < 1) chunk_count = 1;
+
+	memset(&unit, 0, sizeof(unit));
+	unit.kind = LINT_LOCAL;
+	unit.file = lint_add_file(run, path, chunk_count);
+	unit.ref_file = -1;
+	strcpy(unit.path, path);
+	strcpy(unit.root, root);
+	for (i = 0; i < chunk_count; i++) {
+		unit.chunk = i;
+		unit.start = (off_t)i * LINT_CHUNK_SIZE;
+		unit.end = (i == chunk_count - 1) ? st.st_size : unit.start + LINT_CHUNK_SIZE;
+		lint_queue(run, &unit);
+	}
 }
 
-/* Restores the terminal to its original state.*/
-void restore_terminal(void) {
-	tcsetattr(STDIN_FILENO, TCSAFLUSH, &g_original_termios);
-	clear_terminal();
-	move_cursor(1,1);
-	set_cursor_visibility(1); /* Show cursor */
-	printf("%s", COLOR_RESET); /* Reset any lingering colors. */
+/* Queues a remote menu. Its problems are reported under its URL, and a
+ * failure to fetch it against the line that links to it. */
+void lint_add_menu(LintRun *run, const char *host, int port, const char *selector, int ref_file, long ref_line) {
+	LintUnit unit;
+	char url[MAX_URL_INPUT_LENGTH + 8];
+
+	memset(&unit, 0, sizeof(unit));
+	sprintf(url, "gopher://%s:%d/1%s", host, port, selector);
+	unit.kind = LINT_MENU;
+	unit.file = lint_add_file(run, url, 1);
+	unit.ref_file = ref_file;
+	unit.ref_line = ref_line;
+	strcpy(unit.host, host);
+	unit.port = port;
+	strcpy(unit.selector, selector);
+	unit.type = '1';
+	lint_queue(run, &unit);
 }
 
-/* Signal handler for terminal window resizing (SIGWINCH). */
-void handle_resize_signal(int sig) {
-	(void)sig; /* Unused parameter */
-	g_resize_pending = 1;
-}
+/* Records a remote link. Returns FALSE if it was seen before. */
+BOOL lint_mark_seen(LintRun *run, const char *host, int port, const char *selector) {
+	char key[MAX_CACHE_KEY_LENGTH];
 
-/* Signal handler for interrupt signals (SIGINT / Ctrl+C). */
-void handle_sigint_signal(int sig) {
-	(void)sig; /* Unused parameter */
-	restore_terminal();
-	exit(EXIT_SUCCESS);
+	make_cache_key(host, port, selector, key);
+	return hash_set_add(&run->seen, hash_bytes(key, strlen(key)));
 }
 
-/* Controls the visibility of the terminal cursor using ANSI escape codes. */
-void set_cursor_visibility(int visible) {
-	printf("\033[?25%c", visible ? 'h' : 'l');
-	fflush(stdout);
-}
+/* Forks a worker connected to the parent by a command and a result pipe. */
+void lint_start_worker(LintRun *run, LintWorker *worker) {
+	int command_pipe[2];
+	int result_pipe[2];
+	int i;
 
-/* Clears the entire terminal screen. */
-void clear_terminal(void) {
-	printf("\033[H\033[J");
+	if (pipe(command_pipe) == -1 || pipe(result_pipe) == -1) {
+		die("Error: Failed to create lint worker pipes.");
+	}
 	fflush(stdout);
-}
-
-/* Clears a single line in the terminal by overwriting with spaces.*/
-void clear_line(int row, int term_width) {
-	char *clear_str = malloc(term_width + 1);
-	if (clear_str) {
-		memset(clear_str, ' ', term_width);
-		clear_str[term_width] = '\0';
-		move_cursor(row, 1);
-		printf("%s", clear_str);
-		free(clear_str);
+	worker->pid = fork();
+	if (worker->pid == -1) {
+		die("Error: Failed to start a lint worker.");
+	}
+	if (worker->pid == 0) {
+		for (i = 0; i < run->worker_count; i++) {
+			close(run->workers[i].command_fd);
+			close(run->workers[i].result_fd);
+		}
+		close(command_pipe[1]);
+		close(result_pipe[0]);
+		lint_worker_main(command_pipe[0], result_pipe[1], run->internal_host);
+		_exit(EXIT_SUCCESS);
 	}
+	close(command_pipe[0]);
+	close(result_pipe[1]);
+	worker->command_fd = command_pipe[1];
+	worker->result_fd = result_pipe[0];
+	worker->busy = FALSE;
+	worker->length = 0;
 }
 
-void move_cursor(int row, int col) {
-	printf("\033[%d;%dH", row, col);
-}
+/* Worker loop: lints units until the parent closes the command pipe.
+ * Each unit is answered by its records, then an E record with line counts:
+ *   I line TAB check TAB detail                       a problem
+ *   M line TAB type TAB port TAB host TAB selector     an internal remote link
+ *   D reason                                           the unit could not be read
+ *   N reason                                           the server answered with an error
+ *   E lines TAB crlf TAB lf TAB first crlf TAB first lf */
+void lint_worker_main(int command_fd, int result_fd, const char *internal_host) {
+	FILE *out = fdopen(result_fd, "w");
+	LintUnit unit;
+	LintChunk counts;
+	struct stat st;
+	struct timeval tv;
+	fd_set read_fds;
+	char *data;
+	char reply[512];
+	char reason[128];
+	size_t got;
+	size_t length;
+	ssize_t n;
+	int fd;
+
+	if (!out) {
+		die("Error: Failed to open the lint result pipe.");
+	}
+	for (;;) {
+		got = 0;
+		while (got < sizeof(unit) && (n = read(command_fd, (char *)&unit + got, sizeof(unit) - got)) > 0) {
+			got += n;
+		}
+		if (got < sizeof(unit)) {
+			break;
+		}
+		memset(&counts, 0, sizeof(counts));
+
+		if (unit.kind == LINT_LOCAL) {
+			fd = open(unit.path, O_RDONLY);
+			if (fd == -1 || fstat(fd, &st) == -1) {
+				fprintf(out, "D\t%s\n", strerror(errno));
+			} else if (st.st_size > 0) {
+				/* Map the whole file so lines may run past the chunk end. */
+				data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data == MAP_FAILED) {
+					fprintf(out, "D\t%s\n", strerror(errno));
+				} else {
+					posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+					lint_range(out, data, st.st_size, unit.start, unit.end < st.st_size ? unit.end : st.st_size,
+					           &unit, internal_host, &counts);
+					munmap(data, st.st_size);
+				}
+			}
+			if (fd != -1) close(fd);
+		} else if (unit.kind == LINT_MENU) {
+			data = fetch_resource(unit.host, unit.port, unit.selector, 0, &length);
+			if (!data) {
+				fprintf(out, "D\t%s\n", g_fetch_error);
+			} else if (lint_error_reply(data, length, reason)) {
+				fprintf(out, "N\t%s\n", reason);
+				free(data);
+			} else {
+				lint_range(out, data, length, 0, length, &unit, internal_host, &counts);
+				free(data);
+			}
+		} else {
+			/* A probe only needs the start of the answer. */
+			fd = connect_and_send_request(unit.host, unit.port, unit.selector);
+			if (fd == -1) {
+				fprintf(out, "D\t%s\n", g_fetch_error);
+			} else {
+				FD_ZERO(&read_fds);
+				FD_SET(fd, &read_fds);
+				tv.tv_sec = CONNECT_TIMEOUT_MS / 1000;
+				tv.tv_usec = 0;
+				if (select(fd + 1, &read_fds, NULL, NULL, &tv) <= 0) {
+					fprintf(out, "D\tThe host stopped responding.\n");
+				} else if ((n = read(fd, reply, sizeof(reply))) <= 0) {
+					fprintf(out, "D\tThe host sent nothing back.\n");
+				} else if (lint_error_reply(reply, n, reason)) {
+					fprintf(out, "N\t%s\n", reason);
+				}
+				close(fd);
+			}
+		}
 
-void print_string_at(const char *str, int row, int col) {
-	move_cursor(row, col);
-	printf("%s", str);
+		fprintf(out, "E\t%ld\t%ld\t%ld\t%ld\t%ld\n", counts.lines, counts.crlf_lines, counts.lf_lines,
+		        counts.first_crlf, counts.first_lf);
+		fflush(out);
+	}
+	fclose(out);
 }
 
-void print_centered_string(const char *str, int row, int term_width) {
-	int len = strlen(str);
-	int start_col = (term_width - len) / 2;
-	if (start_col < 1) start_col = 1;
-	print_string_at(str, row, start_col);
-}
+/* Lints the lines that start within [start, end) of a buffer. Line numbers
+ * are relative to the first of them. */
+void lint_range(FILE *out, const char *data, size_t length, size_t start, size_t end,
+                const LintUnit *unit, const char *internal_host, LintChunk *counts) {
+	const char *newline;
+	char *line = NULL;
+	size_t capacity = 0;
+	size_t line_length;
+	size_t pos = start;
+
+	/* A line that straddles the chunk start belongs to the previous chunk. */
+	if (pos > 0 && data[pos - 1] != '\n') {
+		newline = memchr(data + pos, '\n', length - pos);
+		pos = newline ? (size_t)(newline - data) + 1 : length;
+	}
 
-/* Helper function that ensures all bytes from a buffer are written. */
-int write_all(int fd, const char* buffer, size_t len) {
-	size_t bytes_sent = 0;
-	ssize_t n_sent;
+	while (pos < end) {
+		newline = memchr(data + pos, '\n', length - pos);
+		line_length = newline ? (size_t)(newline - (data + pos)) : length - pos;
+		counts->lines++;
+		if (newline) {
+			if (line_length > 0 && data[pos + line_length - 1] == '\r') {
+				if (counts->crlf_lines++ == 0) counts->first_crlf = counts->lines;
+			} else if (counts->lf_lines++ == 0) {
+				counts->first_lf = counts->lines;
+			}
+		}
 
-	while (bytes_sent < len) {
-		n_sent = write(fd, buffer + bytes_sent, len - bytes_sent);
-		if (n_sent == -1) {
-			if (errno == EINTR) {
-				continue; /* Interrupted by a signal, try again */
+		if (line_length + 1 > capacity) {
+			capacity = (line_length + 1) * 2;
+			line = realloc(line, capacity);
+			if (!line) {
+				die("Error: Failed to allocate memory for a gophermap line.");
 			}
-			return -1; /* A real error occurred */
 		}
-		bytes_sent += n_sent;
+		memcpy(line, data + pos, line_length);
+		line[line_length] = '\0';
+		lint_line(out, line, line_length, counts->lines, unit, internal_host);
+
+		pos = newline ? (size_t)(newline - data) + 1 : length;
 	}
-	return bytes_sent;
+	free(line);
 }
 
-/* Connects to a Gopher server and sends a selector request */
-int connect_and_send_request(const char *host, int port, const char *selector) {
-	int sock = -1;
-	struct hostent *he;
-	struct sockaddr_in server_addr;
-	char request[MAX_SELECTOR_LENGTH + 3]; /* selector + CRLF + null */
-	char **p;
-	size_t request_len;
+/* Checks one gophermap line. Field problems are found on the raw line;
+ * links are judged on what parse_gopher_line() makes of it. */
+void lint_line(FILE *out, char *line, size_t length, long line_no, const LintUnit *unit, const char *internal_host) {
+	const char *field[5];
+	size_t field_length[5];
+	int field_count = 0;
+	const char *tab;
+	const char *p;
+	char path[MAX_PATH_LENGTH + MAX_SELECTOR_LENGTH + 1];
+	GopherItem item;
+	struct stat st;
+	long port = 0;
+	size_t i;
+
+	if (length > 0 && line[length - 1] == '\r') {
+		line[--length] = '\0';
+	}
+	if (length == 0 || strcmp(line, ".") == 0 || line[0] == 'i') {
+		return;
+	}
 
-	he = gethostbyname(host);
-	if (he == NULL) {
-		die("Error: Failed to resolve host");
+	for (p = line + 1; field_count < 5; p = tab + 1) {
+		tab = strchr(p, '\t');
+		field[field_count] = p;
+		field_length[field_count] = tab ? (size_t)(tab - p) : strlen(p);
+		field_count++;
+		if (!tab) break;
 	}
 
-	/* Iterates through the list of addresses returned by gethostbyname */
-	for (p = he->h_addr_list; *p != 0; p++) {
-		/* Creates a socket for each address */
-		if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-			perror("socket");
-			continue;
+	if (field_count < 4) {
+		fprintf(out, "I\t%ld\tmissing-fields\t%d of 4 fields after the type%s\n", line_no, field_count,
+		        field_count < 3 ? "; shown as plain text" : "; the port is assumed");
+	} else {
+		for (i = 0; i < field_length[3] && isdigit((unsigned char)field[3][i]) && i < 6; i++) {
+			port = port * 10 + (field[3][i] - '0');
 		}
-
-		memset(&server_addr, 0, sizeof(server_addr));
-		server_addr.sin_family = AF_INET;
-		server_addr.sin_port = htons(port);
-		memcpy(&server_addr.sin_addr, *p, sizeof(struct in_addr));
-
-		/* Tries to connect to the server */
-		if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) != -1) {
-			/* Connection successful! Exits the loop. */
-			break;
+		if (field_length[3] == 0 || i < field_length[3] || port < 1 || port > 65535) {
+			fprintf(out, "I\t%ld\tbad-port\t\"%.*s\" is not a port between 1 and 65535\n", line_no,
+			        field_length[3] > 32 ? 32 : (int)field_length[3], field[3]);
 		}
-
-		/* If the connection failed, closes the current socket and tries the next address. */
-		close(sock);
-		sock = -1;
 	}
-
-	if (sock == -1) {
-		die("Error: Could not connect to host");
+	if (field_length[0] >= MAX_DISPLAY_LENGTH) {
+		fprintf(out, "I\t%ld\tlong-display\t%lu bytes; clients keep %d\n", line_no,
+		        (unsigned long)field_length[0], MAX_DISPLAY_LENGTH - 1);
+	}
+	if (field_count >= 2 && field_length[1] >= MAX_SELECTOR_LENGTH) {
+		fprintf(out, "I\t%ld\tlong-selector\t%lu bytes; clients keep %d\n", line_no,
+		        (unsigned long)field_length[1], MAX_SELECTOR_LENGTH - 1);
+		return; /* The link as parsed is not the one written. */
+	}
+	if (field_count >= 3 && field_length[2] >= MAX_HOST_LENGTH) {
+		fprintf(out, "I\t%ld\tlong-host\t%lu bytes; clients keep %d\n", line_no,
+		        (unsigned long)field_length[2], MAX_HOST_LENGTH - 1);
+		return;
+	}
+	if (field_count < 3) {
+		return;
+	}
+	/* Locally, only links without a host, or to the host we serve, are
+	 * checked, so others need not be parsed at all. */
+	if (unit->kind == LINT_LOCAL && field_length[2] != 0 &&
+	        (!internal_host || strlen(internal_host) != field_length[2] ||
+	         strncmp(field[2], internal_host, field_length[2]) != 0)) {
+		return;
 	}
 
-	request_len = strlen(selector) + strlen(CRLF);
-	if (request_len >= sizeof(request)) {
-		die("Error: The request is too long.");
+	parse_gopher_line(line, &item, unit->kind == LINT_LOCAL ? "" : unit->host, unit->port);
+	if (!item.is_selectable || (item.type == 'h' && strncmp(item.selector, "URL:", 4) == 0)) {
+		return;
 	}
-	sprintf(request, "%s%s", selector, CRLF);
 
-	if (write_all(sock, request, request_len) != request_len) {
-		die("Error: Failed to send the request.");
+	if (unit->kind == LINT_LOCAL) {
+		sprintf(path, "%s%s%s", unit->root, item.selector[0] == '/' ? "" : "/", item.selector);
+		if (stat(path, &st) == -1) {
+			fprintf(out, "I\t%ld\tdead-link\t%s not found under %s\n", line_no, item.selector, unit->root);
+		}
+	} else if (strcmp(item.host, unit->host) == 0 && item.port == unit->port) {
+		fprintf(out, "M\t%ld\t%c\t%d\t%s\t%s\n", line_no, item.type, item.port, item.host, item.selector);
 	}
+}
 
-	return sock;
+/* Recognizes a server's error reply: a menu whose first item has type 3.
+ * Its display string becomes `reason`. */
+BOOL lint_error_reply(const char *data, size_t length, char *reason) {
+	const char *tab;
+
+	if (length < 2 || data[0] != '3' || (tab = memchr(data, '\t', length)) == NULL) {
+		return FALSE;
+	}
+	sprintf(reason, "The server answered: %.*s", (int)(tab - data - 1 > 100 ? 100 : tab - data - 1), data + 1);
+	return TRUE;
 }
 
-/* Receives all data from a socket until the connection is closed */
-char *receive_gopher_data(int sock) {
-	size_t buffer_size = INITIAL_BUFFER_SIZE;
-	char *buffer = (char*)malloc(buffer_size);
-	size_t total_bytes = 0;
-	ssize_t bytes_received;
-	char *new_buffer;
+/* Acts on one record from a worker. */
+void lint_handle_record(LintRun *run, LintWorker *worker, char *record) {
+	LintUnit *unit = &worker->unit;
+	LintChunk *chunk = NULL;
+	LintUnit probe;
+	char detail[MAX_URL_INPUT_LENGTH + 256];
+	char *host;
+	char *selector;
+	char *end;
+	char type;
+	size_t length;
+	long line;
+	int port;
 
-	if (!buffer) {
-		die("Error: Failed to allocate memory for receive buffer.");
+	if (unit->file >= 0) {
+		chunk = &run->files[unit->file].chunks[unit->chunk];
+	}
+	if (record[0] == '\0' || record[1] != '\t') {
+		return;
 	}
 
-	while ((bytes_received = read(sock, buffer + total_bytes, buffer_size - total_bytes - 1)) > 0) {
-		total_bytes += bytes_received;
-		if (total_bytes >= buffer_size - 1) {
-			buffer_size *= 2;
-			new_buffer = (char*)realloc(buffer, buffer_size);
-			if (!new_buffer) {
-				die("Error: Failed to reallocate memory for receive buffer.");
+	switch (record[0]) {
+	case 'I':
+		if (!chunk) break;
+		length = strlen(record + 2) + 1;
+		if (chunk->length + length > chunk->capacity) {
+			chunk->capacity = (chunk->length + length) * 2;
+			chunk->records = realloc(chunk->records, chunk->capacity);
+			if (!chunk->records) {
+				die("Error: Failed to allocate memory for lint results.");
 			}
-			buffer = new_buffer;
 		}
+		memcpy(chunk->records + chunk->length, record + 2, length - 1);
+		chunk->records[chunk->length + length - 1] = '\n';
+		chunk->length += length;
+		break;
+	case 'M':
+		line = strtol(record + 2, &end, 10);
+		if (end[0] != '\t' || end[1] == '\0' || end[2] != '\t') break;
+		type = end[1];
+		port = (int)strtol(end + 3, &host, 10);
+		if (*host++ != '\t' || (selector = strchr(host, '\t')) == NULL) break;
+		*selector++ = '\0';
+		if (strlen(host) >= MAX_HOST_LENGTH || strlen(selector) >= MAX_SELECTOR_LENGTH ||
+		        !lint_mark_seen(run, host, port, selector)) {
+			break;
+		}
+		if (type == '1') {
+			lint_add_menu(run, host, port, selector, unit->file, line);
+		} else {
+			memset(&probe, 0, sizeof(probe));
+			probe.kind = LINT_PROBE;
+			probe.file = -1;
+			probe.ref_file = unit->file;
+			probe.ref_line = line;
+			strcpy(probe.host, host);
+			probe.port = port;
+			strcpy(probe.selector, selector);
+			probe.type = type;
+			lint_queue(run, &probe);
+		}
+		break;
+	case 'D':
+	case 'N':
+		worker->host_failed = (record[0] == 'D' && unit->kind != LINT_LOCAL);
+		if (unit->ref_file >= 0) {
+			sprintf(detail, "gopher://%s:%d/%c%s: %.200s", unit->host, unit->port, unit->type, unit->selector, record + 2);
+			lint_report(run, run->files[unit->ref_file].name, unit->ref_line, "dead-link", detail);
+		} else if (unit->file >= 0) {
+			lint_report(run, run->files[unit->file].name, 0,
+			            unit->kind == LINT_LOCAL ? "unreadable" : "unreachable", record + 2);
+		}
+		fflush(stdout);
+		break;
+	case 'E':
+		worker->busy = FALSE;
+		if (unit->kind != LINT_LOCAL) {
+			host_concurrency_record(hash_host_key(unit->host, unit->port), worker->host_failed,
+			                        get_elapsed_ms() - worker->started_ms);
+		}
+		if (!chunk) break;
+		sscanf(record + 2, "%ld\t%ld\t%ld\t%ld\t%ld", &chunk->lines, &chunk->crlf_lines, &chunk->lf_lines,
+		       &chunk->first_crlf, &chunk->first_lf);
+		chunk->done = TRUE;
+		lint_flush_file(run, unit->file);
+		break;
 	}
+}
 
-	if (bytes_received < 0) {
-		die("Error: Failed to read from socket.");
-	}
+/* Prints one problem. */
+void lint_report(LintRun *run, const char *name, long line, const char *check, const char *detail) {
+	printf("%s\t%ld\t%s\t%s\n", name, line, check, detail);
+	run->issues++;
+}
 
-	buffer[total_bytes] = '\0';
-	return buffer;
+/* Reports the finished chunks at the front of a file, in order, and the
+ * line ending check once the whole file is in. */
+void lint_flush_file(LintRun *run, int file) {
+	LintFile *f = &run->files[file];
+	LintChunk *chunk;
+	char detail[128];
+	char *record;
+	char *newline;
+	char *check;
+	char *tab;
+	long line;
+
+	while (f->next_chunk < f->chunk_count && f->chunks[f->next_chunk].done) {
+		chunk = &f->chunks[f->next_chunk];
+		for (record = chunk->records; record && record < chunk->records + chunk->length; record = newline + 1) {
+			newline = memchr(record, '\n', chunk->records + chunk->length - record);
+			*newline = '\0';
+			line = strtol(record, &check, 10);
+			if (*check == '\t' && (tab = strchr(++check, '\t')) != NULL) {
+				*tab = '\0';
+				lint_report(run, f->name, f->base_line + line, check, tab + 1);
+			}
+		}
+		if (chunk->crlf_lines && !f->crlf_lines) f->first_crlf = f->base_line + chunk->first_crlf;
+		if (chunk->lf_lines && !f->lf_lines) f->first_lf = f->base_line + chunk->first_lf;
+		f->crlf_lines += chunk->crlf_lines;
+		f->lf_lines += chunk->lf_lines;
+		f->base_line += chunk->lines;
+		run->lines += chunk->lines;
+		free(chunk->records);
+		chunk->records = NULL;
+		f->next_chunk++;
+
+		if (f->next_chunk == f->chunk_count && f->crlf_lines && f->lf_lines) {
+			/* Point at the first line that breaks with the file's majority. */
+			BOOL mostly_crlf = f->crlf_lines >= f->lf_lines;
+			sprintf(detail, "%s line ending in a file that mostly uses %s (%ld of %ld lines)",
+			        mostly_crlf ? "LF" : "CRLF", mostly_crlf ? "CRLF" : "LF",
+			        mostly_crlf ? f->lf_lines : f->crlf_lines, f->crlf_lines + f->lf_lines);
+			lint_report(run, f->name, mostly_crlf ? f->first_lf : f->first_crlf, "mixed-line-endings", detail);
+		}
+	}
+	fflush(stdout);
 }
 
 void die(const char *message) {
@@ -1292,13 +8184,38 @@ void die(const char *message) {
 }
 
 void show_help(void) {
-	printf("Usage: tocaia [gopher_address]\n");
+	printf("Usage: tocaia [options] [gopher_address]\n");
 	printf("A command-line Gopher client.\n\n");
 	printf("Arguments:\n");
 	printf("  gopher_address  The Gopher server address. E.g., 'gopher.example.org', 'gopher://ex.org:70/1/dir'.\n\n");
 	printf("Options:\n");
 	printf("  -h, --help     Display this help message and exit.\n");
 	printf("  -v, --version  Display program version and exit.\n");
+	printf("  -c, --shared-cache PATH\n");
+	printf("                 Share a page cache with other tocaia processes through PATH.\n");
+	printf("  --budget SIZE  Data-saver mode: receive at most SIZE (e.g. 20M) this session,\n");
+	printf("                 prefer cached copies, even stale ones, and stop previews and\n");
+	printf("                 other speculative fetches when the budget runs low.\n");
+	printf("  --proxy [ADDR:]PORT\n");
+	printf("                 Serve Gopher on ADDR (default 127.0.0.1) and PORT, forwarding and\n");
+	printf("                 caching requests. Selectors may be gopher:// URLs on port 70 or\n");
+	printf("                 at gopher_address; others go to gopher_address.\n");
+	printf("  --lint TARGET...\n");
+	printf("                 Check gophermap files, directories of them, or remote menu trees\n");
+	printf("                 and print problems as 'source TAB line TAB check TAB detail'.\n");
+	printf("  --crawl DIR [gopher_address...]\n");
+	printf("                 Crawl from the given addresses into the search index in DIR/index,\n");
+	printf("                 or resume the crawl in DIR. Other machines may join by running\n");
+	printf("                 the same command on a shared DIR.\n");
+	printf("  --resync       With --crawl, refetch the menus of a finished crawl and fetch\n");
+	printf("                 only the items that are new or changed since.\n");
+	printf("  --shards N     Split a new crawl into N shards by host. Defaults to --jobs.\n");
+	printf("  -j, --jobs N   Number of lint or crawl workers. Defaults to twice the CPU count.\n");
+	printf("  --host NAME    With --lint, check local links to NAME as well as host-less ones.\n");
+	printf("  --watchdog     Log what the browser was doing to TOCAIA_HOME/watchdog.log\n");
+	printf("                 whenever typed keys go unread or a page is slow to arrive.\n");
+	printf("\nEnvironment:\n");
+	printf("  TOCAIA_HOME    Data directory for the search index. Defaults to ~/.tocaia.\n");
 }
 
 void show_version(void) {
@@ -1330,6 +8247,8 @@ const char* get_gopher_type_description(char type) {
 		return "<BINARY>";
 	case 'g':
 		return "<GIF>";
+	case 'I':
+		return "<IMAGE>";
 	case 'h':
 		return "<HTML>";
 	case 'i':
@@ -1363,6 +8282,7 @@ const char* get_gopher_item_color(char type, BOOL selected) {
 	case '8':
 		return TELNET_COLOR;
 	case 'g':
+	case 'I':
 		return GIF_COLOR;
 	case 'h':
 		return HTML_COLOR;